@@ -0,0 +1,22 @@
+import compaqt
+import timeit
+import os
+
+iterations = 10
+
+def benchmark(name, value):
+    print(name)
+
+    for checksum in (False, True):
+        encoded = compaqt.encode(value, checksum=checksum)
+
+        encode_time = min(timeit.repeat(lambda: compaqt.encode(value, checksum=checksum), number=iterations, repeat=5)) / iterations
+        decode_time = min(timeit.repeat(lambda: compaqt.decode(encoded), number=iterations, repeat=5)) / iterations
+        validate_time = min(timeit.repeat(lambda: compaqt.validate(encoded), number=iterations, repeat=5)) / iterations
+
+        label = 'Checksummed' if checksum else 'Regular'
+        print(f"  {label:<11}: {len(encoded):>9} bytes | Encode: {encode_time * 1e3:.3f} ms | Decode: {decode_time * 1e3:.3f} ms | Validate: {validate_time * 1e3:.3f} ms")
+
+# Verifying the checksum adds a pass over the data, which matters most for data that is quick to decode
+benchmark('Records', [{'id': i, 'name': f'user{i}', 'roles': ['read', 'write'], 'active': i % 3 == 0} for i in range(50000)])
+benchmark('Large bytes', [os.urandom(1024 * 1024) for _ in range(16)])
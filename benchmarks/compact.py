@@ -0,0 +1,26 @@
+import compaqt
+import timeit
+import random
+
+iterations = 20
+
+random.seed(0)
+
+def benchmark(name, value):
+    print(name)
+
+    for compact in (False, True):
+        encoded = compaqt.encode(value, compact_numbers=compact)
+
+        encode_time = min(timeit.repeat(lambda: compaqt.encode(value, compact_numbers=compact), number=iterations, repeat=5)) / iterations
+        decode_time = min(timeit.repeat(lambda: compaqt.decode(encoded), number=iterations, repeat=5)) / iterations
+
+        label = 'Compact' if compact else 'Regular'
+        print(f"  {label}: {len(encoded):>9} bytes | Encode: {encode_time * 1e3:.3f} ms | Decode: {decode_time * 1e3:.3f} ms")
+
+# Telemetry-like data: floats with few significant bits and small signed deltas
+benchmark('Float32-exact floats', [random.randrange(-4096, 4096) / 16 for _ in range(100000)])
+benchmark('Arbitrary floats', [random.random() for _ in range(100000)])
+benchmark('Small signed deltas', [random.randrange(-64, 64) for _ in range(100000)])
+benchmark('Mid-sized integers', [random.randrange(-2**20, 2**20) for _ in range(100000)])
+benchmark('Records', [{'time': i, 'delta': random.randrange(-100, 100), 'value': random.randrange(1024) / 8} for i in range(30000)])
@@ -0,0 +1,36 @@
+import compaqt
+import timeit
+import random
+import zlib
+
+iterations = 10
+
+random.seed(0)
+
+def benchmark(name, value):
+    print(name)
+
+    for compress in (False, True):
+        encoded = compaqt.encode(value, compress=compress)
+
+        encode_time = min(timeit.repeat(lambda: compaqt.encode(value, compress=compress), number=iterations, repeat=5)) / iterations
+        decode_time = min(timeit.repeat(lambda: compaqt.decode(encoded), number=iterations, repeat=5)) / iterations
+
+        label = 'Compressed' if compress else 'Regular'
+        print(f"  {label:<10}: {len(encoded):>9} bytes | Encode: {encode_time * 1e3:.3f} ms | Decode: {decode_time * 1e3:.3f} ms")
+
+    # Compressing the regular encoded data with an external codec afterwards, for comparison
+    encoded = compaqt.encode(value)
+    compressed = zlib.compress(encoded, 1)
+
+    encode_time = min(timeit.repeat(lambda: zlib.compress(compaqt.encode(value), 1), number=iterations, repeat=5)) / iterations
+    decode_time = min(timeit.repeat(lambda: compaqt.decode(zlib.decompress(compressed)), number=iterations, repeat=5)) / iterations
+
+    print(f"  {'zlib (1)':<10}: {len(compressed):>9} bytes | Encode: {encode_time * 1e3:.3f} ms | Decode: {decode_time * 1e3:.3f} ms")
+
+# Records with the same keys and repeated strings compress well
+benchmark('Records', [{'id': i, 'name': f'user{i}', 'roles': ['read', 'write'], 'active': i % 3 == 0} for i in range(50000)])
+benchmark('Log lines', [f'{i:08d} INFO request handled in {random.randrange(100)} ms' for i in range(50000)])
+
+# Random data doesn't get smaller, and is kept as is after a quick attempt
+benchmark('Random bytes', random.randbytes(4 * 1024 * 1024))
@@ -0,0 +1,35 @@
+import compaqt
+import timeit
+
+# Number of iterations per benchmark
+iterations = 200
+
+def nested(depth, wrap):
+    value = 0
+    for _ in range(depth):
+        value = wrap(value)
+    return value
+
+values = {
+    # Deeply nested data, which used to be limited by the C stack
+    "Lists, 10k deep": nested(10_000, lambda v: [v]),
+    "Dicts, 10k deep": nested(10_000, lambda v: {"key": v}),
+    "Mixed, 10k deep": nested(10_000, lambda v: ({"key": [v, 1]},)),
+
+    # Wide and shallow data, which shouldn't be affected by the explicit stack
+    "Wide list of ints": list(range(100_000)),
+    "Wide list of dicts": [{"id": i, "name": "item", "tags": ["a", "b"]} for i in range(10_000)],
+    "Wide list of lists": [[i, i + 1, i + 2] for i in range(30_000)],
+}
+
+def benchmark(name, value):
+    encoded = compaqt.encode(value)
+
+    enc_time = timeit.timeit(lambda: compaqt.encode(value), number=iterations) / iterations
+    dec_time = timeit.timeit(lambda: compaqt.decode(encoded), number=iterations) / iterations
+    val_time = timeit.timeit(lambda: compaqt.validate(encoded), number=iterations) / iterations
+
+    print(f"{name:<20} | Encode: {enc_time * 1e6:9.1f} us | Decode: {dec_time * 1e6:9.1f} us | Validate: {val_time * 1e6:9.1f} us")
+
+for name, value in values.items():
+    benchmark(name, value)
@@ -0,0 +1,26 @@
+import compaqt
+import timeit
+
+iterations = 2000
+
+class Custom:
+    def __init__(self, value):
+        self.value = value
+
+custom_types = compaqt.types.encoder_types({
+    0: (Custom, lambda v: v.value),
+})
+
+def benchmark(name, value, **kwargs):
+    total = min(timeit.repeat(lambda: compaqt.encode(value, **kwargs), number=iterations, repeat=5))
+    per_object = total / iterations / len(value) * 1e9
+
+    print(f"{name:<24} {per_object:.2f} ns/object")
+
+print(f"Iterations: {iterations}")
+
+# Cheap values of every type, so that dispatching makes up most of the cost
+benchmark('Mixed types', [1, 1.0, 'a', b'a', True, None, [], {}] * 1000)
+benchmark('Integers', [1] * 8000)
+benchmark('Custom types', [Custom(b'a')] * 8000, custom_types=custom_types)
+benchmark('Custom and mixed types', [Custom(b'a'), 1, 'a', None] * 2000, custom_types=custom_types)
@@ -0,0 +1,30 @@
+import compaqt
+import timeit
+import sys
+
+# Largest payload size to benchmark, in bytes. Pass a smaller value as argument on systems with less memory
+max_size = int(sys.argv[1]) if len(sys.argv) > 1 else 1024**3
+
+# Per-item string of 32 bytes, encoded as 33 bytes with metadata
+item = 'x' * 32
+
+def benchmark(size):
+    value = [item] * (size // 33)
+
+    # Use fewer iterations for larger payloads to keep the total time reasonable
+    iterations = max(1, (1024**2 * 64) // size)
+
+    # Small allocation sizes make the predicted allocation far off, so the buffer has to grow a lot
+    compaqt.settings.manual_allocations(1, 64)
+
+    total = timeit.timeit(lambda: compaqt.encode(value), number=iterations)
+    per_byte = (total / iterations) / size * 1e9
+
+    print(f"Size: {size:>12} bytes | Encode: {total / iterations:.6f} s | {per_byte:.3f} ns/byte")
+
+size = 1024
+while size <= max_size:
+    benchmark(size)
+    size *= 4
+
+compaqt.settings.dynamic_allocations()
@@ -0,0 +1,25 @@
+import compaqt
+import timeit
+import random
+
+iterations = 200
+
+random.seed(0)
+
+def benchmark(name, value):
+    encoded = compaqt.encode(value)
+
+    encode_time = min(timeit.repeat(lambda: compaqt.encode(value), number=iterations, repeat=5))
+    decode_time = min(timeit.repeat(lambda: compaqt.decode(encoded), number=iterations, repeat=5))
+
+    encode_per_int = encode_time / iterations / len(value) * 1e9
+    decode_per_int = decode_time / iterations / len(value) * 1e9
+
+    print(f"{name:<24} Encode: {encode_per_int:.2f} ns/int | Decode: {decode_per_int:.2f} ns/int")
+
+print(f"Iterations: {iterations}")
+
+# Cached small ints, regular ints that still fit in a single digit, and ints that need the full 8 bytes
+benchmark('Small (0-255)', [random.randrange(256) for _ in range(100000)])
+benchmark('Up to 2^30', [random.randrange(-2**30, 2**30) for _ in range(100000)])
+benchmark('Up to 2^62', [random.randrange(-2**62, 2**62) for _ in range(100000)])
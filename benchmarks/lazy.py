@@ -0,0 +1,22 @@
+import compaqt
+import timeit
+
+iterations = 10
+
+def benchmark(name, value, access):
+    print(name)
+
+    encoded = compaqt.encode(value)
+
+    eager_time = min(timeit.repeat(lambda: access(compaqt.decode(encoded)), number=iterations, repeat=5)) / iterations
+    lazy_time = min(timeit.repeat(lambda: access(compaqt.decode(encoded, lazy=True)), number=iterations, repeat=5)) / iterations
+
+    print(f"  {len(encoded):>9} bytes | Eager: {eager_time * 1e3:.3f} ms | Lazy: {lazy_time * 1e3:.3f} ms")
+
+# Reading a few fields out of a large document only decodes those fields, but still skips over everything before them
+catalog = [{'id': i, 'name': f'item{i}', 'price': i / 7, 'tags': ['a', 'b', 'c']} for i in range(100_000)]
+
+benchmark('Catalog item', catalog, lambda doc: doc[50_000]['name'])
+benchmark('Full iteration', catalog, lambda doc: [item['id'] for item in doc])
+benchmark('Config before catalog', {'config': {'name': 'shop', 'version': 3}, 'catalog': catalog}, lambda doc: doc['config']['name'])
+benchmark('Config after catalog', {'catalog': catalog, 'config': {'name': 'shop', 'version': 3}}, lambda doc: doc['config']['name'])
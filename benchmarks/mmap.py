@@ -0,0 +1,23 @@
+import compaqt
+import timeit
+import os
+
+iterations = 5
+file_name = 'benchmark_mmap.bin'
+
+def benchmark(name, value):
+    print(name)
+    compaqt.encode(value, file_name=file_name)
+
+    for referenced in (False, True):
+        for mmap in (False, True):
+            decode_time = min(timeit.repeat(lambda: compaqt.decode(file_name=file_name, mmap=mmap, referenced=referenced), number=iterations, repeat=5)) / iterations
+
+            label = ('Mapped' if mmap else 'Read') + (' (referenced)' if referenced else '')
+            print(f"  {label:<19}: {os.path.getsize(file_name):>9} bytes | Decode: {decode_time * 1e3:.3f} ms")
+
+# Mapping the file skips copying it into a buffer, which matters most for large strings and bytes that are referenced directly
+benchmark('Records', [{'id': i, 'name': f'user{i}', 'roles': ['read', 'write'], 'active': i % 3 == 0} for i in range(50000)])
+benchmark('Large bytes', [os.urandom(1024 * 1024) for _ in range(64)])
+
+os.remove(file_name)
@@ -0,0 +1,23 @@
+import compaqt
+import timeit
+
+iterations = 20
+
+def benchmark(name, value):
+    print(name)
+
+    for preserve in (False, True):
+        encoded = compaqt.encode(value, preserve_refs=preserve)
+
+        encode_time = min(timeit.repeat(lambda: compaqt.encode(value, preserve_refs=preserve), number=iterations, repeat=5)) / iterations
+        decode_time = min(timeit.repeat(lambda: compaqt.decode(encoded), number=iterations, repeat=5)) / iterations
+
+        label = 'References' if preserve else 'Regular'
+        print(f"  {label:<10}: {len(encoded):>9} bytes | Encode: {encode_time * 1e3:.3f} ms | Decode: {decode_time * 1e3:.3f} ms")
+
+# Cached object graph, where many records point to a few shared objects
+users = [{'name': f'user{i}', 'roles': ['read', 'write'], 'settings': {'theme': 'dark', 'limits': list(range(20))}} for i in range(50)]
+benchmark('Shared objects', [{'id': i, 'owner': users[i % 50], 'watchers': users[:10]} for i in range(5000)])
+
+# Data without any sharing, which only pays for the identity lookups
+benchmark('No sharing', [{'id': i, 'tags': ['a', 'b'], 'meta': {'score': i / 7}} for i in range(20000)])
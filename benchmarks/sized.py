@@ -0,0 +1,27 @@
+import compaqt
+import timeit
+
+iterations = 10
+
+def benchmark(name, value, access):
+    print(name)
+
+    plain = compaqt.encode(value)
+    sized = compaqt.encode(value, sized=True)
+
+    encode_time = min(timeit.repeat(lambda: compaqt.encode(value), number=iterations, repeat=5)) / iterations
+    sized_encode_time = min(timeit.repeat(lambda: compaqt.encode(value, sized=True), number=iterations, repeat=5)) / iterations
+
+    plain_time = min(timeit.repeat(lambda: access(compaqt.decode(plain, lazy=True)), number=iterations, repeat=5)) / iterations
+    sized_time = min(timeit.repeat(lambda: access(compaqt.decode(sized, lazy=True)), number=iterations, repeat=5)) / iterations
+
+    print(f"  Encode | Plain: {len(plain):>9} bytes, {encode_time * 1e3:.3f} ms | Sized: {len(sized):>9} bytes, {sized_encode_time * 1e3:.3f} ms")
+    print(f"  Lazy   | Plain: {plain_time * 1e3:.3f} ms | Sized: {sized_time * 1e3:.3f} ms")
+
+# Lazily decoded items are found by skipping over the ones before them, which sized lists and dicts do without reading their items
+catalog = [{'id': i, 'name': f'item{i}', 'price': i / 7, 'tags': ['a', 'b', 'c']} for i in range(100_000)]
+
+benchmark('Catalog item', catalog, lambda doc: doc[50_000]['name'])
+benchmark('Last catalog item', catalog, lambda doc: doc[-1]['name'])
+benchmark('Full iteration', catalog, lambda doc: [item['id'] for item in doc])
+benchmark('Config after catalog', {'catalog': catalog, 'config': {'name': 'shop', 'version': 3}}, lambda doc: doc['config']['name'])
@@ -0,0 +1,85 @@
+import compaqt
+import os
+import sys
+import time
+from threading import Thread
+
+# Validating larger values and reading or writing files doesn't hold the GIL, so these scale with the number of threads.
+# Encoding and decoding hold it, also on free-threaded builds of Python, which enable the GIL for the module
+print(f"GIL enabled: {getattr(sys, '_is_gil_enabled', lambda: True)()}")
+
+value = [{'id': i, 'name': f'item{i}', 'scores': [i / 3, i / 7], 'tags': ['a', 'b', 'c']} for i in range(20000)]
+encoded = compaqt.encode(value)
+iterations = 20
+
+def run(name, func, nthreads):
+    threads = [Thread(target=lambda: [func(i) for _ in range(iterations)]) for i in range(nthreads)]
+
+    start = time.perf_counter()
+    for t in threads: t.start()
+    for t in threads: t.join()
+    elapsed = time.perf_counter() - start
+
+    print(f"  {name:<14}: {nthreads} threads | {nthreads * iterations / elapsed:8.1f} calls/s")
+
+def encode(i):
+    compaqt.encode(value)
+
+def decode(i):
+    compaqt.decode(encoded)
+
+def validate(i):
+    compaqt.validate(encoded)
+
+def validate_file(i):
+    compaqt.validate(file_name=f'bench_threads_{i}.bin')
+
+def encode_file(i):
+    compaqt.encode(value, file_name=f'bench_threads_{i}.bin')
+
+for nthreads in (1, 2, 4):
+    for i in range(nthreads):
+        compaqt.encode(value, file_name=f'bench_threads_{i}.bin')
+
+    run('Encode', encode, nthreads)
+    run('Decode', decode, nthreads)
+    run('Validate', validate, nthreads)
+    run('Validate file', validate_file, nthreads)
+    run('Encode file', encode_file, nthreads)
+
+    for i in range(nthreads):
+        os.remove(f'bench_threads_{i}.bin')
+
+# Sub-interpreters with their own GIL (Python 3.12+) each import their own copy of the module, so encoding and decoding
+# scale with the number of interpreters on builds with the GIL as well
+try:
+    import _interpreters as interpreters
+    create_interpreter = lambda: interpreters.create('isolated')
+except ImportError:
+    try:
+        import _xxsubinterpreters as interpreters
+        create_interpreter = lambda: interpreters.create(isolated=True)
+    except ImportError:
+        interpreters = None
+
+if interpreters is not None:
+    code = f"""
+import compaqt
+value = [{{'id': i, 'name': f'item{{i}}', 'scores': [i / 3, i / 7], 'tags': ['a', 'b', 'c']}} for i in range(20000)]
+for _ in range({iterations}):
+    compaqt.decode(compaqt.encode(value))
+"""
+
+    for ninterps in (1, 2, 4):
+        interps = [create_interpreter() for _ in range(ninterps)]
+        threads = [Thread(target=interpreters.run_string, args=(interp, code)) for interp in interps]
+
+        start = time.perf_counter()
+        for t in threads: t.start()
+        for t in threads: t.join()
+        elapsed = time.perf_counter() - start
+
+        for interp in interps:
+            interpreters.destroy(interp)
+
+        print(f"  {'Interpreters':<14}: {ninterps} interps  | {ninterps * iterations / elapsed:8.1f} round trips/s")
@@ -3,5 +3,5 @@ __license__ = "BSD-3-Clause"
 __url__ = "https://github.com/svenboertjens/compaqt"
 __doc__ = "For usage details, see <https://github.com/svenboertjens/compaqt/blob/main/USAGE.md> or consult the USAGE file directly from the module directory"
 
-from .compaqt import encode, decode, settings, StreamEncoder, StreamDecoder, validate, types
+from .compaqt import encode, encode_into, encoded_size, Encoder, decode, settings, StreamEncoder, StreamDecoder, validate, types, EncodingError, BufferSizeError, DecodingError, LazyList, LazyDict
 
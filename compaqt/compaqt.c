@@ -2,6 +2,7 @@
 
 #include <Python.h>
 
+#include "main/serialization.h"
 #include "main/regular.h"
 #include "main/stream.h"
 #include "main/validation.h"
@@ -9,20 +10,25 @@
 #include "types/usertypes.h"
 #include "types/cbytes.h"
 #include "types/cstr.h"
+#include "types/lazy.h"
 
 #include "settings/allocations.h"
 
-#include "globals/exceptions.h"
+#include "globals/modstate.h"
 
 /* MODULE DEFINITIONS */
 
 // Main module methods
 static PyMethodDef CompaqtMethods[] = {
     {"encode", (PyCFunction)encode, METH_VARARGS | METH_KEYWORDS, NULL},
+    {"encode_into", (PyCFunction)encode_into, METH_VARARGS | METH_KEYWORDS, NULL},
+    {"encoded_size", (PyCFunction)encoded_size, METH_VARARGS | METH_KEYWORDS, NULL},
     {"decode", (PyCFunction)decode, METH_VARARGS | METH_KEYWORDS, NULL},
 
     {"validate", (PyCFunction)validate, METH_VARARGS | METH_KEYWORDS, NULL},
 
+    {"Encoder", (PyCFunction)get_encoder, METH_VARARGS | METH_KEYWORDS, NULL},
+
     {"StreamEncoder", (PyCFunction)get_stream_encoder, METH_VARARGS | METH_KEYWORDS, NULL},
     {"StreamDecoder", (PyCFunction)get_stream_decoder, METH_VARARGS | METH_KEYWORDS, NULL},
 
@@ -33,19 +39,11 @@ static PyMethodDef CompaqtMethods[] = {
 static PyMethodDef SettingsMethods[] = {
     {"manual_allocations", (PyCFunction)manual_allocations, METH_VARARGS, NULL},
     {"dynamic_allocations", (PyCFunction)dynamic_allocations, METH_VARARGS | METH_KEYWORDS, NULL},
+    {"buffer_growth", (PyCFunction)buffer_growth, METH_VARARGS | METH_KEYWORDS, NULL},
 
     {NULL, NULL, 0, NULL}
 };
 
-// SETTINGS object
-static PyTypeObject settings_obj = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "compaqt.settings",
-    .tp_basicsize = sizeof(PyObject),
-    .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_methods = SettingsMethods,
-};
-
 // TYPES methods
 static PyMethodDef TypesMethods[] = {
     {"encoder_types", (PyCFunction)get_utypes_encode_ob, METH_VARARGS, NULL},
@@ -54,98 +52,208 @@ static PyMethodDef TypesMethods[] = {
     {NULL, NULL, 0, NULL}
 };
 
-// TYPES object
-static PyTypeObject types_obj = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "compaqt.types",
-    .tp_basicsize = sizeof(PyObject),
-    .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_methods = TypesMethods,
-};
+/* MODULE STATE */
 
-// Main module
-static struct PyModuleDef compaqt = {
-    PyModuleDef_HEAD_INIT,
-    "compaqt",
-    NULL,
-    -1,
-    CompaqtMethods
-};
+// Apply `action` to all objects held by the module state
+#define STATE_OBJECTS(action) do { \
+    action(state->encoding_error); \
+    action(state->buffer_size_error); \
+    action(state->decoding_error); \
+    action(state->validation_error); \
+    action(state->file_offset_error); \
+    action(state->encoder_type); \
+    action(state->stream_encoder_type); \
+    action(state->stream_decoder_type); \
+    action(state->utypes_encode_type); \
+    action(state->utypes_decode_type); \
+    action(state->cbytes_type); \
+    action(state->cstr_type); \
+    action(state->lazy_list_type); \
+    action(state->lazy_dict_type); \
+    action(state->array_type); \
+} while (0)
 
-// Module init function
-PyMODINIT_FUNC PyInit_compaqt(void) {
-    /* PREPARE CUSTOM TYPES */
+static int compaqt_traverse(PyObject *m, visitproc visit, void *arg)
+{
+    module_state_t *state = MODULE_STATE(m);
 
-    if (PyType_Ready(&settings_obj) < 0)
-        return NULL;
-    
-    if (PyType_Ready(&types_obj) < 0)
-        return NULL;
-    if (PyType_Ready(&utypes_encode_t) < 0)
-        return NULL;
-    if (PyType_Ready(&utypes_decode_t) < 0)
-        return NULL;
-    
-    if (PyType_Ready(&stream_encoder_t) < 0)
-        return NULL;
-    if (PyType_Ready(&stream_decoder_t) < 0)
-        return NULL;
-    
-    if (PyType_Ready(&cbytes_t) < 0)
-        return NULL;
-    if (PyType_Ready(&cstr_t) < 0)
+    if (state != NULL)
+        STATE_OBJECTS(Py_VISIT);
+
+    return 0;
+}
+
+static int compaqt_clear(PyObject *m)
+{
+    module_state_t *state = MODULE_STATE(m);
+
+    if (state != NULL)
+        STATE_OBJECTS(Py_CLEAR);
+
+    return 0;
+}
+
+static void compaqt_free(void *m)
+{
+    compaqt_clear((PyObject *)m);
+}
+
+/* MODULE SETUP */
+
+// Create a type from its spec. The module creates all instances itself, and sets the buffer functions on versions that don't support them in specs
+static PyTypeObject *create_type(PyType_Spec *spec, PyBufferProcs *buffer)
+{
+    PyTypeObject *type = (PyTypeObject *)PyType_FromSpec(spec);
+
+    if (type == NULL)
         return NULL;
 
-    /* CREATE MAIN MODULE */
-    
-    PyObject *m = PyModule_Create(&compaqt);
-    if (m == NULL)
+    #if (PY_VERSION_HEX < 0x030A0000)
+    type->tp_new = NULL;
+    #endif
+
+    #ifndef Py_bf_getbuffer
+    if (buffer != NULL)
+        *type->tp_as_buffer = *buffer;
+    #else
+    (void)buffer;
+    #endif
+
+    return type;
+}
+
+// Create a namespace object holding the functions in `methods`, which receive the main module as `self` to reach its state
+static PyObject *create_namespace(PyObject *m, const char *name, PyMethodDef *methods)
+{
+    PyObject *namespace = PyModule_New(name);
+
+    if (namespace == NULL)
         return NULL;
-    
-    /* CREATE CUSTOM OBJECTS */
-    
-    PyObject *settings = PyObject_New(PyObject, &settings_obj);
-    PyObject *types = PyObject_New(PyObject, &types_obj);
-
-    EncodingError = PyErr_NewException("compaqt.EncodingError", NULL, NULL);
-    DecodingError = PyErr_NewException("compaqt.DecodingError", NULL, NULL);
-    ValidationError = PyErr_NewException("compaqt.ValidationError", NULL, NULL);
-    FileOffsetError = PyErr_NewException("compaqt.FileOffsetError", NULL, NULL);
-
-    // Check if any object is NULL
+
+    for (PyMethodDef *def = methods; def->ml_name != NULL; ++def)
+    {
+        PyObject *func = PyCFunction_NewEx(def, m, NULL);
+
+        if (func == NULL || PyModule_AddObject(namespace, def->ml_name, func) != 0)
+        {
+            Py_XDECREF(func);
+            Py_DECREF(namespace);
+            return NULL;
+        }
+    }
+
+    return namespace;
+}
+
+// Add an object to the module without stealing the reference, as the module state keeps its own
+static int add_object(PyObject *m, const char *name, PyObject *ob)
+{
+    Py_INCREF(ob);
+
+    if (PyModule_AddObject(m, name, ob) == 0)
+        return 0;
+
+    Py_DECREF(ob);
+    return -1;
+}
+
+// Module exec function, which runs for every (sub-)interpreter that imports the module. Everything created here is cleared with the module state on failure
+static int compaqt_exec(PyObject *m)
+{
+    module_state_t *state = MODULE_STATE(m);
+
+    /* CREATE TYPES */
+
     if (
-        settings        == NULL ||
-        types           == NULL ||
+        (state->utypes_encode_type  = create_type(&utypes_encode_spec, NULL)) == NULL ||
+        (state->utypes_decode_type  = create_type(&utypes_decode_spec, NULL)) == NULL ||
+        (state->encoder_type        = create_type(&encoder_spec, NULL))       == NULL ||
+        (state->stream_encoder_type = create_type(&stream_encoder_spec, NULL)) == NULL ||
+        (state->stream_decoder_type = create_type(&stream_decoder_spec, NULL)) == NULL ||
+        (state->cbytes_type         = create_type(&cbytes_spec, &cbytes_as_buffer)) == NULL ||
+        (state->cstr_type           = create_type(&cstr_spec, &cstr_asbuffer)) == NULL ||
+        (state->lazy_list_type      = create_type(&lazy_list_spec, NULL)) == NULL ||
+        (state->lazy_dict_type      = create_type(&lazy_dict_spec, NULL)) == NULL
+    )
+        return -1;
+
+    /* PREPARE TYPE DISPATCH AND SETTINGS */
+
+    if (setup_dispatch(state) == 1)
+        return -1;
 
-        EncodingError   == NULL ||
-        DecodingError   == NULL ||
-        ValidationError == NULL ||
-        FileOffsetError == NULL
+    setup_allocation_settings(state);
+
+    /* CREATE EXCEPTIONS */
+
+    if (
+        (state->encoding_error    = PyErr_NewException("compaqt.EncodingError", NULL, NULL)) == NULL ||
+        (state->buffer_size_error = PyErr_NewException("compaqt.BufferSizeError", state->encoding_error, NULL)) == NULL ||
+        (state->decoding_error    = PyErr_NewException("compaqt.DecodingError", NULL, NULL)) == NULL ||
+        (state->validation_error  = PyErr_NewException("compaqt.ValidationError", NULL, NULL)) == NULL ||
+        (state->file_offset_error = PyErr_NewException("compaqt.FileOffsetError", NULL, NULL)) == NULL
     )
+        return -1;
+
+    /* ADD CUSTOM OBJECTS */
+
+    PyObject *settings = create_namespace(m, "compaqt.settings", SettingsMethods);
+
+    if (settings == NULL || PyModule_AddObject(m, "settings", settings) != 0)
     {
-        // Cleanup any successfully created types and return NULL
         Py_XDECREF(settings);
-        Py_XDECREF(types);
+        return -1;
+    }
 
-        Py_XDECREF(EncodingError);
-        Py_XDECREF(DecodingError);
-        Py_XDECREF(ValidationError);
-        Py_XDECREF(FileOffsetError);
+    PyObject *types = create_namespace(m, "compaqt.types", TypesMethods);
 
-        Py_DECREF(m);
-        return NULL;
+    if (types == NULL || PyModule_AddObject(m, "types", types) != 0)
+    {
+        Py_XDECREF(types);
+        return -1;
     }
-    
-    /* ADD CUSTOM OBJECTS */
 
-    PyModule_AddObject(m, "settings", settings);
-    PyModule_AddObject(m, "types", types);
-
-    PyModule_AddObject(m, "EncodingError", EncodingError);
-    PyModule_AddObject(m, "DecodingError", DecodingError);
-    PyModule_AddObject(m, "ValidationError", ValidationError);
-    PyModule_AddObject(m, "FileOffsetError", FileOffsetError);
+    if (
+        add_object(m, "EncodingError", state->encoding_error) != 0 ||
+        add_object(m, "BufferSizeError", state->buffer_size_error) != 0 ||
+        add_object(m, "DecodingError", state->decoding_error) != 0 ||
+        add_object(m, "ValidationError", state->validation_error) != 0 ||
+        add_object(m, "FileOffsetError", state->file_offset_error) != 0 ||
+        add_object(m, "LazyList", (PyObject *)state->lazy_list_type) != 0 ||
+        add_object(m, "LazyDict", (PyObject *)state->lazy_dict_type) != 0
+    )
+        return -1;
 
-    return m;
+    return 0;
 }
 
+static PyModuleDef_Slot compaqt_slots[] = {
+    {Py_mod_exec, compaqt_exec},
+
+    // All state is kept per module, so each sub-interpreter can run with its own GIL
+    #ifdef Py_mod_multiple_interpreters
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+    #endif
+
+    // Free-threaded builds still enable the GIL for this module, as containers are walked without locking them
+
+    {0, NULL}
+};
+
+// Main module
+static struct PyModuleDef compaqt = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "compaqt",
+    .m_doc = NULL,
+    .m_size = sizeof(module_state_t),
+    .m_methods = CompaqtMethods,
+    .m_slots = compaqt_slots,
+    .m_traverse = compaqt_traverse,
+    .m_clear = compaqt_clear,
+    .m_free = compaqt_free,
+};
+
+// Module init function
+PyMODINIT_FUNC PyInit_compaqt(void) {
+    return PyModuleDef_Init(&compaqt);
+}
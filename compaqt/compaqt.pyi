@@ -3,29 +3,92 @@
 class CustomWriteTypes: pass
 class CustomReadTypes: pass
 
-def encode(value: any, file_name: str=None, stream_compatible: bool=False, custom_types: CustomWriteTypes=None) -> bytes | None:
+class EncodingError(Exception): pass
+class BufferSizeError(EncodingError):
+    needed_size: int
+class DecodingError(Exception): pass
+
+class LazyList:
+    """A list that decodes its items once they're accessed, returned by `decode` with `lazy=True`. Supports indexing, slicing, iteration and `len`."""
+    
+    def materialize(self) -> list:
+        """Decode the entire list at once, including everything nested in it."""
+        ...
+
+class LazyDict:
+    """A dict that decodes its values once they're accessed, returned by `decode` with `lazy=True`. Supports lookups, `in`, iteration and `len`."""
+    
+    def get(self, key: any, default: any=None) -> any: ...
+    def keys(self) -> list: ...
+    def values(self) -> list: ...
+    def items(self) -> list: ...
+    
+    def materialize(self) -> dict:
+        """Decode the entire dict at once, including everything nested in it."""
+        ...
+
+def encode(value: any, file_name: str=None, stream_compatible: bool=False, custom_types: CustomWriteTypes=None, key_table: bool=False, columnar: bool=False, compact_numbers: bool=False, preserve_refs: bool=False, sized: bool=False, compress: bool=False, checksum: bool=False, max_depth: int=100000) -> bytes | None:
     """Encode a value to bytes.
     
     Args:
     - `value`:      The value to encode.
     - `file_name`:  The file to write encoded data to. By default doesn't write to a file and returns the bytes as a value.
+    - `key_table`:  Whether to write repeated dict keys as references to their first occurrence.
+    - `columnar`:   Whether to encode lists of dicts with the same keys by column.
+    - `compact_numbers`:  Whether to store lossless floats as 32-bit floats and lists of integers as zigzag varints.
+    - `preserve_refs`:  Whether to write lists and dicts that occur more than once as references, preserving shared objects and cycles.
+    - `sized`:      Whether to prefix lists and dicts with their encoded size, so that readers can skip over them without reading their items.
+    - `compress`:   Whether to compress the encoded data in blocks, which are decompressed transparently when decoding.
+    - `checksum`:   Whether to add a CRC32C checksum to the encoded data, which is verified when decoding and validating.
+    - `max_depth`:  The maximum number of nested containers. Raises an `EncodingError` if exceeded.
     
     Returns the value encoded to bytes (if not writing to a file).
     """
     ...
 
-def decode(encoded: bytes=None, file_name: str=None, custom_types: CustomReadTypes=None) -> any:
-    """Decode an encoded bytes object back to the original value.
+def encode_into(value: any, buffer: bytearray | memoryview, offset: int=0, custom_types: CustomWriteTypes=None) -> int:
+    """Encode a value directly into a writable buffer.
     
     Args:
-    - `encoded`:    The encoded value to decode. Overrides `file_name`.
+    - `value`:         The value to encode.
+    - `buffer`:        A writable, contiguous buffer object to write the encoded data into.
+    - `offset`:        The offset in the buffer to start writing at.
+    - `custom_types`:  Object that holds custom types to encode that are not supported by default.
+    
+    Returns the number of bytes written. Raises a `BufferSizeError` holding the `needed_size` if the buffer is too small.
+    """
+    ...
+
+def encoded_size(value: any, custom_types: CustomWriteTypes=None) -> int:
+    """Get the exact number of bytes a value encodes to, without creating the encoded data.
+    
+    Args:
+    - `value`:         The value to measure.
+    - `custom_types`:  Object that holds custom types to encode that are not supported by default.
+    
+    Returns the size of the encoded value in bytes, when encoded with the default options of `encode`.
+    Options that change the encoding, such as `columnar`, `sized` or `compress`, are not accounted for.
+    """
+    ...
+
+def decode(encoded: bytes | bytearray | memoryview=None, file_name: str=None, custom_types: CustomReadTypes=None, max_depth: int=100000, offset: int=0, length: int=None, mmap: bool=False, huge_pages: bool=False, lazy: bool=False) -> any:
+    """Decode an encoded bytes-like object back to the original value.
+    
+    Args:
+    - `encoded`:    The encoded value to decode, as any bytes-like object. Overrides `file_name`.
     - `file_name`:  The file to read the data from. Can be given INSTEAD of `encoded`.
+    - `max_depth`:  The maximum number of nested containers. Raises a `DecodingError` if exceeded.
+    - `offset`:     The offset in `encoded` at which the encoded data starts.
+    - `length`:     The number of bytes of encoded data from `offset`. `None` means up to the end of `encoded`.
+    - `mmap`:       Whether to map the file into memory instead of reading it into a buffer.
+    - `huge_pages`: Whether to request huge pages for the mapped file, where supported.
+    - `lazy`:       Whether to return lists and dicts as `LazyList` and `LazyDict` objects, which decode their items once they're accessed.
     
     Returns the decoded value.
     """
     ...
 
-def validate(encoded: bytes=None, file_name: str=None, file_offset: int=0, chunk_size: int=0, err_on_invalid: bool=False) -> bool:
+def validate(encoded: bytes | bytearray | memoryview=None, file_name: str=None, file_offset: int=0, chunk_size: int=0, err_on_invalid: bool=False, max_depth: int=100000, offset: int=0, length: int=None) -> bool:
     """Validate whether encoded bytes object are valid
     
     Args:
@@ -34,11 +97,44 @@ def validate(encoded: bytes=None, file_name: str=None, file_offset: int=0, chunk
     - `file_offset`:     The offset in the file to start reading from.
     - `chunk_size`:      The size of the internal buffer to process data in. Zero means the size of the file (starting from the file offset).
     - `err_on_invalid`:  Whether to throw an error if the the value is invalid.
+    - `max_depth`:       The maximum number of nested containers. Deeper nested data is considered invalid.
+    - `offset`:          The offset in `encoded` at which the encoded data starts.
+    - `length`:          The number of bytes of encoded data from `offset`. `None` means up to the end of `encoded`.
     
     Returns a boolean on whether the encoded object is valid.
     """
     ...
 
+class Encoder:
+    """Create a reusable encoder that keeps its options and internal buffer across calls.
+    
+    Args:
+    - `custom_types`:       Object that holds custom types to encode that are not supported by default.
+    - `stream_compatible`:  Whether to encode lists and dicts so that streams can continue them.
+    - `initial_capacity`:   The number of bytes to allocate for the internal buffer up front.
+    
+    Returns an encoder object.
+    """
+    
+    def __init__(self, custom_types: CustomWriteTypes=None, stream_compatible: bool=False, initial_capacity: int=0) -> self:
+        self.capacity: int = ...
+        ...
+    
+    def encode(self, value: any) -> bytes:
+        """Encode a value to bytes.
+        
+        Args:
+        - `value`:  The value to encode.
+        
+        Returns the value encoded to bytes.
+        """
+        ...
+    
+    def clear(self) -> None:
+        """Free the internal buffer. A new one is allocated on the next call to `encode`.
+        """
+        ...
+
 class StreamEncoder:
     """Create an encoding stream for writing serialized data directly to a file.
     
@@ -50,11 +146,13 @@ class StreamEncoder:
     - `resume_stream`:  If the stream was already initialized and you want to continue streaming to it.
     - `file_offset`:    What file position offset to start the stream at.
     - `preserve_file`:  If the current file needs to be preserved and the stream should start at the end of the file. Overrides the `resume_stream` and `file_offset` args.
+    - `compress`:       Whether to write each chunk as a compressed block. Resumed streams have to use the same setting.
+    - `checksum`:       Whether to write each chunk as a block with a CRC32C checksum, which decoders verify. Resumed streams have to use the same setting.
     
     Returns an Encoding Stream object to update the stream with.
     """
     
-    def __init__(self, file_name: str, value_type: type=list, chunk_size: int=1024*32, custom_types: CustomWriteTypes=None, resume_stream: bool=False, file_offset: int=0, preserve_file: bool=False) -> self:
+    def __init__(self, file_name: str, value_type: type=list, chunk_size: int=1024*32, custom_types: CustomWriteTypes=None, resume_stream: bool=False, file_offset: int=0, preserve_file: bool=False, compress: bool=False, checksum: bool=False) -> self:
         self.start_offset: int = ...
         self.curr_offset: int = ...
         ...
@@ -135,6 +233,15 @@ class settings:
         """
         ...
 
+    def buffer_growth(factor: float=..., cap: int=...) -> None:
+        """Set how encode buffers grow when the current allocation is insufficient.
+        
+        Args:
+        - `factor`:  The factor to grow the buffer by. Defaults to 1.5.
+        - `cap`:     The maximum amount of bytes to grow the buffer by at once. Defaults to 256MB.
+        """
+        ...
+
 class types:
     """Contains type control for the serialization process
     """
@@ -0,0 +1,73 @@
+// This file contains atomic operations for state shared between threads
+
+#ifndef ATOMICS_H
+#define ATOMICS_H
+
+#include <Python.h>
+
+/*  Without the GIL (free-threaded builds), shared state has to be updated atomically. Otherwise plain operations suffice.
+ *  Free-threaded builds still enable the GIL for the module for now, as containers are walked without locking them.
+ */
+#ifdef Py_GIL_DISABLED
+
+    // Increment or decrement a counter, evaluating to the new count
+    #define ATOMIC_INCREMENT(ptr) ((size_t)_Py_atomic_add_ssize((Py_ssize_t *)(ptr), 1) + 1)
+    #define ATOMIC_DECREMENT(ptr) ((size_t)_Py_atomic_add_ssize((Py_ssize_t *)(ptr), -1) - 1)
+
+    // Load or store a size that may be read or written by other threads at the same time
+    #define ATOMIC_LOAD_SIZE(ptr) ((size_t)_Py_atomic_load_ssize_relaxed((Py_ssize_t *)(ptr)))
+    #define ATOMIC_STORE_SIZE(ptr, value) _Py_atomic_store_ssize_relaxed((Py_ssize_t *)(ptr), (Py_ssize_t)(value))
+
+    // Load or store a double the same way, through its bits
+    static inline double atomic_load_double(double *ptr)
+    {
+        const uint64_t bits = _Py_atomic_load_uint64_relaxed((uint64_t *)ptr);
+        double value;
+        memcpy(&value, &bits, sizeof(double));
+        return value;
+    }
+
+    static inline void atomic_store_double(double *ptr, const double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(double));
+        _Py_atomic_store_uint64_relaxed((uint64_t *)ptr, bits);
+    }
+
+    #define ATOMIC_LOAD_DOUBLE(ptr) atomic_load_double(ptr)
+    #define ATOMIC_STORE_DOUBLE(ptr, value) atomic_store_double(ptr, value)
+
+    // Set a flag if it's not set yet. Returns 1 if it was set by this call
+    static inline int atomic_try_set(int *flag)
+    {
+        int expected = 0;
+        return _Py_atomic_compare_exchange_int(flag, &expected, 1);
+    }
+
+    #define ATOMIC_CLEAR(flag) _Py_atomic_store_int_release(flag, 0)
+
+#else
+
+    #define ATOMIC_INCREMENT(ptr) (++*(ptr))
+    #define ATOMIC_DECREMENT(ptr) (--*(ptr))
+
+    #define ATOMIC_LOAD_SIZE(ptr) (*(ptr))
+    #define ATOMIC_STORE_SIZE(ptr, value) (*(ptr) = (value))
+
+    #define ATOMIC_LOAD_DOUBLE(ptr) (*(ptr))
+    #define ATOMIC_STORE_DOUBLE(ptr, value) (*(ptr) = (value))
+
+    static inline int atomic_try_set(int *flag)
+    {
+        if (*flag != 0)
+            return 0;
+
+        *flag = 1;
+        return 1;
+    }
+
+    #define ATOMIC_CLEAR(flag) (*(flag) = 0)
+
+#endif // Py_GIL_DISABLED
+
+#endif // ATOMICS_H
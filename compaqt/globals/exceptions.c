@@ -1,7 +0,0 @@
-#include <Python.h>
-
-PyObject *EncodingError   = NULL;
-PyObject *DecodingError   = NULL;
-PyObject *ValidationError = NULL;
-PyObject *FileOffsetError = NULL;
-
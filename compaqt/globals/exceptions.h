@@ -1,20 +1,20 @@
-// This file contains custom error types
+// This file contains error codes. The custom error types themselves are held by the module state
 
 #ifndef EXCEPTIONS_H
 #define EXCEPTIONS_H
 
 #include <Python.h>
 
-// Error for when encoding data
-extern PyObject *EncodingError;
+/*  Results of file operations done without holding the GIL, which are turned into errors once it's held again.
+ *  These don't overlap with the 0 (success) and 1 (invalid) results of validation.
+ */
+#define FILE_NO_MEMORY -1
+#define FILE_OPEN_FAILED 2
+#define FILE_SEEK_FAILED 3
+#define FILE_READ_FAILED 4
+#define FILE_WRITE_FAILED 5
+#define FILE_EMPTY 6
+#define FILE_CORRUPTED 7 // The file holds a compressed block that can't be decompressed
+#define FILE_MAP_FAILED 8
 
-// Error for when decoding data
-extern PyObject *DecodingError;
-
-// Error for when validating data
-extern PyObject *ValidationError;
-
-// Error for when finding a file offset
-extern PyObject *FileOffsetError;
-
-#endif // EXCEPTIONS_H
\ No newline at end of file
+#endif // EXCEPTIONS_H
@@ -0,0 +1,69 @@
+// This file contains helpers for the explicit stacks used to walk nested containers
+
+#ifndef FRAMESTACK_H
+#define FRAMESTACK_H
+
+#include <Python.h>
+
+// Default maximum number of nested containers when encoding, decoding and validating
+#define DEFAULT_MAX_DEPTH 100000
+
+// Number of frames that fit in the initial (local) storage of a frame stack
+#define FRAMES_INITIAL 16
+
+/*  Double the capacity of a frame stack. Stacks start out in local storage and move to the heap once that's full.
+ *
+ *  Returns the grown stack, or NULL if out of memory, in which case `frames` is still valid. No error is set,
+ *  so that stacks can also grow while the GIL is released.
+ */
+static inline void *frames_grow(void *frames, const void *local, size_t *capacity, const size_t frame_size)
+{
+    const size_t new_capacity = *capacity << 1;
+    void *grown;
+
+    if (frames == local)
+    {
+        grown = malloc(new_capacity * frame_size);
+
+        if (grown != NULL)
+            memcpy(grown, local, *capacity * frame_size);
+    }
+    else
+    {
+        grown = realloc(frames, new_capacity * frame_size);
+    }
+
+    if (grown == NULL)
+        return NULL;
+
+    *capacity = new_capacity;
+    return grown;
+}
+
+// Free a frame stack if it moved to the heap
+#define FRAMES_FREE(frames, local) do { \
+    if ((void *)(frames) != (void *)(local)) free(frames); \
+} while (0)
+
+// Set an error of type `error` for exceeding the maximum depth. Always returns 1
+static inline int depth_error(PyObject *error)
+{
+    PyErr_SetString(error, "Exceeded the maximum nesting depth of containers");
+    return 1;
+}
+
+/*  Enter `levels` levels of nesting. `max_depth` holds the number of levels that can still be entered,
+ *  and is raised again by the caller when leaving them.
+ *
+ *  Returns 1 with an error of type `error` set if this exceeds the maximum depth.
+ */
+static inline int enter_depth(size_t *max_depth, const size_t levels, PyObject *error)
+{
+    if (*max_depth < levels)
+        return depth_error(error);
+
+    *max_depth -= levels;
+    return 0;
+}
+
+#endif // FRAMESTACK_H
@@ -16,6 +16,8 @@
 
     // Already little-endian, don't change anything
     #define LITTLE_64(x) (x)
+    #define LITTLE_32(x) (x)
+    #define LITTLE_16(x) (x)
 
     #define LITTLE_DOUBLE(x) (x)
 
@@ -25,12 +27,16 @@
     #if defined(__GNUC__) || defined(__clang__)
 
         #define LITTLE_64(x) (__builtin_bswap64(x))
+        #define LITTLE_32(x) (__builtin_bswap32(x))
+        #define LITTLE_16(x) (__builtin_bswap16(x))
 
     // MSCV intrinsics
     #elif defined(_MSC_VER)
 
         #include <intrin.h>
         #define LITTLE_64(x) (_byteswap_uint64(x))
+        #define LITTLE_32(x) (_byteswap_ulong(x))
+        #define LITTLE_16(x) (_byteswap_ushort(x))
 
     // Fallback with manual swapping
     #else
@@ -46,6 +52,15 @@
             (((x) << 56) & 0xFF00000000000000)   \
         )
 
+        #define LITTLE_32(x) ( \
+            (((x) >> 24) & 0x000000FF) | \
+            (((x) >>  8) & 0x0000FF00) | \
+            (((x) <<  8) & 0x00FF0000) | \
+            (((x) << 24) & 0xFF000000)   \
+        )
+
+        #define LITTLE_16(x) ((uint16_t)((((x) >> 8) & 0x00FF) | (((x) << 8) & 0xFF00)))
+
     #endif
 
     // Don't cast doubles to integers as that can be undefined, instead use the safe copy method
@@ -64,6 +79,7 @@
 #if (defined(__GNUC__) || defined(__clang__))
 
     #define LEADING_ZEROES_64(x) (__builtin_clzll(x))
+    #define TRAILING_ZEROES_64(x) (__builtin_ctzll(x))
 
 // MSCV
 #elif defined(_MSC_VER)
@@ -71,6 +87,14 @@
     #include <intrin.h>
     #define LEADING_ZEROES_64(x) (8 - _BitScanReverse64(x))
 
+    static inline int TRAILING_ZEROES_64(uint64_t x)
+    {
+        unsigned long idx;
+        _BitScanForward64(&idx, x);
+
+        return (int)idx;
+    }
+
 // Fallback
 #else
 
@@ -88,6 +112,52 @@
         return n;
     }
 
+    inline int TRAILING_ZEROES_64(uint64_t x)
+    {
+        int n = 0;
+
+        while ((x & 1) == 0) { ++n; x >>= 1; }
+
+        return n;
+    }
+
+#endif
+
+/* THREAD-LOCAL STORAGE */
+
+#if defined(_MSC_VER)
+
+    #define THREAD_LOCAL __declspec(thread)
+
+#elif (defined(__GNUC__) || defined(__clang__))
+
+    #define THREAD_LOCAL __thread
+
+#else
+
+    #define THREAD_LOCAL _Thread_local
+
+#endif
+
+/* INLINING */
+
+// Inline functions into the hot loops that call them, also when they're larger than the compiler would inline,
+// and keep rarely called functions out of them
+#if defined(_MSC_VER)
+
+    #define ALWAYS_INLINE __forceinline
+    #define NOINLINE __declspec(noinline)
+
+#elif (defined(__GNUC__) || defined(__clang__))
+
+    #define ALWAYS_INLINE inline __attribute__((always_inline))
+    #define NOINLINE __attribute__((noinline))
+
+#else
+
+    #define ALWAYS_INLINE inline
+    #define NOINLINE
+
 #endif
 
 // Count the number of used bytes in a 64-bit unsigned integer
@@ -0,0 +1,119 @@
+// This file contains the identity table used to preserve shared and cyclic references while encoding
+
+#ifndef MEMOTABLE_H
+#define MEMOTABLE_H
+
+#include <Python.h>
+#include <stdint.h>
+
+// Number of slots a memo table starts out with, as a power of 2
+#define MEMO_INITIAL_BITS 6
+
+// Multiplicative hash of an object address, taking the upper `bits` bits of the product
+#define MEMO_HASH(obj, bits) ((size_t)(((uint64_t)(uintptr_t)(obj) * 0x9E3779B97F4A7C15ULL) >> (64 - (bits))))
+
+typedef struct {
+    PyObject *obj; // The object (owned), or NULL if the slot is empty
+    size_t idx;    // Index of the object in the reference table
+} memoslot_t;
+
+/*  Open addressing hash table from objects (by identity) to their index in the reference table.
+ *  Objects are kept alive by the table, so that their address can't be reused by another object while encoding.
+ */
+typedef struct {
+    memoslot_t *slots;
+    size_t bits;  // Number of slots as a power of 2
+    size_t count; // Number of objects in the table
+} memotable_t;
+
+// Create an empty memo table. Returns NULL with an error set if out of memory
+static inline memotable_t *memo_new(void)
+{
+    memotable_t *memo = (memotable_t *)malloc(sizeof(memotable_t));
+
+    if (memo == NULL)
+    {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    memo->slots = (memoslot_t *)calloc((size_t)1 << MEMO_INITIAL_BITS, sizeof(memoslot_t));
+
+    if (memo->slots == NULL)
+    {
+        free(memo);
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    memo->bits = MEMO_INITIAL_BITS;
+    memo->count = 0;
+
+    return memo;
+}
+
+// Free a memo table and release the objects in it
+static inline void memo_free(memotable_t *memo)
+{
+    if (memo == NULL)
+        return;
+
+    const size_t nslots = (size_t)1 << memo->bits;
+
+    for (size_t i = 0; i < nslots; ++i)
+        Py_XDECREF(memo->slots[i].obj);
+
+    free(memo->slots);
+    free(memo);
+}
+
+// Get the slot of an object, which is empty if the object isn't in the table yet
+static inline memoslot_t *memo_lookup(memotable_t *memo, PyObject *obj)
+{
+    const size_t mask = ((size_t)1 << memo->bits) - 1;
+    size_t i = MEMO_HASH(obj, memo->bits);
+
+    while (memo->slots[i].obj != NULL && memo->slots[i].obj != obj)
+        i = (i + 1) & mask;
+
+    return &memo->slots[i];
+}
+
+/*  Add an object to the empty slot received from `memo_lookup`, giving it the next index.
+ *  The table grows once it's half full to keep probe sequences short.
+ *
+ *  Returns 1 with an error set if out of memory.
+ */
+static inline int memo_add(memotable_t *memo, memoslot_t *slot, PyObject *obj)
+{
+    Py_INCREF(obj);
+    slot->obj = obj;
+    slot->idx = memo->count++;
+
+    if (memo->count << 1 <= (size_t)1 << memo->bits)
+        return 0;
+
+    const size_t nslots = (size_t)1 << memo->bits;
+    memoslot_t *old = memo->slots;
+    memoslot_t *grown = (memoslot_t *)calloc(nslots << 1, sizeof(memoslot_t));
+
+    if (grown == NULL)
+    {
+        PyErr_NoMemory();
+        return 1;
+    }
+
+    memo->slots = grown;
+    ++memo->bits;
+
+    for (size_t i = 0; i < nslots; ++i)
+    {
+        if (old[i].obj != NULL)
+            *memo_lookup(memo, old[i].obj) = old[i];
+    }
+
+    free(old);
+    return 0;
+}
+
+#endif // MEMOTABLE_H
@@ -0,0 +1,62 @@
+// This file contains the per-module state, which replaces global variables so that each (sub-)interpreter has its own
+
+#ifndef MODSTATE_H
+#define MODSTATE_H
+
+#include <Python.h>
+
+#include "globals/typedefs.h"
+
+// Number of bits used to index the type dispatch table
+#define DISPATCH_BITS 6
+#define DISPATCH_SLOTS (1 << DISPATCH_BITS)
+
+struct module_state_s {
+    // Exceptions
+    PyObject *encoding_error;     // Error for when encoding data
+    PyObject *buffer_size_error;  // Error for when a caller-supplied buffer is too small to encode into
+    PyObject *decoding_error;     // Error for when decoding data
+    PyObject *validation_error;   // Error for when validating data
+    PyObject *file_offset_error;  // Error for when finding a file offset
+
+    // Types created by the module
+    PyTypeObject *encoder_type;
+    PyTypeObject *stream_encoder_type;
+    PyTypeObject *stream_decoder_type;
+    PyTypeObject *utypes_encode_type;
+    PyTypeObject *utypes_decode_type;
+    PyTypeObject *cbytes_type;
+    PyTypeObject *cstr_type;
+    PyTypeObject *lazy_list_type;
+    PyTypeObject *lazy_dict_type;
+
+    // The `array.array` type, and the table mapping type objects to their type codes
+    PyTypeObject *array_type;
+    PyTypeObject *dispatch_types[DISPATCH_SLOTS];
+    uint8_t dispatch_codes[DISPATCH_SLOTS];
+    uint64_t dispatch_mult;
+
+    // Allocation settings
+    allocdata_t allocdata;          // Allocation sizes that threads start from
+    size_t allocdata_version;       // Incremented whenever the allocation settings change
+    int dynamic_allocation_tweaks;  // Whether to tweak the allocation sizes based on the encoded data
+    double realloc_growth_factor;   // Geometric growth of encode buffers
+    size_t realloc_growth_cap;      // Maximum number of bytes to grow encode buffers by at once
+};
+
+// Get the state of the module object `m`
+#define MODULE_STATE(m) ((module_state_t *)PyModule_GetState(m))
+
+// Instances of heap types hold a reference to their type since Python 3.8, which their deallocator has to release
+#if (PY_VERSION_HEX >= 0x03080000)
+    #define HEAPTYPE_DECREF(type) Py_DECREF(type)
+#else
+    #define HEAPTYPE_DECREF(type)
+#endif
+
+// The module creates all instances of its types itself. Older versions clear `tp_new` after creating the types instead
+#ifndef Py_TPFLAGS_DISALLOW_INSTANTIATION
+    #define Py_TPFLAGS_DISALLOW_INSTANTIATION 0
+#endif
+
+#endif // MODSTATE_H
@@ -5,6 +5,8 @@
 
 #include <Python.h>
 
+#include "globals/memotable.h"
+
 /*  Typedef for functions that do buffer checks while encoding/decoding.
  *  These functions return 1 on error and set an error message.
  *  
@@ -18,14 +20,21 @@ typedef int (*bufcheck_t)(void *, const size_t);
 
 
 /*  Holds data of a reference buffer. Reference buffers are used for referenced str/bytes types to avoid copying data.
- *  The base can be both a PyObject and an allocated buffer. In case of a PyObject (is_PyOb = 1), DECREF `base`. Otherwise free `base`.
+ *  The data is either an allocated buffer (BUFD_ALLOCATED), which is freed, the exported buffer of a Python object
+ *  (BUFD_BUFFER), which is released, or a file mapped into memory (BUFD_MAPPED), which is unmapped.
  */
 typedef struct {
-    void *base;    // Referenced PyObject / allocated buffer.
-    size_t refcnt; // Reference count of objects referencing this buffer.
-    int is_PyOb;   // Indicates if `base` is a PyObject.
+    void *base;      // Allocated buffer or start of the mapping, if `kind` is BUFD_ALLOCATED or BUFD_MAPPED.
+    size_t size;     // Size of the mapping, if `kind` is BUFD_MAPPED.
+    Py_buffer view;  // Exported buffer of the decoded object, if `kind` is BUFD_BUFFER.
+    size_t refcnt;   // Reference count of objects referencing this buffer.
+    int kind;        // What holds the data, one of the BUFD_* kinds.
 } bufdata_t;
 
+#define BUFD_ALLOCATED 0
+#define BUFD_BUFFER 1
+#define BUFD_MAPPED 2
+
 
 // Key-value pair struct for the hash table
 typedef struct {
@@ -56,6 +65,18 @@ typedef struct {
 } utypes_decode_ob;
 
 
+// Per-module state, defined in `globals/modstate.h`
+typedef struct module_state_s module_state_t;
+
+
+/*  Holds the allocation sizes used when encoding. These get tweaked based on the encoded data if dynamic allocations are enabled.
+ */
+typedef struct {
+    size_t item_size;    // Bytes to allocate per item in a list or dict.
+    size_t realloc_size; // Bytes to allocate extra when the buffer is insufficient.
+} allocdata_t;
+
+
 /*  Holds data for encoding objects to bytes.
  */
 typedef struct {
@@ -65,6 +86,13 @@ typedef struct {
 
     bufcheck_t bufcheck;      // Function to refresh the buffer if necessary.
     utypes_encode_ob *utypes; // Holds user type objects. Is NULL if not used.
+    PyObject *keys;           // Dict mapping dict keys to their index in the key table. Is NULL if not used.
+    int columnar;             // Whether to encode lists of dicts with the same keys by column.
+    int compact;              // Whether to use the compact numeric encodings (float32 and zigzag varints).
+    int sized;                // Whether to prefix lists and dicts with their encoded size.
+    size_t max_depth;         // Number of container levels that can still be nested, lowered while inside containers.
+    memotable_t *refs;        // Identity table of the lists and dicts in the reference table. Is NULL if not used.
+    module_state_t *state;    // The state of the module, holding its exceptions and types.
 } encode_t;
 
 /*  Holds data for decoding bytes to an object.
@@ -77,6 +105,11 @@ typedef struct {
     bufdata_t *bufd;          // Points to a reference buffer data struct. Is NULL if not used.
     bufcheck_t bufcheck;      // Function to check if enough bytes are remaining or if the buffer needs to be refreshed.
     utypes_decode_ob *utypes; // Holds user type objects. Is NULL if not used.
+    PyObject *keys;           // List of the strings in the key table. Is NULL until a key is defined.
+    size_t max_depth;         // Number of container levels that can still be nested, lowered while inside containers.
+    PyObject *refs;           // List of the values in the reference table. Is NULL until a value is defined.
+    module_state_t *state;    // The state of the module, holding its exceptions and types.
+    size_t dropped;           // Number of bytes dropped from before the buffer base, which keeps the position in the data.
 } decode_t;
 
 
@@ -89,11 +122,71 @@ typedef struct {
     char *max_offset;
     bufcheck_t bufcheck;
     utypes_encode_ob *utypes;
+    PyObject *keys;
+    int columnar;
+    int compact;
+    int sized;
+    size_t max_depth;
+    memotable_t *refs;
+    module_state_t *state;
 
     // `reg_encode_t` data
-    size_t reallocs; // Keep track of re-allocations for dynamic allocation tweaks
+    size_t reallocs;     // Keep track of re-allocations for dynamic allocation tweaks
+    allocdata_t *allocs; // The allocation sizes to use and tweak
+    PyObject *bytes;     // The bytes object holding the buffer if building the result in place. NULL otherwise.
+    int in_place;        // Whether to build the result in a bytes object instead of an allocated buffer
 } reg_encode_t;
 
+/*  Encode struct for encoding into a caller-supplied buffer. Starts with the `reg_encode_t` data,
+ *  so that it can continue with the regular offset checks once the encoded data has to continue in a scratch buffer.
+ */
+typedef struct {
+    // `reg_encode_t` data
+    char *base;
+    char *offset;
+    char *max_offset;
+    bufcheck_t bufcheck;
+    utypes_encode_ob *utypes;
+    PyObject *keys;
+    int columnar;
+    int compact;
+    int sized;
+    size_t max_depth;
+    memotable_t *refs;
+    module_state_t *state;
+    size_t reallocs;
+    allocdata_t *allocs;
+    PyObject *bytes;
+    int in_place;
+
+    // `into_encode_t` data
+    char *user_base; // The caller's buffer at the requested offset. `base` points elsewhere if the data continues in a scratch buffer.
+    size_t kept;     // Number of bytes written to the caller's buffer before continuing in a scratch buffer
+} into_encode_t;
+
+/*  Encode struct for measuring the encoded size of a value. The written data is counted and discarded,
+ *  so the buffer only has to be large enough for the largest single item.
+ */
+typedef struct {
+    // `encode_t` data
+    char *base;
+    char *offset;
+    char *max_offset;
+    bufcheck_t bufcheck;
+    utypes_encode_ob *utypes;
+    PyObject *keys;
+    int columnar;
+    int compact;
+    int sized;
+    size_t max_depth;
+    memotable_t *refs;
+    module_state_t *state;
+
+    // `size_encode_t` data
+    size_t counted; // Number of bytes counted in previously discarded data
+    char *stack;    // The initial stack buffer, which should not be freed
+} size_encode_t;
+
 /*  Holds file data for streaming objects
 */
 typedef struct {
@@ -113,6 +206,13 @@ typedef struct {
     char *max_offset;
     bufcheck_t bufcheck;
     utypes_encode_ob *utypes;
+    PyObject *keys;
+    int columnar;
+    int compact;
+    int sized;
+    size_t max_depth;
+    memotable_t *refs;
+    module_state_t *state;
 
     // `filedata_t` data
     FILE *file;
@@ -122,6 +222,11 @@ typedef struct {
     size_t chunk_size;
     size_t start_offset;
     size_t curr_offset;
+
+    // `stream_encode_t` data
+    char *scratch;       // Holds a compressed block before it's written to the file. Is NULL if not allocated.
+    size_t scratch_size; // The number of bytes allocated for `scratch`.
+    int block_flags;     // The BLOCK_* flags to write chunks as blocks with, or zero to write them as is.
 } stream_encode_t;
 
 typedef struct {
@@ -132,6 +237,11 @@ typedef struct {
     bufdata_t *bufd;
     bufcheck_t bufcheck;
     utypes_decode_ob *utypes;
+    PyObject *keys;
+    size_t max_depth;
+    PyObject *refs;
+    module_state_t *state;
+    size_t dropped;
 
     // `filedata_t` data
     FILE *file;
@@ -141,6 +251,13 @@ typedef struct {
     size_t chunk_size;
     size_t start_offset;
     size_t curr_offset;
+
+    // `stream_decode_t` data
+    char *scratch;       // Holds a compressed block before it's decompressed into the chunk buffer. Is NULL if not allocated.
+    size_t scratch_size; // The number of bytes allocated for `scratch`.
+    int in_blocks;       // Whether the stream is read in (compressed or checksummed) blocks, in which case `curr_offset` is the offset of the current block.
+    size_t block_skip;   // Number of decompressed bytes of the block at `curr_offset` that were read already.
+    size_t next_offset;  // File offset of the block after the one in the chunk buffer.
 } stream_decode_t;
 
 
@@ -9,13 +9,76 @@
 #define DT_STRNG (unsigned char)0x03 // Strings     | VARLEN
 #define DT_INTGR (unsigned char)0x04 // Integers    | INTEGER
 #define DT_UTYPE (unsigned char)0x06 // Usertype    | UTYPE
+#define DT_EXTNS (unsigned char)0x07 // Extension   | EXTENSION
 // 5 bits
 #define DT_BOOLF (unsigned char)0x05 // False       | BOOLEAN, no reading method
 #define DT_BOOLT (unsigned char)0x0D // True        | BOOLEAN, no reading method
 #define DT_FLOAT (unsigned char)0x15 // Float       | <no methods>
 #define DT_NONTP (unsigned char)0x1D // NoneType    | <no methods>
 
-// 0x07 is available but not used for anything
+#define DT_FLT32 (unsigned char)0x35 // Float32     | DT_FLOAT with the upper bits set to 1, holding 4 bytes
+
+/*  Extension types are written as a DT_EXTNS byte with the extension ID in the upper 5 bits.
+ *  The extension byte is followed by the metadata and data of the value it extends.
+ */
+
+//      NAME                    ID                  | Extends
+#define EXT_TUPLE (unsigned char)0x00 // Tuples     | DT_ARRAY
+#define EXT_SETTP (unsigned char)0x01 // Sets       | DT_ARRAY
+#define EXT_FROZN (unsigned char)0x02 // Frozensets | DT_ARRAY
+#define EXT_BARRY (unsigned char)0x03 // Bytearrays | DT_BYTES
+#define EXT_MVIEW (unsigned char)0x04 // Memoryview | DT_BYTES
+#define EXT_BIGNT (unsigned char)0x05 // Big ints   | DT_BYTES, little-endian two's complement
+#define EXT_KEYDF (unsigned char)0x06 // Key table definition | DT_STRNG, adds the key to the key table
+#define EXT_KEYRF (unsigned char)0x07 // Key table reference  | DT_INTGR, unsigned index into the key table
+#define EXT_COLMN (unsigned char)0x08 // List of dicts by column | DT_ARRAY, list of the keys followed by a list or packed column per key
+#define EXT_NMCOL (unsigned char)0x09 // Packed numeric column   | DT_BYTES, format character followed by the little-endian items
+#define EXT_TARRY (unsigned char)0x0A // Typed array             | DT_BYTES, format character followed by the little-endian items
+#define EXT_ZZINT (unsigned char)0x0B // List of integers        | DT_BYTES, zigzag varints
+#define EXT_REFDF (unsigned char)0x0C // Reference table definition | Any list or dict, adds the value to the reference table
+#define EXT_REFRF (unsigned char)0x0D // Reference table reference  | DT_INTGR, unsigned index into the reference table
+#define EXT_SIZED (unsigned char)0x0E // Sized container | Any list or dict, preceded by the 4-byte size of its metadata and items
+
+// The highest extension ID in use by values
+#define EXT_LIMIT EXT_SIZED
+
+// The datatype extended by each extension
+static const unsigned char ext_tpmasks[EXT_LIMIT + 1] = {
+    DT_ARRAY, DT_ARRAY, DT_ARRAY, DT_BYTES, DT_BYTES, DT_BYTES, DT_STRNG, DT_INTGR,
+    DT_ARRAY, DT_BYTES, DT_BYTES, DT_BYTES, DT_ARRAY, DT_INTGR, DT_ARRAY,
+};
+
+/*  Packed data holds a format character followed by the little-endian items. The formats are those of the `struct`
+ *  and `array` modules, normalized to a fixed width: 'b', 'h', 'i' and 'q' for signed integers of 1, 2, 4 and 8 bytes,
+ *  'B', 'H', 'I' and 'Q' for unsigned integers, and 'f' and 'd' for floats and doubles.
+ */
+
+// Get the number of bytes per item of a packed data format, or 0 if the format is not supported
+static inline size_t format_width(const char format)
+{
+    switch (format)
+    {
+    case 'b': case 'B': return 1;
+    case 'h': case 'H': return 2;
+    case 'i': case 'I': case 'f': return 4;
+    case 'q': case 'Q': case 'd': return 8;
+    default:  return 0;
+    }
+}
+
+/*  Sized containers can be skipped without reading their items. Their size is written once the container is encoded,
+ *  and containers that end up larger than the size can hold get SIZED_UNKNOWN, which are skipped item by item instead.
+ */
+#define SIZED_BYTE (unsigned char)(DT_EXTNS | (EXT_SIZED << 3))
+#define SIZED_PREFIX_SIZE 5
+#define SIZED_UNKNOWN 0xFFFFFFFFUL
+
+/*  Blocks and checksummed data aren't values, so their IDs lie above the limit and are never mistaken for one.
+ *  They're only found at the start of the data, or blocks directly after the metadata of a stream container.
+ */
+#define EXT_CMPRS (unsigned char)0x0F // Compressed block  | 4-byte raw length and 4-byte stored length, followed by the stored data
+#define EXT_CHKBK (unsigned char)0x10 // Checksummed block | EXT_CMPRS header and the 4-byte CRC32C of its lengths and the stored data, followed by the stored data
+#define EXT_CHKSM (unsigned char)0x11 // Checksummed data  | Followed by the data and its 4-byte CRC32C
 
 
 // Max size for metadata
@@ -109,6 +172,12 @@
 } while (0)
 
 // VARLEN metadata read
+// Number of bytes read as the varlen metadata starting with `byte`, as mode 3 always reads 8 length bytes
+#define METADATA_VARLEN_SIZE(byte) ( \
+    (((byte) >> 3) & 0b11) == 0b11 ? 9 : \
+    (((byte) >> 3) & 0b11) == 0b01 ? 2 : 1 \
+)
+
 #define METADATA_VARLEN_RD(length) do { \
     /* Mask the mode bits of the first byte */ \
     const unsigned int mode = (__offset[0] >> 3) & 0b11; \
@@ -162,9 +231,23 @@
     idx = __GETBYTE() >> 3; \
     /* Get the number of bytes stored in the bottom 3 bits, add 1 as that was subtracted before storing */ \
     const unsigned int nbytes = __offset[0] & 0b111; /* Without increment, length is also stored on this byte */ \
-    /* Get the length back using memcpy. Shift right by 3 to remove the nbytes bits */ \
-    __MEMCPY_READ(length, nbytes); \
-    length >>= 3; \
+    /* Only read the length bytes, as a small custom value at the end of the data has fewer than 8 bytes after it */ \
+    uint64_t __length = 0; \
+    memcpy(&__length, __offset, nbytes); \
+    /* Shift right by 3 to remove the nbytes bits */ \
+    length = LITTLE_64(__length) >> 3; \
+    __offset += nbytes; \
+} while (0)
+
+
+// EXTENSION metadata writing
+#define METADATA_EXTENSION_WR(ext) do { \
+    __SETBYTE(DT_EXTNS | ((ext) << 3)); \
+} while (0)
+
+// EXTENSION metadata reading
+#define METADATA_EXTENSION_RD(ext) do { \
+    ext = __GETBYTE() >> 3; \
 } while (0)
 
 
@@ -202,8 +285,12 @@
     case tpmask | (0b11 << 3):
 
 
-// Execute a block of code, fetching the length by default, with a specified length method
-#define VARLEN_READ_MODEx(code, getlength) { \
+/*  Execute a block of code, fetching the length by default, with a specified length method. Metadata of more than the
+ *  first byte is checked to be available with the `OVERREAD_CHECK` macro of the file using it.
+ */
+#define VARLEN_READ_MODEx(code, getlength, nbytes) { \
+    if ((nbytes) > 1) \
+        OVERREAD_CHECK(nbytes); \
     size_t length; \
     getlength(length); \
     { code } \
@@ -211,9 +298,9 @@
 
 // Execute a block of code for a specific typemask. The macro separates the code across different types for performance by using more direct metadata methods
 #define VARLEN_READ_CASES(tpmask, code) \
-    VARLEN_MODE1_CASES(tpmask) VARLEN_READ_MODEx(code, METADATA_VARLEN_RD_MODE1) \
-    VARLEN_MODE2_CASES(tpmask) VARLEN_READ_MODEx(code, METADATA_VARLEN_RD_MODE2) \
-    VARLEN_MODE3_CASES(tpmask) VARLEN_READ_MODEx(code, METADATA_VARLEN_RD_MODE3) \
+    VARLEN_MODE1_CASES(tpmask) VARLEN_READ_MODEx(code, METADATA_VARLEN_RD_MODE1, 1) \
+    VARLEN_MODE2_CASES(tpmask) VARLEN_READ_MODEx(code, METADATA_VARLEN_RD_MODE2, 2) \
+    VARLEN_MODE3_CASES(tpmask) VARLEN_READ_MODEx(code, METADATA_VARLEN_RD_MODE3, 9) \
 
 
 #endif // TYPEMASKS_H
\ No newline at end of file
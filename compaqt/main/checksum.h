@@ -0,0 +1,32 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <Python.h>
+
+#include "globals/typemasks.h"
+
+// Metadata byte that starts checksummed data, which ends with the checksum of the data in between
+#define CHECKSUM_BYTE (unsigned char)(DT_EXTNS | (EXT_CHKSM << 3))
+
+// Size of a checksum, and the number of bytes that checksummed data adds around the data it covers
+#define CHECKSUM_SIZE 4
+#define CHECKSUM_OVERHEAD (1 + CHECKSUM_SIZE)
+
+// Minimum size of data to checksum with the GIL released
+#define CHECKSUM_GIL_RELEASE_MIN_SIZE (1024*256)
+
+// Running checksum of data that's read in parts, of which `remaining` bytes are still to be covered
+typedef struct {
+    uint32_t crc;
+    size_t remaining;
+} checksum_t;
+
+uint32_t crc32c(uint32_t crc, const char *data, size_t length);
+
+void write_checksum(char *dst, const uint32_t crc);
+uint32_t read_checksum(const char *src);
+
+void checksum_update(checksum_t *checksum, const char *data, const size_t length);
+int verify_checksum(const char *data, const size_t length);
+
+#endif // CHECKSUM_H
@@ -0,0 +1,515 @@
+// This file contains the block compression of encoded data
+
+#include <Python.h>
+
+#include "main/compression.h"
+
+#include "globals/typemasks.h"
+#include "globals/internals.h"
+
+/*  Blocks are compressed with an LZ77 variant that uses the sequence layout of LZ4 blocks. Each sequence starts with a token
+ *  holding the number of literals in the upper 4 bits and the match length minus 4 in the lower 4 bits. A value of 15 in
+ *  either means the rest of the number follows in bytes of 255 until a byte below it. The literals come after the number
+ *  of literals, followed by the 2-byte offset of the match and the rest of the match length. The last sequence of a block
+ *  only holds literals.
+ */
+
+// Number of bits to index the hash table of recent positions with
+#define HASH_BITS 12
+
+// Minimum length of a match
+#define MIN_MATCH 4
+
+// Blocks end with at least 5 literals, and the last match starts at least 12 bytes before the end of the block
+#define LAST_LITERALS 5
+#define MATCH_LIMIT 12
+
+// Maximum distance to a match, as offsets are stored in 2 bytes
+#define MAX_DISTANCE 0xFFFF
+
+static inline uint32_t read_32(const char *src)
+{
+    uint32_t value;
+    memcpy(&value, src, 4);
+
+    return value;
+}
+
+static inline uint64_t read_64(const char *src)
+{
+    uint64_t value;
+    memcpy(&value, src, 8);
+
+    return value;
+}
+
+// Hash the 4 bytes at a position to an index of the hash table
+static inline uint32_t hash_32(const uint32_t value)
+{
+    return (value * 2654435761U) >> (32 - HASH_BITS);
+}
+
+// Write the rest of a number that didn't fit in 4 bits of the token
+static inline char *write_length(char *dst, size_t length)
+{
+    while (length >= 255)
+    {
+        *(dst++) = (char)255;
+        length -= 255;
+    }
+
+    *(dst++) = (char)length;
+    return dst;
+}
+
+// Read the rest of a number that didn't fit in 4 bits of the token. Returns 1 if it runs past the end of the data
+static inline int read_length(const unsigned char **src, const unsigned char *end, size_t *length)
+{
+    unsigned int byte;
+
+    do
+    {
+        if (*src == end)
+            return 1;
+
+        byte = *((*src)++);
+        *length += byte;
+    } while (byte == 255);
+
+    return 0;
+}
+
+// Get the number of bytes that match after `src` and `ref`, up until `end`
+static inline size_t match_length(const char *src, const char *ref, const char *end)
+{
+    const char *start = src;
+
+#if (IS_LITTLE_ENDIAN == 1)
+    // Compare 8 bytes at once, where the lowest differing bit tells the first differing byte
+    while (src + 8 <= end)
+    {
+        const uint64_t diff = read_64(src) ^ read_64(ref);
+
+        if (diff != 0)
+            return (size_t)(src - start) + (TRAILING_ZEROES_64(diff) >> 3);
+
+        src += 8;
+        ref += 8;
+    }
+#endif
+
+    while (src < end && *src == *ref)
+    {
+        ++src;
+        ++ref;
+    }
+
+    return (size_t)(src - start);
+}
+
+// Write a sequence of literals, followed by a match unless `match` is zero (at the end of the block)
+static inline char *write_sequence(char *dst, const char *literals, const size_t nliterals, const size_t distance, const size_t match)
+{
+    char *token = dst++;
+    const size_t extra = match == 0 ? 0 : match - MIN_MATCH;
+
+    *token = (char)(((nliterals >= 15 ? 15 : nliterals) << 4) | (extra >= 15 ? 15 : extra));
+
+    if (nliterals >= 15)
+        dst = write_length(dst, nliterals - 15);
+
+    memcpy(dst, literals, nliterals);
+    dst += nliterals;
+
+    if (match == 0)
+        return dst;
+
+    const uint16_t offset = LITTLE_16((uint16_t)distance);
+    memcpy(dst, &offset, 2);
+    dst += 2;
+
+    if (extra >= 15)
+        dst = write_length(dst, extra - 15);
+
+    return dst;
+}
+
+/*  Compress `length` bytes of `src` into `dst`, which has to hold at least `compress_bound(length, 1)` bytes.
+ *  This doesn't use the Python API, so it can run without holding the GIL.
+ *
+ *  Returns the number of compressed bytes.
+ */
+static size_t compress_raw(const char *src, const size_t length, char *dst)
+{
+    // Positions relative to `src`, where zero-initialized slots point to the start of the data and are checked like any other
+    uint32_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    const char *const end = src + length;
+    const char *ip = src;
+    const char *anchor = src;
+    char *op = dst;
+
+    if (length > MATCH_LIMIT)
+    {
+        const char *const match_limit = end - MATCH_LIMIT;
+        const char *const match_end = end - LAST_LITERALS;
+
+        while (ip < match_limit)
+        {
+            const uint32_t sequence = read_32(ip);
+            const uint32_t hash = hash_32(sequence);
+            const char *ref = src + table[hash];
+
+            table[hash] = (uint32_t)(ip - src);
+
+            if (ref >= ip || ip - ref > MAX_DISTANCE || read_32(ref) != sequence)
+            {
+                // Skip ahead faster the longer no match is found, so that incompressible data passes quickly
+                ip += 1 + ((size_t)(ip - anchor) >> 6);
+                continue;
+            }
+
+            // Extend the match backwards over the pending literals
+            while (ip > anchor && ref > src && ip[-1] == ref[-1])
+            {
+                --ip;
+                --ref;
+            }
+
+            const size_t match = MIN_MATCH + match_length(ip + MIN_MATCH, ref + MIN_MATCH, match_end);
+
+            op = write_sequence(op, anchor, (size_t)(ip - anchor), (size_t)(ip - ref), match);
+
+            ip += match;
+            anchor = ip;
+
+            // Index a position near the end of the match, as the data that follows often repeats it
+            if (ip < match_limit)
+                table[hash_32(read_32(ip - 2))] = (uint32_t)(ip - 2 - src);
+        }
+    }
+
+    return (size_t)(write_sequence(op, anchor, (size_t)(end - anchor), 0, 0) - dst);
+}
+
+// Get the maximum number of bytes that `length` raw bytes compress to in `nblocks` blocks, frame headers included
+size_t compress_bound(const size_t length, const size_t nblocks)
+{
+    return length + (length / 255) + nblocks * (CHECKED_FRAME_HEADER_SIZE + 16);
+}
+
+// Get the checksum of a block, which covers the lengths in its frame header as well as the stored data
+static inline uint32_t block_checksum(const size_t raw_length, const char *stored, const size_t stored_length)
+{
+    const uint32_t lengths[2] = {LITTLE_32((uint32_t)raw_length), LITTLE_32((uint32_t)stored_length)};
+
+    return crc32c(crc32c(0, (const char *)lengths, 8), stored, stored_length);
+}
+
+/*  Write the frame header of a block holding `length` raw bytes, of which the `stored_length` stored bytes are at `stored`.
+ *  These are only read to checksum them if `flags` has `BLOCK_CHECKSUM`, so the header can be written before they're in place.
+ *  This doesn't use the Python API, so it can run without holding the GIL.
+ *
+ *  Returns the size of the frame header.
+ */
+size_t write_frame_header(char *dst, const size_t raw_length, const char *stored, const size_t stored_length, const int flags)
+{
+    const uint32_t raw = LITTLE_32((uint32_t)raw_length);
+    const uint32_t size = LITTLE_32((uint32_t)stored_length);
+
+    memcpy(dst + 1, &raw, 4);
+    memcpy(dst + 5, &size, 4);
+
+    if (flags & BLOCK_CHECKSUM)
+    {
+        dst[0] = (char)CHECKED_FRAME_BYTE;
+        write_checksum(dst + FRAME_HEADER_SIZE, block_checksum(raw_length, stored, stored_length));
+
+        return CHECKED_FRAME_HEADER_SIZE;
+    }
+
+    dst[0] = (char)FRAME_BYTE;
+    return FRAME_HEADER_SIZE;
+}
+
+/*  Write `length` bytes of `src` as a block in `dst`, which has to hold at least `compress_bound(length, 1)` bytes.
+ *  The data is stored as is if it isn't compressed or doesn't get smaller. This doesn't use the Python API, so it can run
+ *  without holding the GIL.
+ *
+ *  Returns the number of bytes of the block, including the frame header.
+ */
+size_t write_block(const char *src, const size_t length, char *dst, const int flags)
+{
+    const size_t header_size = flags & BLOCK_CHECKSUM ? CHECKED_FRAME_HEADER_SIZE : FRAME_HEADER_SIZE;
+    char *stored = dst + header_size;
+
+    size_t stored_length = flags & BLOCK_COMPRESS ? compress_raw(src, length, stored) : length;
+
+    if (stored_length >= length)
+    {
+        memcpy(stored, src, length);
+        stored_length = length;
+    }
+
+    write_frame_header(dst, length, stored, stored_length, flags);
+
+    return header_size + stored_length;
+}
+
+/*  Write `length` bytes of `src` as blocks in `dst`, after copying over the first `start` bytes as is.
+ *  Blocks end at the offsets in `ends` if given, and hold `BLOCK_SIZE` bytes otherwise. `dst` has to hold at least
+ *  `compress_bound(length, nblocks)` bytes. This doesn't use the Python API, so it can run without holding the GIL.
+ *
+ *  Returns the number of bytes written to `dst`.
+ */
+size_t write_blocks(const char *src, const size_t length, const size_t start, const block_ends_t *ends, const int flags, char *dst)
+{
+    memcpy(dst, src, start);
+
+    size_t offset = start;
+    size_t written = start;
+    size_t idx = 0;
+
+    while (offset < length)
+    {
+        size_t end;
+
+        if (ends == NULL)
+            end = length - offset > BLOCK_SIZE ? offset + BLOCK_SIZE : length;
+        else
+            end = idx < ends->count ? ends->offsets[idx++] : length;
+
+        written += write_block(src + offset, end - offset, dst + written, flags);
+        offset = end;
+    }
+
+    return written;
+}
+
+// Add the offset at which a block ends. Returns 1 with an error set if out of memory
+int block_ends_add(block_ends_t *ends, const size_t offset)
+{
+    if (ends->count == ends->capacity)
+    {
+        const size_t capacity = ends->capacity == 0 ? 16 : ends->capacity << 1;
+        size_t *offsets = (size_t *)realloc(ends->offsets, capacity * sizeof(size_t));
+
+        if (offsets == NULL)
+        {
+            PyErr_NoMemory();
+            return 1;
+        }
+
+        ends->offsets = offsets;
+        ends->capacity = capacity;
+    }
+
+    ends->offsets[ends->count++] = offset;
+    return 0;
+}
+
+/*  Read the frame header of a block, which has to have `FRAME_HEADER_LENGTH(header[0])` bytes available.
+ *  Returns 1 if it doesn't start a block.
+ */
+int read_frame_header(const char *header, frame_t *frame)
+{
+    if (!IS_FRAME_BYTE(header[0]))
+        return 1;
+
+    uint32_t raw;
+    uint32_t stored;
+
+    memcpy(&raw, header + 1, 4);
+    memcpy(&stored, header + 5, 4);
+
+    frame->raw_length = (size_t)LITTLE_32(raw);
+    frame->stored_length = (size_t)LITTLE_32(stored);
+    frame->checked = (header[0] & 0xFF) == CHECKED_FRAME_BYTE;
+    frame->header_size = frame->checked ? CHECKED_FRAME_HEADER_SIZE : FRAME_HEADER_SIZE;
+    frame->checksum = frame->checked ? read_checksum(header + FRAME_HEADER_SIZE) : 0;
+
+    // Stored data is never larger than the raw data
+    return frame->stored_length > frame->raw_length;
+}
+
+/*  Decompress the stored data of a block into `raw_length` bytes of `dst`. Every sequence is checked against the bounds of
+ *  both buffers, so corrupted data can't read or write outside of them.
+ *
+ *  Returns 1 if the data is corrupted.
+ */
+static int decompress_block(const char *src, const size_t stored_length, char *dst, const size_t raw_length)
+{
+    // Blocks that didn't get smaller are stored as is
+    if (stored_length == raw_length)
+    {
+        memcpy(dst, src, raw_length);
+        return 0;
+    }
+
+    const unsigned char *ip = (const unsigned char *)src;
+    const unsigned char *const end = ip + stored_length;
+    char *op = dst;
+    char *const op_end = dst + raw_length;
+
+    for (;;)
+    {
+        if (ip == end)
+            return 1;
+
+        const unsigned int token = *(ip++);
+        size_t nliterals = token >> 4;
+
+        if (nliterals == 15 && read_length(&ip, end, &nliterals) == 1)
+            return 1;
+
+        if (nliterals > (size_t)(end - ip) || nliterals > (size_t)(op_end - op))
+            return 1;
+
+        memcpy(op, ip, nliterals);
+        op += nliterals;
+        ip += nliterals;
+
+        // The last sequence only holds literals
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return 1;
+
+        const size_t distance = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+
+        if (distance == 0 || distance > (size_t)(op - dst))
+            return 1;
+
+        size_t match = token & 0b1111;
+
+        if (match == 15 && read_length(&ip, end, &match) == 1)
+            return 1;
+
+        match += MIN_MATCH;
+
+        if (match > (size_t)(op_end - op))
+            return 1;
+
+        const char *ref = op - distance;
+
+        if (distance >= match)
+        {
+            memcpy(op, ref, match);
+        }
+        else if (distance >= 8 && (size_t)(op_end - op) >= match + 8)
+        {
+            // Copy overlapping matches in steps of 8 bytes, each of which is already written when it's read
+            for (size_t i = 0; i < match; i += 8)
+                memcpy(op + i, ref + i, 8);
+        }
+        else
+        {
+            for (size_t i = 0; i < match; ++i)
+                op[i] = ref[i];
+        }
+
+        op += match;
+    }
+
+    return op != op_end;
+}
+
+// Verify the checksum of a block against its stored data at `src`. Returns 1 if it doesn't match, or 0 if it has no checksum
+int verify_block(const frame_t *frame, const char *src)
+{
+    return frame->checked && block_checksum(frame->raw_length, src, frame->stored_length) != frame->checksum;
+}
+
+/*  Verify the checksum of the `frame->stored_length` bytes of `src` if the block has one, and decompress them into
+ *  `frame->raw_length` bytes of `dst`. This doesn't use the Python API, so it can run without holding the GIL.
+ *
+ *  Returns 1 if the data is corrupted.
+ */
+int unpack_block(const frame_t *frame, const char *src, char *dst)
+{
+    if (verify_block(frame, src) == 1)
+        return 1;
+
+    return decompress_block(src, frame->stored_length, dst, frame->raw_length);
+}
+
+/*  Get the offset of the first block in encoded data. Blocks either start the data, or follow the metadata of the container
+ *  of stream compatible data, which has to be the 9-byte metadata that streams write.
+ *
+ *  Returns `NO_FRAME` if the data isn't made up of blocks.
+ */
+size_t frame_offset(const char *data, const size_t length)
+{
+    if (IS_FRAME_BYTE(data[0]))
+        return 0;
+
+    // Lists and dicts with the mode 3 metadata holding an 8-byte number of items
+    if (length > MAX_METADATA_SIZE + 1 && (data[0] & 0b11111110) == 0b11111000 && IS_FRAME_BYTE(data[MAX_METADATA_SIZE + 1]))
+        return MAX_METADATA_SIZE + 1;
+
+    return NO_FRAME;
+}
+
+/*  Unpack the blocks of encoded data from `start` onwards into a newly allocated buffer, copying over the first `start`
+ *  bytes as is. The blocks end where the data doesn't continue with another one. This doesn't use the Python API,
+ *  so it can run without holding the GIL.
+ *
+ *  Returns 0 on success, 1 if the data is corrupted, and -1 if out of memory.
+ */
+int decompress_data(const char *data, const size_t length, const size_t start, char **raw, size_t *raw_length)
+{
+    size_t total = start;
+    size_t offset = start;
+
+    // Find the total size first, so that everything is unpacked into a single buffer
+    while (length - offset >= FRAME_HEADER_SIZE && IS_FRAME_BYTE(data[offset]))
+    {
+        frame_t frame;
+
+        if (length - offset < FRAME_HEADER_LENGTH(data[offset]) || read_frame_header(data + offset, &frame) == 1 ||
+            frame.stored_length > length - offset - frame.header_size)
+            return 1;
+
+        total += frame.raw_length;
+        offset += frame.header_size + frame.stored_length;
+    }
+
+    if (offset == start)
+        return 1;
+
+    // Leave room for reading the metadata of a value past the end of the data, which is checked afterwards
+    char *buf = (char *)malloc(total + MAX_METADATA_SIZE);
+
+    if (buf == NULL)
+        return -1;
+
+    memcpy(buf, data, start);
+
+    char *dst = buf + start;
+    const char *src = data + start;
+
+    while (src != data + offset)
+    {
+        frame_t frame;
+
+        read_frame_header(src, &frame);
+        src += frame.header_size;
+
+        if (unpack_block(&frame, src, dst) == 1)
+        {
+            free(buf);
+            return 1;
+        }
+
+        src += frame.stored_length;
+        dst += frame.raw_length;
+    }
+
+    *raw = buf;
+    *raw_length = total;
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <Python.h>
+
+#include "main/checksum.h"
+
+#include "globals/typemasks.h"
+
+// Metadata bytes that start a compressed block, and a block with a checksum of its stored data
+#define FRAME_BYTE (unsigned char)(DT_EXTNS | (EXT_CMPRS << 3))
+#define CHECKED_FRAME_BYTE (unsigned char)(DT_EXTNS | (EXT_CHKBK << 3))
+
+#define IS_FRAME_BYTE(byte) (((byte) & 0xFF) == FRAME_BYTE || ((byte) & 0xFF) == CHECKED_FRAME_BYTE)
+
+// Size of the frame header of a block: the frame byte, the 4-byte raw length and the 4-byte stored length, and the checksum if checked
+#define FRAME_HEADER_SIZE 9
+#define CHECKED_FRAME_HEADER_SIZE (FRAME_HEADER_SIZE + CHECKSUM_SIZE)
+
+// Size of the frame header that starts with `byte`
+#define FRAME_HEADER_LENGTH(byte) (((byte) & 0xFF) == CHECKED_FRAME_BYTE ? CHECKED_FRAME_HEADER_SIZE : FRAME_HEADER_SIZE)
+
+// Flags for writing blocks, which are compressed, checksummed, or both
+#define BLOCK_COMPRESS 1
+#define BLOCK_CHECKSUM 2
+
+// Number of raw bytes per compressed block when compressing regular data
+#define BLOCK_SIZE (1024*1024)
+
+// Maximum number of raw bytes in a single block, as the lengths in the frame header are 4 bytes
+#define MAX_BLOCK_SIZE 0xFFFFFFFF
+
+// Minimum size of data to compress or decompress with the GIL released
+#define COMPRESSION_GIL_RELEASE_MIN_SIZE (1024*64)
+
+// Returned by `frame_offset` if the data isn't compressed
+#define NO_FRAME ((size_t)-1)
+
+// The frame header of a block
+typedef struct {
+    size_t raw_length;
+    size_t stored_length;
+    size_t header_size;
+    int checked;
+    uint32_t checksum;
+} frame_t;
+
+// Offsets at which the blocks of stream compatible data end, so that each block holds whole items of the stream container
+typedef struct {
+    size_t *offsets;
+    size_t count;
+    size_t capacity;
+} block_ends_t;
+
+int block_ends_add(block_ends_t *ends, const size_t offset);
+
+size_t compress_bound(const size_t length, const size_t nblocks);
+size_t write_frame_header(char *dst, const size_t raw_length, const char *stored, const size_t stored_length, const int flags);
+size_t write_block(const char *src, const size_t length, char *dst, const int flags);
+size_t write_blocks(const char *src, const size_t length, const size_t start, const block_ends_t *ends, const int flags, char *dst);
+
+int read_frame_header(const char *header, frame_t *frame);
+int verify_block(const frame_t *frame, const char *src);
+int unpack_block(const frame_t *frame, const char *src, char *dst);
+
+size_t frame_offset(const char *data, const size_t length);
+int decompress_data(const char *data, const size_t length, const size_t start, char **raw, size_t *raw_length);
+
+#endif // COMPRESSION_H
+
@@ -0,0 +1,123 @@
+// This file contains the memory mapping of files, so that they can be decoded without reading them into memory first
+
+#include <Python.h>
+
+#include "main/filemap.h"
+
+#include "globals/exceptions.h"
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+/*  Map the entire content of a file into memory as read-only. The pages are loaded from the page cache as they're accessed,
+ *  so only the parts in use take up memory, and the mapping stays valid after the file itself is closed. The mapping ends
+ *  where the file does, so the data is decoded with the same bounds checks as any other buffer, without padding after it.
+ *  This doesn't use the Python API, so it can run without holding the GIL.
+ *
+ *  Returns 0 on success, or one of the FILE_* results otherwise.
+ */
+int map_file(const char *filename, const int flags, char **base, size_t *size)
+{
+    int status = 0;
+
+#ifdef _WIN32
+
+    // Windows doesn't support huge pages for mappings of files, and is told about sequential access when opening the file instead
+    (void)flags;
+
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (file == INVALID_HANDLE_VALUE)
+        return FILE_OPEN_FAILED;
+
+    LARGE_INTEGER length;
+    length.QuadPart = 0;
+
+    if (GetFileSizeEx(file, &length) == 0)
+        status = FILE_SEEK_FAILED;
+    else if (length.QuadPart == 0)
+        status = FILE_EMPTY;
+    else
+    {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+        if (mapping == NULL)
+            status = FILE_MAP_FAILED;
+        else
+        {
+            // The view keeps the mapping alive by itself
+            if ((*base = (char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) == NULL)
+                status = FILE_MAP_FAILED;
+
+            CloseHandle(mapping);
+        }
+    }
+
+    CloseHandle(file);
+
+    *size = (size_t)length.QuadPart;
+
+#else
+
+    int fd = open(filename, O_RDONLY);
+
+    if (fd == -1)
+        return FILE_OPEN_FAILED;
+
+    struct stat info;
+    info.st_size = 0;
+
+    if (fstat(fd, &info) != 0)
+        status = FILE_SEEK_FAILED;
+    else if (info.st_size == 0)
+        status = FILE_EMPTY;
+    else if ((*base = (char *)mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == (char *)MAP_FAILED)
+        status = FILE_MAP_FAILED;
+
+    close(fd);
+
+    *size = (size_t)info.st_size;
+
+    #ifdef MADV_HUGEPAGE
+    // This is only a request, which the system can ignore if it doesn't support huge pages for the page cache
+    if (status == 0 && (flags & MAPPING_HUGE_PAGES))
+        madvise(*base, *size, MADV_HUGEPAGE);
+    #else
+    (void)flags;
+    #endif
+
+#endif
+
+    return status;
+}
+
+void unmap_file(char *base, const size_t size)
+{
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(base);
+#else
+    munmap(base, size);
+#endif
+}
+
+/*  Advise the system of how the mapping is going to be accessed. While decoding, the data is read from start to end once,
+ *  so the system can read ahead aggressively and drop the pages behind it. Referenced values point into the mapping
+ *  afterwards though, and are accessed in any order.
+ */
+void advise_mapping(char *base, const size_t size, const int access)
+{
+#if !defined(_WIN32) && defined(MADV_SEQUENTIAL)
+    madvise(base, size, access == MAPPING_SEQUENTIAL ? MADV_SEQUENTIAL : MADV_NORMAL);
+#else
+    (void)base;
+    (void)size;
+    (void)access;
+#endif
+}
@@ -0,0 +1,17 @@
+#ifndef FILEMAP_H
+#define FILEMAP_H
+
+#include <Python.h>
+
+// Flags for mapping files, which request huge pages for the mapping where supported
+#define MAPPING_HUGE_PAGES 1
+
+// Access patterns to advise the system of, so that it can read ahead or keep pages around accordingly
+#define MAPPING_NORMAL 0
+#define MAPPING_SEQUENTIAL 1
+
+int map_file(const char *filename, const int flags, char **base, size_t *size);
+void unmap_file(char *base, const size_t size);
+void advise_mapping(char *base, const size_t size, const int access);
+
+#endif // FILEMAP_H
@@ -3,16 +3,31 @@
 #include <Python.h>
 
 #include "main/serialization.h"
+#include "main/compression.h"
+#include "main/checksum.h"
+#include "main/filemap.h"
 
 #include "globals/exceptions.h"
 #include "globals/buftricks.h"
 #include "globals/typemasks.h"
 #include "globals/typedefs.h"
+#include "globals/framestack.h"
+#include "globals/atomics.h"
+#include "globals/modstate.h"
 
 #include "settings/allocations.h"
 
 #include "types/usertypes.h"
+#include "types/base.h"
+#include "types/lazy.h"
 
+// Python 3.8 doesn't have `Py_SET_SIZE` yet
+#if (PY_VERSION_HEX < 0x03090000)
+    #define Py_SET_SIZE(ob, size) (Py_SIZE(ob) = (size))
+#endif
+
+// Maximum number of unused bytes to leave at the end of an encoded bytes object instead of shrinking it
+#define MAX_RESULT_SLACK 4096
 
 /* ENCODING */
 
@@ -20,16 +35,32 @@ int offset_check(reg_encode_t *b, const size_t length)
 {
     if (b->offset + length >= b->max_offset)
     {
-        const size_t new_length = BUF_GET_OFFSET + length + avg_realloc_size;
+        const size_t used = BUF_GET_OFFSET;
+        const size_t new_length = grown_buffer_size(b->state, b->allocs, BUF_GET_LENGTH, used + length);
 
-        char *tmp = (char *)realloc(b->base, new_length);
-        if (tmp == NULL)
+        char *tmp;
+        if (b->in_place == 1)
         {
-            PyErr_NoMemory();
-            return 1;
+            // Frees the bytes object and sets it to NULL on failure
+            if (_PyBytes_Resize(&b->bytes, (Py_ssize_t)new_length) != 0)
+            {
+                b->base = b->offset = b->max_offset = NULL;
+                return 1;
+            }
+
+            tmp = PyBytes_AS_STRING(b->bytes);
+        }
+        else
+        {
+            tmp = (char *)realloc(b->base, new_length);
+            if (tmp == NULL)
+            {
+                PyErr_NoMemory();
+                return 1;
+            }
         }
 
-        b->offset = tmp + BUF_GET_OFFSET;
+        b->offset = tmp + used;
         b->max_offset = tmp + new_length;
         b->base = tmp;
 
@@ -39,77 +70,244 @@ int offset_check(reg_encode_t *b, const size_t length)
     return 0;
 }
 
-static inline int encode_container(reg_encode_t *b, PyObject *cont, PyTypeObject *type, const int stream_compatible)
+// Make sure the buffer can hold at least `length` bytes. Existing data is not preserved
+static inline int reserve_buffer(reg_encode_t *b, const size_t length)
 {
-    size_t nitems = Py_SIZE(cont);
-    size_t initial_alloc;
-
-    if (type == &PyList_Type)
+    if (b->base == NULL || (size_t)BUF_GET_LENGTH < length)
     {
-        initial_alloc = (nitems * avg_item_size) + avg_realloc_size;
-        b->base = b->offset = (char *)malloc(initial_alloc);
-        b->max_offset = b->base + initial_alloc;
-
-        if (b->base == NULL)
+        if (b->in_place == 1)
         {
-            PyErr_NoMemory();
-            return 1;
-        }
+            Py_XDECREF(b->bytes);
+            b->bytes = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)length);
 
-        if (stream_compatible == 0)
-        {
-            METADATA_VARLEN_WR(DT_ARRAY, nitems);
+            b->base = b->bytes == NULL ? NULL : PyBytes_AS_STRING(b->bytes);
         }
         else
         {
-            __SETBYTE(DT_ARRAY | 0b111);
-            memcpy(b->offset, &nitems, 8);
+            // Don't use realloc as we don't need to preserve data
+            free(b->base);
+            b->base = (char *)malloc(length);
 
-            b->offset += 8;
+            if (b->base == NULL)
+                PyErr_NoMemory();
         }
 
-        for (size_t i = 0; i < nitems; ++i)
-            if (encode_object((encode_t *)b, PyList_GET_ITEM(cont, i)) == 1) return 1;
-    }
-    else
-    {
-        // Allocate for twice as many items as we have pairs of keys and values
-        initial_alloc = (nitems * 2 * avg_item_size) + avg_realloc_size;
-        b->base = b->offset = (char *)malloc(initial_alloc);
-        b->max_offset = b->base + initial_alloc;
-
         if (b->base == NULL)
         {
-            PyErr_NoMemory();
+            b->offset = b->max_offset = NULL;
             return 1;
         }
 
-        if (stream_compatible == 0)
-        {
-            METADATA_VARLEN_WR(DT_DICTN, nitems);
-        }
-        else
-        {
-            __SETBYTE(DT_DICTN | 0b111);
-            memcpy(b->offset, &nitems, 8);
+        b->max_offset = b->base + length;
+    }
 
-            b->offset += 8;
-        }
+    b->offset = b->base;
+    return 0;
+}
 
-        nitems <<= 1;
+/*  End the block of stream compatible data after the current item if it holds enough data, so that blocks
+ *  hold whole items and stream decoders can decode them one block at a time. Returns 1 with an error set on failure.
+ */
+static inline int end_block(reg_encode_t *b, block_ends_t *ends, size_t *block_start)
+{
+    const size_t offset = BUF_GET_OFFSET;
+
+    if (offset - *block_start < BLOCK_SIZE)
+        return 0;
+
+    if (offset - *block_start > MAX_BLOCK_SIZE)
+    {
+        PyErr_SetString(b->state->encoding_error, "Items of compressed or checksummed stream compatible data cannot be larger than 4 GiB");
+        return 1;
+    }
+
+    *block_start = offset;
+    return block_ends_add(ends, offset);
+}
+
+/*  Encode a list or dict. The buffer is (re-)allocated based on the allocation sizes, unless it is already large enough.
+ *  The allocation sizes are tweaked afterwards based on how far off the prediction was.
+ *
+ *  If `ends` is given, the offsets at which the items of stream compatible data fill a block are added to it.
+ */
+static inline int encode_container(reg_encode_t *b, PyObject *cont, PyTypeObject *type, const int stream_compatible, block_ends_t *ends)
+{
+    const size_t npairs = Py_SIZE(cont);
+    const int is_list = type == &PyList_Type;
+
+    // Dicts have twice as many items as they have pairs of keys and values
+    const size_t nitems = is_list ? npairs : npairs << 1;
+    const size_t initial_alloc = (nitems * b->allocs->item_size) + b->allocs->realloc_size;
+
+    if (reserve_buffer(b, initial_alloc) == 1)
+        return 1;
+
+    /*  Containers are encoded like nested ones, which includes encoding lists by column or as packed integers.
+     *  Streams append to the container afterwards, so stream compatible ones are always encoded as regular lists and dicts.
+     */
+    if (stream_compatible == 0)
+    {
+        if (encode_object((encode_t *)b, cont) == 1)
+            return 1;
 
+        update_allocation_settings(b->state, b->allocs, b->reallocs, BUF_GET_OFFSET, initial_alloc, nitems);
+        return 0;
+    }
+
+    const unsigned char tpmask = is_list ? DT_ARRAY : DT_DICTN;
+
+    if (enter_depth(&b->max_depth, 1, b->state->encoding_error) == 1)
+        return 1;
+
+    // Streams expect the 8-byte length to update the number of items in place
+    METADATA_VARLEN_WR_MODE3(tpmask, npairs, 8);
+
+    int status = 0;
+    size_t block_start = BUF_GET_OFFSET;
+
+    if (is_list)
+    {
+        for (size_t i = 0; i < npairs && status == 0; ++i)
+        {
+            status = encode_object((encode_t *)b, PyList_GET_ITEM(cont, i));
+
+            if (status == 0 && ends != NULL)
+                status = end_block(b, ends, &block_start);
+        }
+    }
+    else
+    {
         PyObject *key;
         PyObject *val;
         Py_ssize_t pos = 0;
 
-        while (PyDict_Next(cont, &pos, &key, &val))
+        while (status == 0 && PyDict_Next(cont, &pos, &key, &val))
         {
-            if (encode_object((encode_t *)b, key) == 1) return 1;
-            if (encode_object((encode_t *)b, val) == 1) return 1;
+            status = encode_key((encode_t *)b, key) == 1 || encode_object((encode_t *)b, val) == 1;
+
+            if (status == 0 && ends != NULL)
+                status = end_block(b, ends, &block_start);
         }
     }
 
-    update_allocation_settings(b->reallocs, BUF_GET_OFFSET, initial_alloc, nitems);
+    ++b->max_depth;
+
+    if (status == 1)
+        return 1;
+
+    update_allocation_settings(b->state, b->allocs, b->reallocs, BUF_GET_OFFSET, initial_alloc, nitems);
+    return 0;
+}
+
+// Encode any value into the buffer of `b`, which is either NULL or an existing buffer to reuse
+static inline int encode_value(reg_encode_t *b, PyObject *value, const int stream_compatible, block_ends_t *ends)
+{
+    // See if we got a list or dict type
+    PyTypeObject *type = Py_TYPE(value);
+
+    b->reallocs = 0;
+
+    if (type == &PyList_Type || type == &PyDict_Type)
+        return encode_container(b, value, type, stream_compatible, ends);
+
+    if (reserve_buffer(b, b->allocs->realloc_size) == 1)
+        return 1;
+
+    return encode_object((encode_t *)b, value);
+}
+
+/*  Write the encoded data of `b` as blocks into a new bytes object, compressed and/or checksummed according to `flags`.
+ *  The first `start` bytes are kept as is, which hold the container metadata of stream compatible data. Compressed data
+ *  that didn't get smaller is kept as is instead, unless it's checksummed, which decodes as usual.
+ *
+ *  Returns 1 with an error set on failure.
+ */
+static int encode_blocks(reg_encode_t *b, const size_t start, const block_ends_t *ends, const int flags)
+{
+    const size_t size = BUF_GET_OFFSET;
+    const size_t nblocks = ends != NULL ? ends->count + 1 : (size / BLOCK_SIZE) + 1;
+    const size_t bound = compress_bound(size, nblocks);
+
+    PyObject *blocks = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)bound);
+
+    if (blocks == NULL)
+        return 1;
+
+    char *dst = PyBytes_AS_STRING(blocks);
+
+    // Both buffers are only referenced by us, so let other threads run while compressing larger data
+    PyThreadState *tstate = size >= COMPRESSION_GIL_RELEASE_MIN_SIZE ? PyEval_SaveThread() : NULL;
+
+    const size_t written = write_blocks(b->base, size, start, ends, flags, dst);
+
+    if (tstate != NULL)
+        PyEval_RestoreThread(tstate);
+
+    if (written >= size && !(flags & BLOCK_CHECKSUM))
+    {
+        Py_DECREF(blocks);
+        return 0;
+    }
+
+    Py_DECREF(b->bytes);
+
+    b->bytes = blocks;
+    b->base = dst;
+    b->offset = dst + written;
+    b->max_offset = dst + bound;
+
+    return 0;
+}
+
+/*  Add a checksum to the encoded data of `b`, which is moved up to make room for the checksum byte in front of it.
+ *  Returns 1 with an error set on failure.
+ */
+static int checksum_encoded(reg_encode_t *b)
+{
+    const size_t size = BUF_GET_OFFSET;
+
+    if (offset_check(b, CHECKSUM_OVERHEAD) == 1)
+        return 1;
+
+    char *data = b->base;
+
+    // The buffer is only referenced by us, so let other threads run while checksumming larger data
+    PyThreadState *tstate = size >= CHECKSUM_GIL_RELEASE_MIN_SIZE ? PyEval_SaveThread() : NULL;
+
+    memmove(data + 1, data, size);
+    const uint32_t crc = crc32c(0, data + 1, size);
+
+    if (tstate != NULL)
+        PyEval_RestoreThread(tstate);
+
+    data[0] = (char)CHECKSUM_BYTE;
+    write_checksum(data + 1 + size, crc);
+
+    b->offset = data + size + CHECKSUM_OVERHEAD;
+    return 0;
+}
+
+// Parse a non-negative integer argument, such as 'max_depth', the maximum number of nested containers
+static int parse_size(PyObject *py_value, const char *name, size_t *size)
+{
+    if (!PyLong_Check(py_value))
+    {
+        PyErr_Format(PyExc_ValueError, "The '%s' argument must be of type 'int', got '%s'", name, Py_TYPE(py_value)->tp_name);
+        return 1;
+    }
+
+    const Py_ssize_t value = PyLong_AsSsize_t(py_value);
+
+    if (value == -1 && PyErr_Occurred())
+        return 1;
+
+    if (value < 0)
+    {
+        PyErr_Format(PyExc_ValueError, "The '%s' argument cannot be negative", name);
+        return 1;
+    }
+
+    *size = (size_t)value;
     return 0;
 }
 
@@ -125,6 +323,14 @@ PyObject *encode(PyObject *self, PyObject *args, PyObject *kwargs)
       - file_name;
       - stream_compatible;
       - custom_types;
+      - key_table;
+      - columnar;
+      - compact_numbers;
+      - preserve_refs;
+      - sized;
+      - compress;
+      - checksum;
+      - max_depth;
 
     */
 
@@ -139,9 +345,19 @@ PyObject *encode(PyObject *self, PyObject *args, PyObject *kwargs)
         return NULL;
     }
 
+    module_state_t *state = MODULE_STATE(self);
+
     char *filename = NULL;
     utypes_encode_ob *utypes = NULL;
     int stream_compatible = 0;
+    int key_table = 0;
+    int columnar = 0;
+    int compact = 0;
+    int preserve_refs = 0;
+    int sized = 0;
+    int compress = 0;
+    int checksum = 0;
+    size_t max_depth = DEFAULT_MAX_DEPTH;
 
     // Check if we received kwargs
     if (kwargs != NULL)
@@ -159,7 +375,7 @@ PyObject *encode(PyObject *self, PyObject *args, PyObject *kwargs)
                 return NULL;
             }
 
-            filename = PyUnicode_AsUTF8(py_filename);
+            filename = (char *)PyUnicode_AsUTF8(py_filename);
 
             // Check if the decremented remaining count is zero, exit if so
             if (--remaining == 0)
@@ -168,18 +384,102 @@ PyObject *encode(PyObject *self, PyObject *args, PyObject *kwargs)
 
         utypes = (utypes_encode_ob *)PyDict_GetItemString(kwargs, "custom_types");
 
-        if (utypes != NULL && Py_TYPE(utypes) != &utypes_encode_t)
+        if (utypes != NULL)
         {
-            PyErr_Format(PyExc_ValueError, "The 'custom_types' argument must be of type 'compaqt.CustomWriteTypes', got '%s'", Py_TYPE(utypes)->tp_name);
-            return NULL;
+            if (Py_TYPE(utypes) != state->utypes_encode_type)
+            {
+                PyErr_Format(PyExc_ValueError, "The 'custom_types' argument must be of type 'compaqt.CustomWriteTypes', got '%s'", Py_TYPE(utypes)->tp_name);
+                return NULL;
+            }
+
+            if (--remaining == 0)
+                goto kwargs_parse_end;
         }
-        else if (--remaining == 0)
-            goto kwargs_parse_end;
 
         PyObject *py_stream_compatible = PyDict_GetItemString(kwargs, "stream_compatible");
 
-        if (py_stream_compatible != NULL && py_stream_compatible == Py_True)
-            stream_compatible = 1;
+        if (py_stream_compatible != NULL)
+        {
+            stream_compatible = py_stream_compatible == Py_True;
+
+            if (--remaining == 0)
+                goto kwargs_parse_end;
+        }
+
+        PyObject *py_key_table = PyDict_GetItemString(kwargs, "key_table");
+
+        if (py_key_table != NULL)
+        {
+            key_table = py_key_table == Py_True;
+
+            if (--remaining == 0)
+                goto kwargs_parse_end;
+        }
+
+        PyObject *py_columnar = PyDict_GetItemString(kwargs, "columnar");
+
+        if (py_columnar != NULL)
+        {
+            columnar = py_columnar == Py_True;
+
+            if (--remaining == 0)
+                goto kwargs_parse_end;
+        }
+
+        PyObject *py_compact = PyDict_GetItemString(kwargs, "compact_numbers");
+
+        if (py_compact != NULL)
+        {
+            compact = py_compact == Py_True;
+
+            if (--remaining == 0)
+                goto kwargs_parse_end;
+        }
+
+        PyObject *py_preserve_refs = PyDict_GetItemString(kwargs, "preserve_refs");
+
+        if (py_preserve_refs != NULL)
+        {
+            preserve_refs = py_preserve_refs == Py_True;
+
+            if (--remaining == 0)
+                goto kwargs_parse_end;
+        }
+
+        PyObject *py_sized = PyDict_GetItemString(kwargs, "sized");
+
+        if (py_sized != NULL)
+        {
+            sized = py_sized == Py_True;
+
+            if (--remaining == 0)
+                goto kwargs_parse_end;
+        }
+
+        PyObject *py_compress = PyDict_GetItemString(kwargs, "compress");
+
+        if (py_compress != NULL)
+        {
+            compress = py_compress == Py_True;
+
+            if (--remaining == 0)
+                goto kwargs_parse_end;
+        }
+
+        PyObject *py_checksum = PyDict_GetItemString(kwargs, "checksum");
+
+        if (py_checksum != NULL)
+        {
+            checksum = py_checksum == Py_True;
+
+            if (--remaining == 0)
+                goto kwargs_parse_end;
+        }
+
+        PyObject *py_max_depth = PyDict_GetItemString(kwargs, "max_depth");
+
+        if (py_max_depth != NULL && parse_size(py_max_depth, "max_depth", &max_depth) == 1)
+            return NULL;
     }
 
     // We jump here if all kwargs are parsed
@@ -191,72 +491,552 @@ PyObject *encode(PyObject *self, PyObject *args, PyObject *kwargs)
     
     reg_encode_t b;
 
-    b.reallocs = 0;
+    b.base = b.offset = b.max_offset = NULL;
     b.bufcheck = (bufcheck_t)offset_check;
     b.utypes = utypes;
+    b.allocs = thread_allocdata(state);
+    b.keys = NULL;
+    b.columnar = columnar;
+    b.compact = compact;
+    b.sized = sized;
+    b.max_depth = max_depth;
+    b.refs = NULL;
+    b.state = state;
+
+    // The key table only lives for the duration of this message
+    if (key_table == 1 && (b.keys = PyDict_New()) == NULL)
+        return NULL;
 
-    // See if we got a list or dict type
-    PyTypeObject *type = Py_TYPE(value);
+    // Readers that skip sized containers would miss the table entries defined within them, so tables leave containers unsized
+    if (key_table == 1 || preserve_refs == 1)
+        b.sized = 0;
 
-    if (type == &PyList_Type || type == &PyDict_Type)
+    // Dicts encoded by column can't be referenced, so lists of dicts are encoded as usual when preserving references
+    if (preserve_refs == 1)
     {
-        // This manages the initial buffer allocation itself
-        if (encode_container(&b, value, type, stream_compatible) == 1)
+        b.columnar = 0;
+
+        if ((b.refs = memo_new()) == NULL)
         {
-            free(b.base);
+            Py_XDECREF(b.keys);
             return NULL;
         }
     }
-    else
-    {
-        b.base = b.offset = b.max_offset = NULL;
 
-        if (encode_object((encode_t *)&b, value) == 1)
-        {
-            free(b.base);
-            return NULL;
-        }
+    // Build the result in a bytes object directly, so it doesn't have to be copied over afterwards
+    b.bytes = NULL;
+    b.in_place = 1;
+
+    /*  Compressed stream compatible data keeps the metadata of its container in front of the blocks, which hold whole items.
+     *  Streams are appended to, so their checksums are kept per block as well. Other data gets a single checksum instead.
+     */
+    const int stream_container = stream_compatible == 1 && (PyList_CheckExact(value) || PyDict_CheckExact(value));
+    const int flags = (compress == 1 ? BLOCK_COMPRESS : 0) | (checksum == 1 && stream_container == 1 ? BLOCK_CHECKSUM : 0);
+    block_ends_t ends = {NULL, 0, 0};
+
+    int status = encode_value(&b, value, stream_compatible, flags != 0 && stream_container == 1 ? &ends : NULL);
+    Py_XDECREF(b.keys);
+    memo_free(b.refs);
+
+    if (status == 0 && flags != 0)
+        status = encode_blocks(&b, stream_container == 1 ? MAX_METADATA_SIZE + 1 : 0, stream_container == 1 ? &ends : NULL, flags);
+
+    if (status == 0 && checksum == 1 && stream_container == 0)
+        status = checksum_encoded(&b);
+
+    free(ends.offsets);
+
+    if (status == 1)
+    {
+        Py_XDECREF(b.bytes);
+        return NULL;
     }
 
     // See if we should write to a file
     if (filename != NULL)
     {
+        const size_t size = (size_t)(b.offset - b.base);
+        int status = 0;
+
+        // The encoded data is only referenced by us, so let other threads run while it's written
+        Py_BEGIN_ALLOW_THREADS
         FILE *file = fopen(filename, "wb");
 
         if (file == NULL)
+            status = FILE_OPEN_FAILED;
+        else
+        {
+            if (fwrite(b.base, 1, size, file) != size)
+                status = FILE_WRITE_FAILED;
+            
+            if (fclose(file) != 0)
+                status = FILE_WRITE_FAILED;
+        }
+        Py_END_ALLOW_THREADS
+        
+        Py_DECREF(b.bytes);
+
+        if (status == FILE_OPEN_FAILED)
         {
             PyErr_Format(PyExc_FileNotFoundError, "Unable to open/create file '%s'", filename);
-            free(b.base);
+            return NULL;
+        }
+        else if (status == FILE_WRITE_FAILED)
+        {
+            PyErr_Format(PyExc_OSError, "Unable to write to file '%s'", filename);
             return NULL;
         }
 
-        fwrite(b.base, 1, (size_t)(b.offset - b.base), file);
-        fclose(file);
-        
-        free(b.base);
         Py_RETURN_NONE;
     }
 
-    // Otherwise return as a Python bytes object
-    PyObject *result = PyBytes_FromStringAndSize(b.base, b.offset - b.base);
-    
-    free(b.base);
+    const size_t size = (size_t)(b.offset - b.base);
+    const size_t slack = (size_t)(b.max_offset - b.offset);
+
+    /*  Shrink the bytes object down to the encoded size. Re-allocating to shrink a little
+     *  doesn't return any memory worth it, but does make the allocator trim and re-fault its pages,
+     *  so only re-allocate if more than a page would be left unused.
+     */
+    if (slack > MAX_RESULT_SLACK)
+    {
+        if (_PyBytes_Resize(&b.bytes, (Py_ssize_t)size) != 0)
+            return NULL;
+    }
+    else
+    {
+        Py_SET_SIZE(b.bytes, (Py_ssize_t)size);
+        b.base[size] = '\0';
+    }
+
+    return b.bytes;
+}
+
+/* ENCODER OBJECT */
+
+typedef struct {
+    PyObject_HEAD
+    reg_encode_t b;
+    PyObject *module;      // The module that created the encoder, which keeps the module state of `b` alive
+    allocdata_t allocs;    // Allocation sizes of this encoder, separate from those of the thread
+    int stream_compatible; // Whether to encode lists and dicts stream compatible
+    int busy;              // Whether the buffer is in use, as it's shared by all calls on the encoder
+} encoder_ob;
+
+// Claim the buffer of an encoder. Returns 1 with an error set if it's already in use by another call
+static inline int encoder_claim(encoder_ob *ob)
+{
+    if (atomic_try_set(&ob->busy) == 1)
+        return 0;
+
+    PyErr_SetString(PyExc_RuntimeError, "The encoder is already in use");
+    return 1;
+}
+
+static PyObject *encoder_encode(encoder_ob *ob, PyObject *value)
+{
+    reg_encode_t *b = &ob->b;
+
+    if (encoder_claim(ob) == 1)
+        return NULL;
+
+    PyObject *result = NULL;
+
+    if (encode_value(b, value, ob->stream_compatible, NULL) == 0)
+        result = PyBytes_FromStringAndSize(b->base, b->offset - b->base);
+
+    ATOMIC_CLEAR(&ob->busy);
     return result;
 }
 
+static PyObject *encoder_clear(encoder_ob *ob)
+{
+    reg_encode_t *b = &ob->b;
+
+    if (encoder_claim(ob) == 1)
+        return NULL;
+
+    free(b->base);
+    b->base = b->offset = b->max_offset = NULL;
+
+    ATOMIC_CLEAR(&ob->busy);
+    Py_RETURN_NONE;
+}
+
+static PyObject *encoder_capacity(encoder_ob *ob)
+{
+    reg_encode_t *b = &ob->b;
+    return PyLong_FromSize_t((size_t)BUF_GET_LENGTH);
+}
+
+static void encoder_dealloc(encoder_ob *ob)
+{
+    PyTypeObject *type = Py_TYPE(ob);
+
+    free(ob->b.base);
+    Py_XDECREF(ob->b.utypes);
+    Py_XDECREF(ob->module);
+
+    type->tp_free((PyObject *)ob);
+    HEAPTYPE_DECREF(type);
+}
+
+static PyGetSetDef encoder_getset[] = {
+    {"capacity", (getter)encoder_capacity, NULL, "The number of bytes currently allocated for the internal buffer", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyMethodDef encoder_methods[] = {
+    {"encode", (PyCFunction)encoder_encode, METH_O, "Encode a value to bytes"},
+    {"clear", (PyCFunction)encoder_clear, METH_NOARGS, "Free the internal buffer"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyType_Slot encoder_slots[] = {
+    {Py_tp_methods, encoder_methods},
+    {Py_tp_dealloc, (destructor)encoder_dealloc},
+    {Py_tp_getset, encoder_getset},
+    {0, NULL}
+};
+
+PyType_Spec encoder_spec = {
+    .name = "compaqt.Encoder",
+    .basicsize = sizeof(encoder_ob),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    .slots = encoder_slots,
+};
+
+// Init function for encoder objects
+PyObject *get_encoder(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    module_state_t *state = MODULE_STATE(self);
+
+    utypes_encode_ob *utypes = NULL;
+    int stream_compatible = 0;
+    Py_ssize_t initial_capacity = 0;
+
+    static char *kwlist[] = {"custom_types", "stream_compatible", "initial_capacity", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O!pn", kwlist, state->utypes_encode_type, &utypes, &stream_compatible, &initial_capacity))
+        return NULL;
+
+    if (initial_capacity < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "The initial capacity cannot be negative");
+        return NULL;
+    }
+
+    encoder_ob *ob = PyObject_New(encoder_ob, state->encoder_type);
+
+    if (ob == NULL)
+        return PyErr_NoMemory();
+
+    reg_encode_t *b = &ob->b;
+
+    b->base = b->offset = b->max_offset = NULL;
+    b->bufcheck = (bufcheck_t)offset_check;
+    b->utypes = utypes;
+    b->keys = NULL;
+    b->columnar = 0;
+    b->compact = 0;
+    b->sized = 0;
+    b->max_depth = DEFAULT_MAX_DEPTH;
+    b->refs = NULL;
+    b->state = state;
+    b->reallocs = 0;
+    b->allocs = &ob->allocs;
+    b->bytes = NULL;
+    b->in_place = 0;
+
+    // Start off with the current allocation sizes of this thread
+    ob->allocs = *thread_allocdata(state);
+    ob->module = self;
+    ob->stream_compatible = stream_compatible;
+    ob->busy = 0;
+
+    Py_XINCREF(utypes);
+    Py_INCREF(self);
+
+    if (initial_capacity != 0 && reserve_buffer(b, (size_t)initial_capacity) == 1)
+    {
+        Py_DECREF(ob);
+        return NULL;
+    }
+
+    return (PyObject *)ob;
+}
+
+/* ENCODING INTO A BUFFER */
+
+/*  Offset check for a caller-supplied buffer. Continues in a scratch buffer once a write doesn't fit the caller's buffer,
+ *  keeping the data written so far where it is, so that only the data after it has to be copied back if it fits after all.
+ *  The headroom of a write is the most it can take, so writes that end exactly at the end of the buffer still fit.
+ */
+static int into_offset_check(into_encode_t *b, const size_t length)
+{
+    if (b->offset + length > b->max_offset)
+    {
+        const size_t new_length = (length << 1) + b->allocs->realloc_size;
+
+        char *tmp = (char *)malloc(new_length);
+        if (tmp == NULL)
+        {
+            PyErr_NoMemory();
+            return 1;
+        }
+
+        b->kept = BUF_GET_OFFSET;
+
+        b->offset = tmp;
+        b->max_offset = tmp + new_length;
+        b->base = tmp;
+
+        // The scratch buffer is ours, so continue with the regular offset checks
+        b->bufcheck = (bufcheck_t)offset_check;
+    }
+
+    return 0;
+}
+
+// Set a `BufferSizeError` that holds the number of bytes that were needed
+static inline void set_buffer_size_error(module_state_t *state, const size_t needed, const size_t available)
+{
+    PyObject *msg = PyUnicode_FromFormat("Needed %zu bytes to encode the value, while the buffer had %zu bytes available", needed, available);
+    if (msg == NULL)
+        return;
+
+    PyObject *exc = PyObject_CallFunctionObjArgs(state->buffer_size_error, msg, NULL);
+    Py_DECREF(msg);
+
+    if (exc == NULL)
+        return;
+
+    PyObject *py_needed = PyLong_FromSize_t(needed);
+    if (py_needed == NULL || PyObject_SetAttrString(exc, "needed_size", py_needed) != 0)
+    {
+        Py_XDECREF(py_needed);
+        Py_DECREF(exc);
+        return;
+    }
+
+    Py_DECREF(py_needed);
+
+    PyErr_SetObject(state->buffer_size_error, exc);
+    Py_DECREF(exc);
+}
+
+PyObject *encode_into(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    module_state_t *state = MODULE_STATE(self);
+
+    PyObject *value;
+    PyObject *buffer;
+    Py_ssize_t offset = 0;
+    utypes_encode_ob *utypes = NULL;
+
+    static char *kwlist[] = {"value", "buffer", "offset", "custom_types", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|nO!", kwlist, &value, &buffer, &offset, state->utypes_encode_type, &utypes))
+        return NULL;
+
+    Py_buffer view;
+    if (PyObject_GetBuffer(buffer, &view, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS) != 0)
+        return NULL;
+
+    if (offset < 0 || offset > view.len)
+    {
+        PyErr_Format(PyExc_ValueError, "The offset must be between 0 and the buffer size (%zi), got %zi", view.len, offset);
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+
+    const size_t available = (size_t)(view.len - offset);
+
+    into_encode_t b;
+
+    b.user_base = (char *)view.buf + offset;
+    b.base = b.offset = b.user_base;
+    b.kept = 0;
+    b.max_offset = b.user_base + available;
+
+    b.reallocs = 0;
+    b.allocs = thread_allocdata(state);
+    b.bytes = NULL;
+    b.in_place = 0;
+    b.bufcheck = (bufcheck_t)into_offset_check;
+    b.utypes = utypes;
+    b.keys = NULL;
+    b.columnar = 0;
+    b.compact = 0;
+    b.sized = 0;
+    b.max_depth = DEFAULT_MAX_DEPTH;
+    b.refs = NULL;
+    b.state = state;
+
+    if (encode_object((encode_t *)&b, value) == 1)
+    {
+        if (b.base != b.user_base)
+            free(b.base);
+
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+
+    const size_t written = b.kept + (size_t)(b.offset - b.base);
+
+    // The offset checks reserve some headroom, so the data may have continued in the scratch buffer while it does fit the caller's buffer
+    if (b.base != b.user_base)
+    {
+        if (written <= available)
+            memcpy(b.user_base + b.kept, b.base, written - b.kept);
+
+        free(b.base);
+
+        if (written > available)
+        {
+            set_buffer_size_error(b.state, written, available);
+            PyBuffer_Release(&view);
+            return NULL;
+        }
+    }
+
+    PyBuffer_Release(&view);
+    return PyLong_FromSize_t(written);
+}
+
+/* ENCODED SIZE */
+
+// Size of the stack buffer to measure encoded data in
+#define SIZE_CHUNK 4096
+
+// Offset check for measuring the encoded size. Counts and discards the data written so far instead of growing the buffer
+static int size_check(size_encode_t *b, const size_t length)
+{
+    if (b->offset + length >= b->max_offset)
+    {
+        b->counted += BUF_GET_OFFSET;
+        b->offset = b->base;
+
+        // Only allocate if a single item doesn't fit the buffer on its own
+        if (length >= (size_t)BUF_GET_LENGTH)
+        {
+            if (b->base != b->stack)
+                free(b->base);
+
+            const size_t new_length = length + SIZE_CHUNK;
+
+            b->base = b->offset = (char *)malloc(new_length);
+            if (b->base == NULL)
+            {
+                PyErr_NoMemory();
+                return 1;
+            }
+
+            b->max_offset = b->base + new_length;
+        }
+    }
+
+    return 0;
+}
+
+// Get the exact number of bytes `value` encodes to, using the same dispatch as encoding. Returns 1 on error
+int encoded_size_of(module_state_t *state, PyObject *value, utypes_encode_ob *utypes, size_t *size)
+{
+    char chunk[SIZE_CHUNK];
+
+    size_encode_t b;
+
+    b.stack = b.base = b.offset = chunk;
+    b.max_offset = chunk + SIZE_CHUNK;
+    b.counted = 0;
+    b.bufcheck = (bufcheck_t)size_check;
+    b.utypes = utypes;
+    b.keys = NULL;
+    b.columnar = 0;
+    b.compact = 0;
+    b.sized = 0;
+    b.max_depth = DEFAULT_MAX_DEPTH;
+    b.refs = NULL;
+    b.state = state;
+
+    const int status = encode_object((encode_t *)&b, value);
+
+    *size = b.counted + (size_t)(b.offset - b.base);
+
+    // The buffer is NULL if allocating a larger one failed
+    if (b.base != b.stack)
+        free(b.base);
+
+    return status;
+}
+
+PyObject *encoded_size(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    module_state_t *state = MODULE_STATE(self);
+
+    PyObject *value;
+    utypes_encode_ob *utypes = NULL;
+
+    static char *kwlist[] = {"value", "custom_types", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O!", kwlist, &value, state->utypes_encode_type, &utypes))
+        return NULL;
+
+    size_t size;
+    if (encoded_size_of(state, value, utypes, &size) == 1)
+        return NULL;
+
+    return PyLong_FromSize_t(size);
+}
+
 /* DECODING */
 
 static inline int overread_check(decode_t *b, const size_t length)
 {
-    if (b->offset + length > b->max_offset)
+    // The offset is past the end if the metadata of a value was read past it
+    if (b->offset > b->max_offset || (size_t)(b->max_offset - b->offset) < length)
     {
-        PyErr_SetString(DecodingError, "Received invalid or corrupted bytes");
+        PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
         return 1;
     }
 
     return 0;
 }
 
+/*  Read the entire content of a file into a newly allocated buffer. This doesn't use the Python API, so it can run without holding the GIL.
+ *
+ *  Returns 0 on success, or one of the FILE_* results otherwise.
+ */
+static int read_file(const char *filename, char **base, size_t *size)
+{
+    FILE *file = fopen(filename, "rb");
+
+    if (file == NULL)
+        return FILE_OPEN_FAILED;
+
+    int status = 0;
+    long end;
+
+    // Get the length of the file, then go back to the start of it to read its contents
+    if (fseek(file, 0, SEEK_END) != 0 || (end = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0)
+        status = FILE_SEEK_FAILED;
+    else if (end == 0)
+        status = FILE_EMPTY;
+    else if ((*base = (char *)malloc((size_t)end)) == NULL)
+        status = FILE_NO_MEMORY;
+    else if (fread(*base, 1, (size_t)end, file) != (size_t)end)
+    {
+        free(*base);
+        status = FILE_READ_FAILED;
+    }
+
+    fclose(file);
+
+    if (status == 0)
+        *size = (size_t)end;
+
+    return status;
+}
+
 PyObject *decode(PyObject *self, PyObject *args, PyObject *kwargs)
 {
     /* CUSTOM ARG PARSING */
@@ -269,21 +1049,36 @@ PyObject *decode(PyObject *self, PyObject *args, PyObject *kwargs)
       - file_name;
       - custom_types;
       - referenced;
+      - lazy;
+      - max_depth;
+      - offset;
+      - length;
+      - mmap;
+      - huge_pages;
 
     */
 
+    module_state_t *state = MODULE_STATE(self);
+
     PyObject *value = NULL;
     char *filename = NULL;
     utypes_decode_ob *utypes = NULL;
     int referenced = 0;
+    int lazy = 0;
+    size_t max_depth = DEFAULT_MAX_DEPTH;
+    size_t offset = 0;
+    size_t length = (size_t)-1;
+    int ranged = 0;
+    int mapped = 0;
+    int map_flags = 0;
 
     if (PyTuple_GET_SIZE(args) != 0)
     {
         value = PyTuple_GET_ITEM(args, 0);
 
-        if (!PyBytes_Check(value))
+        if (!PyObject_CheckBuffer(value))
         {
-            PyErr_Format(PyExc_ValueError, "The 'encoded' argument must be of type 'bytes', got '%s'", Py_TYPE(value)->tp_name);
+            PyErr_Format(PyExc_ValueError, "The 'encoded' argument must be a bytes-like object, got '%s'", Py_TYPE(value)->tp_name);
             return NULL;
         }
     }
@@ -298,15 +1093,20 @@ PyObject *decode(PyObject *self, PyObject *args, PyObject *kwargs)
         if (referenced == 1 && --remaining == 0)
                 goto kwargs_parse_end;
 
+        // Lists and dicts are decoded on access, keeping the buffer alive meanwhile
+        lazy = PyDict_GetItemString(kwargs, "lazy") == Py_True;
+        if (lazy == 1 && --remaining == 0)
+                goto kwargs_parse_end;
+
         if (value == NULL)
         {
             value = PyDict_GetItemString(kwargs, "encoded");
 
             if (value != NULL)
             {
-                if (!PyBytes_Check(value))
+                if (!PyObject_CheckBuffer(value))
                 {
-                    PyErr_Format(PyExc_ValueError, "The 'encoded' argument must be of type 'bytes', got '%s'", Py_TYPE(value)->tp_name);
+                    PyErr_Format(PyExc_ValueError, "The 'encoded' argument must be a bytes-like object, got '%s'", Py_TYPE(value)->tp_name);
                     return NULL;
                 }
             }
@@ -335,121 +1135,262 @@ PyObject *decode(PyObject *self, PyObject *args, PyObject *kwargs)
         
         utypes = (utypes_decode_ob *)PyDict_GetItemString(kwargs, "custom_types");
 
-        if (utypes != NULL && Py_TYPE(utypes) != &utypes_decode_t)
+        if (utypes != NULL && Py_TYPE(utypes) != state->utypes_decode_type)
         {
-            if (Py_TYPE(utypes) != &utypes_decode_t)
-            {
-                PyErr_Format(PyExc_ValueError, "The 'custom_types' argument must be of type 'compaqt.CustomReadTypes', got '%s'", Py_TYPE(utypes)->tp_name);
+            PyErr_Format(PyExc_ValueError, "The 'custom_types' argument must be of type 'compaqt.CustomReadTypes', got '%s'", Py_TYPE(utypes)->tp_name);
+            return NULL;
+        }
+
+        if (utypes != NULL && --remaining == 0)
+            goto kwargs_parse_end;
+
+        PyObject *py_max_depth = PyDict_GetItemString(kwargs, "max_depth");
+
+        if (py_max_depth != NULL)
+        {
+            if (parse_size(py_max_depth, "max_depth", &max_depth) == 1)
                 return NULL;
-            }
+
+            if (--remaining == 0)
+                goto kwargs_parse_end;
         }
+
+        // The part of the encoded buffer to decode
+        PyObject *py_offset = PyDict_GetItemString(kwargs, "offset");
+
+        if (py_offset != NULL)
+        {
+            if (parse_size(py_offset, "offset", &offset) == 1)
+                return NULL;
+
+            ranged = 1;
+            if (--remaining == 0)
+                goto kwargs_parse_end;
+        }
+
+        PyObject *py_length = PyDict_GetItemString(kwargs, "length");
+
+        if (py_length != NULL)
+        {
+            if (py_length != Py_None && parse_size(py_length, "length", &length) == 1)
+                return NULL;
+
+            ranged = 1;
+            if (--remaining == 0)
+                goto kwargs_parse_end;
+        }
+
+        // Whether to map the file into memory instead of reading it, optionally with huge pages
+        mapped = PyDict_GetItemString(kwargs, "mmap") == Py_True;
+        map_flags = PyDict_GetItemString(kwargs, "huge_pages") == Py_True ? MAPPING_HUGE_PAGES : 0;
     }
 
     kwargs_parse_end:
 
     /* END OF CUSTOM PARSING */
 
+    if (filename != NULL && ranged == 1)
+    {
+        PyErr_SetString(PyExc_ValueError, "The 'offset' and 'length' arguments can only be used with the 'encoded' argument");
+        return NULL;
+    }
+
+    size_t size;
+
+    // The source of the data, which is moved over to the reference buffer when referencing it
+    bufdata_t src;
+
     // Read from the value if one is given
     if (value != NULL)
     {
-        Py_ssize_t size;
-        PyBytes_AsStringAndSize(value, &b.base, &size);
+        // The buffer of the value stays exported while decoding, so that the object can't resize it meanwhile
+        if (PyObject_GetBuffer(value, &src.view, PyBUF_SIMPLE) != 0)
+            return NULL;
 
-        if (size == 0)
+        src.kind = BUFD_BUFFER;
+
+        if (offset > (size_t)src.view.len || (length != (size_t)-1 && length > (size_t)src.view.len - offset))
         {
-            PyErr_SetString(PyExc_ValueError, "Received an empty bytes object");
+            PyErr_Format(PyExc_ValueError, "The offset and length have to lie within the buffer of %zi bytes", src.view.len);
+            release_bufd_data(&src);
             return NULL;
         }
 
-        b.offset = b.base;
-        b.max_offset = b.base + size;
+        b.base = (char *)src.view.buf + offset;
+        size = length != (size_t)-1 ? length : (size_t)src.view.len - offset;
+
+        if (size == 0)
+        {
+            PyErr_SetString(PyExc_ValueError, "Received an empty buffer");
+            release_bufd_data(&src);
+            return NULL;
+        }
     }
     else
     {
-        // Otherwise read from the file if given
-        FILE *file = fopen(filename, "rb");
+        // Otherwise read or map the file if given. This doesn't touch any Python objects, so let other threads run meanwhile
+        int status;
 
-        if (file == NULL)
+        Py_BEGIN_ALLOW_THREADS
+        if (mapped == 1)
         {
-            PyErr_Format(PyExc_FileNotFoundError, "Cannot open file '%s'", filename);
-            return NULL;
-        }
+            status = map_file(filename, map_flags, &b.base, &size);
 
-        // Get the length of the file
-        if (fseek(file, 0, SEEK_END) != 0)
+            // The data is read from start to end while decoding
+            if (status == 0)
+                advise_mapping(b.base, size, MAPPING_SEQUENTIAL);
+        }
+        else
         {
-            PyErr_Format(FileOffsetError, "Unable to find the end of file '%s'", filename);
-            fclose(file);
-            return NULL;
+            status = read_file(filename, &b.base, &size);
         }
+        Py_END_ALLOW_THREADS
 
-        // The amount to allocate is the size of the file
-        const size_t size = ftell(file);
-
-        if (size == 0)
+        switch (status)
         {
+        case FILE_OPEN_FAILED:
+            PyErr_Format(PyExc_FileNotFoundError, "Cannot open file '%s'", filename);
+            return NULL;
+        case FILE_SEEK_FAILED:
+            PyErr_Format(state->file_offset_error, "Unable to find the size of file '%s'", filename);
+            return NULL;
+        case FILE_READ_FAILED:
+            PyErr_Format(PyExc_OSError, "Unable to read file '%s'", filename);
+            return NULL;
+        case FILE_MAP_FAILED:
+            PyErr_Format(PyExc_OSError, "Unable to map file '%s' into memory", filename);
+            return NULL;
+        case FILE_EMPTY:
             PyErr_SetString(PyExc_ValueError, "Received an empty file");
             return NULL;
-        }
-
-        // Go back to the start of the file to read its contents
-        if (fseek(file, 0, SEEK_SET) != 0)
-        {
-            PyErr_Format(FileOffsetError, "Unable to find the start of file '%s'", filename);
-            fclose(file);
+        case FILE_NO_MEMORY:
+            PyErr_NoMemory();
             return NULL;
         }
 
-        b.base = (char *)malloc(size);
-        if (b.base == NULL)
+        src.base = b.base;
+        src.size = size;
+        src.kind = mapped == 1 ? BUFD_MAPPED : BUFD_ALLOCATED;
+    }
+
+    // The data to decode, which lies within the checksum byte and the checksum of checksummed data
+    char *data = b.base;
+
+    if ((data[0] & 0xFF) == CHECKSUM_BYTE)
+    {
+        // The data is either exported to us or only referenced by us
+        PyThreadState *tstate = size >= CHECKSUM_GIL_RELEASE_MIN_SIZE ? PyEval_SaveThread() : NULL;
+
+        const int status = verify_checksum(data, size);
+
+        if (tstate != NULL)
+            PyEval_RestoreThread(tstate);
+
+        if (status == 1 || size == CHECKSUM_OVERHEAD)
         {
-            PyErr_NoMemory();
-            fclose(file);
+            release_bufd_data(&src);
+
+            if (status == 1)
+                PyErr_SetString(state->decoding_error, "Received data that does not match its checksum");
+            else
+                PyErr_SetString(PyExc_ValueError, "Received checksummed data without a value");
+
             return NULL;
         }
-        
-        // Copy the file content into the allocated message buffer
-        fread(b.base, 1, size, file);
-        fclose(file);
 
-        b.offset = b.base;
-        b.max_offset = b.base + size;
+        ++data;
+        size -= CHECKSUM_OVERHEAD;
     }
 
-    if (referenced == 1)
+    // Compressed data is decompressed into a buffer of its own, which is decoded as usual
+    const size_t start = frame_offset(data, size);
+
+    if (start != NO_FRAME)
     {
-        b.bufd = (bufdata_t *)PyObject_Malloc(sizeof(bufdata_t));
+        char *raw;
+        size_t raw_size;
+
+        // The compressed data is either exported to us or only referenced by us
+        PyThreadState *tstate = size >= COMPRESSION_GIL_RELEASE_MIN_SIZE ? PyEval_SaveThread() : NULL;
+
+        const int status = decompress_data(data, size, start, &raw, &raw_size);
 
-        if (b.bufd == NULL)
+        if (tstate != NULL)
+            PyEval_RestoreThread(tstate);
+
+        // The source isn't needed anymore once the data is decompressed
+        release_bufd_data(&src);
+
+        if (status == -1)
             return PyErr_NoMemory();
-        
-        if (value == NULL)
+        else if (status == 1)
         {
-            b.bufd->base = b.base;
-            b.bufd->is_PyOb = 0;
-        }
-        else
-        {
-            Py_INCREF(value);
-            b.bufd->base = (void *)value;
-            b.bufd->is_PyOb = 1;
+            PyErr_SetString(state->decoding_error, "Received invalid or corrupted compressed or checksummed data");
+            return NULL;
         }
-        
-        b.bufd->refcnt = 0;
+
+        b.base = data = raw;
+        size = raw_size;
+
+        src.base = raw;
+        src.kind = BUFD_ALLOCATED;
     }
-    else
+
+    b.offset = data;
+    b.max_offset = data + size;
+
+    // Referenced values and lazily decoded containers keep the buffer alive through a reference buffer
+    bufdata_t *bufd = NULL;
+
+    if (referenced == 1 || lazy == 1)
     {
-        b.bufd = NULL;
+        bufd = (bufdata_t *)PyObject_Malloc(sizeof(bufdata_t));
+
+        if (bufd == NULL)
+        {
+            release_bufd_data(&src);
+            return PyErr_NoMemory();
+        }
+
+        // The source moves over to the reference buffer, which releases it once nothing references it anymore
+        *bufd = src;
+
+        // Hold a reference while decoding, so that the buffer is also released if no values end up referencing it
+        bufd->refcnt = 1;
     }
 
+    b.bufd = referenced == 1 ? bufd : NULL;
     b.bufcheck = (bufcheck_t)overread_check;
     b.utypes = utypes;
+    b.keys = NULL;
+    b.max_depth = max_depth;
+    b.refs = NULL;
+    b.state = state;
+    b.dropped = 0;
 
-    PyObject *result = decode_bytes(&b);
+    PyObject *result;
 
-    // Free the buffer if we read from a file AND aren't referencing the buffer
-    if (value == NULL && referenced == 0)
-        free(b.base);
+    // Values that aren't lists or dicts have nothing to decode lazily
+    if (lazy == 1 && IS_LAZY_VALUE(data[0] & 0xFF))
+        result = lazy_create(self, bufd, utypes, data, data + size, max_depth, referenced);
+    else
+        result = decode_bytes(&b);
+
+    Py_XDECREF(b.keys);
+    Py_XDECREF(b.refs);
+
+    if (bufd != NULL)
+    {
+        // Referenced values and lazily decoded containers are accessed in any order from now on
+        if (bufd->kind == BUFD_MAPPED && bufd->refcnt > 1)
+            advise_mapping((char *)bufd->base, bufd->size, MAPPING_NORMAL);
+
+        DECREF_BUFD(bufd);
+    }
+    else
+    {
+        release_bufd_data(&src);
+    }
     
     return result;
 }
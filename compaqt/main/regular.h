@@ -2,8 +2,16 @@
 #define REGULAR_H
 
 #include <Python.h>
+#include "globals/typedefs.h"
+
+extern PyType_Spec encoder_spec;
+
+int encoded_size_of(module_state_t *state, PyObject *value, utypes_encode_ob *utypes, size_t *size);
 
 PyObject *encode(PyObject *self, PyObject *args, PyObject *kwargs);
+PyObject *get_encoder(PyObject *self, PyObject *args, PyObject *kwargs);
+PyObject *encode_into(PyObject *self, PyObject *args, PyObject *kwargs);
+PyObject *encoded_size(PyObject *self, PyObject *args, PyObject *kwargs);
 PyObject *decode(PyObject *self, PyObject *args, PyObject *kwargs);
 
 #endif // REGULAR_H
\ No newline at end of file
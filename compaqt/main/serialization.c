@@ -1,85 +1,574 @@
 // This file contains the main processing functions for serialization
 
+#include <float.h>
+#include <math.h>
+
+#include "main/serialization.h"
+
 #include "types/usertypes.h"
 #include "types/base.h"
 #include "types/cbytes.h"
 #include "types/cstr.h"
+#include "types/strdata.h"
 
 #include "globals/exceptions.h"
 #include "globals/typemasks.h"
 #include "globals/buftricks.h"
 #include "globals/typedefs.h"
+#include "globals/memotable.h"
+#include "globals/framestack.h"
+#include "globals/modstate.h"
+
+/* TYPE DISPATCH */
+
+// Codes of the natively supported types. Zero is reserved for types that aren't in the dispatch table
+#define TP_OTHER 0
+#define TP_BYTES 1
+#define TP_BOOLN 2
+#define TP_STRNG 3
+#define TP_INTGR 4
+#define TP_FLOAT 5
+#define TP_NONTP 6
+#define TP_ARRAY 7
+#define TP_DICTN 8
+#define TP_TUPLE 9
+#define TP_SETTP 10
+#define TP_FROZN 11
+#define TP_BARRY 12
+#define TP_MVIEW 13
+#define TP_TARRY 14
+
+/*  The module state holds a perfect hash table from type pointers to type codes. The multiplier is chosen on setup
+ *  so that no types collide, as type addresses are only known at runtime (and differ between interpreters).
+ */
+
+// Multiplicative hash, taking the upper bits of the product
+#define DISPATCH_HASH(type, mult) ((size_t)(((uint64_t)(uintptr_t)(type) * (mult)) >> (64 - DISPATCH_BITS)))
+
+int setup_dispatch(module_state_t *state)
+{
+    PyObject *array_module = PyImport_ImportModule("array");
+
+    if (array_module == NULL)
+        return 1;
+
+    // The `array.array` type is not exposed through the C API. Each interpreter has its own, which the state keeps a reference to
+    state->array_type = (PyTypeObject *)PyObject_GetAttrString(array_module, "array");
+    Py_DECREF(array_module);
+
+    if (state->array_type == NULL)
+        return 1;
+
+    PyTypeObject *array_type = state->array_type;
+    PyTypeObject **dispatch_types = state->dispatch_types;
+    uint8_t *dispatch_codes = state->dispatch_codes;
+
+    PyTypeObject *types[] = {
+        &PyBytes_Type, &PyBool_Type, &PyUnicode_Type, &PyLong_Type, &PyFloat_Type, Py_TYPE(Py_None), &PyList_Type, &PyDict_Type,
+        &PyTuple_Type, &PySet_Type, &PyFrozenSet_Type, &PyByteArray_Type, &PyMemoryView_Type, array_type,
+    };
+    const int codes[] = {
+        TP_BYTES, TP_BOOLN, TP_STRNG, TP_INTGR, TP_FLOAT, TP_NONTP, TP_ARRAY, TP_DICTN,
+        TP_TUPLE, TP_SETTP, TP_FROZN, TP_BARRY, TP_MVIEW, TP_TARRY,
+    };
+    const size_t ntypes = sizeof(codes) / sizeof(int);
+
+    /*  Try odd multipliers, starting at the golden ratio, until every type gets its own slot. The multipliers follow a
+     *  splitmix64 sequence, as nearby multipliers hash types with nearby addresses (static types) to the same slots.
+     */
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+
+    for (uint64_t mult = seed, tries = 0; tries < 100000; ++tries)
+    {
+        memset(dispatch_types, 0, sizeof(state->dispatch_types));
+        memset(dispatch_codes, 0, sizeof(state->dispatch_codes));
 
-/* ENCODING */
+        size_t i = 0;
+        for (; i < ntypes; ++i)
+        {
+            const size_t hash = DISPATCH_HASH(types[i], mult);
+
+            if (dispatch_types[hash] != NULL)
+                break;
+
+            dispatch_types[hash] = types[i];
+            dispatch_codes[hash] = (uint8_t)codes[i];
+        }
+
+        if (i == ntypes)
+        {
+            state->dispatch_mult = mult;
+            return 0;
+        }
+
+        seed += 0x9E3779B97F4A7C15ULL;
+        mult = seed;
+        mult = (mult ^ (mult >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        mult = (mult ^ (mult >> 27)) * 0x94D049BB133111EBULL;
+        mult = (mult ^ (mult >> 31)) | 1;
+    }
+
+    PyErr_SetString(PyExc_RuntimeError, "Unable to set up the type dispatch table");
+    return 1;
+}
+
+// Get the type code of a subtype of a natively supported type. Bools and None can't be subclassed
+static inline int subtype_code(const module_state_t *state, PyTypeObject *type)
+{
+    const unsigned long flags = type->tp_flags;
+
+    if (flags & Py_TPFLAGS_LONG_SUBCLASS)
+        return TP_INTGR;
+    if (flags & Py_TPFLAGS_UNICODE_SUBCLASS)
+        return TP_STRNG;
+    if (flags & Py_TPFLAGS_BYTES_SUBCLASS)
+        return TP_BYTES;
+    if (flags & Py_TPFLAGS_LIST_SUBCLASS)
+        return TP_ARRAY;
+    if (flags & Py_TPFLAGS_DICT_SUBCLASS)
+        return TP_DICTN;
+    if (flags & Py_TPFLAGS_TUPLE_SUBCLASS)
+        return TP_TUPLE;
+    if (PyType_IsSubtype(type, &PyFloat_Type))
+        return TP_FLOAT;
+    if (PyType_IsSubtype(type, &PySet_Type))
+        return TP_SETTP;
+    if (PyType_IsSubtype(type, &PyFrozenSet_Type))
+        return TP_FROZN;
+    if (PyType_IsSubtype(type, &PyByteArray_Type))
+        return TP_BARRY;
+    if (PyType_IsSubtype(type, state->array_type))
+        return TP_TARRY;
+
+    return TP_OTHER;
+}
+
+/* PACKED DATA */
+
+/*  Get the packed data format of a buffer format and item size. Formats with a platform-dependent size
+ *  (such as 'l' and 'n') are normalized to the format of their actual size.
+ *
+ *  Returns 0 if the format is not supported.
+ */
+static char packed_format(const char *format, const Py_ssize_t itemsize)
+{
+    if (format == NULL)
+        return itemsize == 1 ? 'B' : 0;
+
+    // Only native byte order is supported, which is little-endian for '<'
+    if (format[0] == '@' || format[0] == '=' || (format[0] == '<' && IS_LITTLE_ENDIAN == 1))
+        ++format;
+
+    if (format[0] == 0 || format[1] != 0)
+        return 0;
+
+    const char *signed_formats = "bhilqn";
+    const char *unsigned_formats = "BHILQN";
+
+    char packed;
+    if (strchr(signed_formats, format[0]) != NULL)
+        packed = itemsize == 1 ? 'b' : itemsize == 2 ? 'h' : itemsize == 4 ? 'i' : 'q';
+    else if (strchr(unsigned_formats, format[0]) != NULL)
+        packed = itemsize == 1 ? 'B' : itemsize == 2 ? 'H' : itemsize == 4 ? 'I' : 'Q';
+    else if (format[0] == 'f' || format[0] == 'd')
+        packed = format[0];
+    else
+        return 0;
+
+    return (Py_ssize_t)format_width(packed) == itemsize ? packed : 0;
+}
+
+/*  Convert packed items between native and little-endian byte order in place.
+ *  Only does anything on big-endian systems, where the loops over the byte swaps are vectorized by the compiler.
+ */
+static inline void swap_items(char *data, const size_t nitems, const size_t width)
+{
+    #if (IS_LITTLE_ENDIAN == 0)
+
+        #define SWAP_LOOP(utype, LITTLE_x) do { \
+            for (size_t i = 0; i < nitems; ++i) \
+            { \
+                utype item; \
+                memcpy(&item, data + (i * sizeof(utype)), sizeof(utype)); \
+                item = LITTLE_x(item); \
+                memcpy(data + (i * sizeof(utype)), &item, sizeof(utype)); \
+            } \
+        } while (0)
+
+        switch (width)
+        {
+        case 2: SWAP_LOOP(uint16_t, LITTLE_16); break;
+        case 4: SWAP_LOOP(uint32_t, LITTLE_32); break;
+        case 8: SWAP_LOOP(uint64_t, LITTLE_64); break;
+        }
+
+        #undef SWAP_LOOP
+
+    #else
+
+        (void)data;
+        (void)nitems;
+        (void)width;
+
+    #endif
+}
+
+/* COMPACT NUMBERS */
+
+// Zigzag encoding maps signed integers to unsigned ones, so that small negative numbers take few varint bytes as well
+#define ZIGZAG(num) (((uint64_t)(num) << 1) ^ (uint64_t)((int64_t)(num) >> 63))
+#define UNZIGZAG(num) ((int64_t)((num) >> 1) ^ -(int64_t)((num) & 1))
+
+// Whether a double survives a round trip through a float
+static inline int is_float32(const double num)
+{
+    // Converting doubles outside of the float range is undefined
+    return (isinf(num) || fabs(num) <= FLT_MAX) && (double)(float)num == num;
+}
+
+// Get the number of bytes of a varint
+static inline size_t varint_size(uint64_t num)
+{
+    size_t nbytes = 1;
+
+    for (; num >= 0x80; num >>= 7)
+        ++nbytes;
+
+    return nbytes;
+}
 
-// Check datatype for a container item
-#define DT_CHECK(expected) \
-    if (type != &expected) { break; }
+// Write a varint, 7 bits per byte with the high bit set on all but the last byte
+#define VARINT_WR(num) do { \
+    uint64_t __num = (num); \
+    for (; __num >= 0x80; __num >>= 7) \
+        *BUF_POST_INC = (char)((__num & 0x7F) | 0x80); \
+    \
+    *BUF_POST_INC = (char)__num; \
+} while (0)
+
+/* ENCODING */
 
 // Macro for calling and testing the offset check function
 #define OFFSET_CHECK(length) do { \
     if (b->bufcheck(b, length) == 1) return 1; \
 } while (0)
 
-int encode_object(encode_t *b, PyObject *item)
+static int is_uniform(PyObject *list);
+static int encode_columns(encode_t *b, PyObject *list);
+
+/*  Get the encoded size of a list of integers as zigzag varints.
+ *
+ *  Returns 0 if not all items are integers that fit in 8 bytes.
+ */
+static size_t varint_list_size(PyObject *list)
 {
-    PyTypeObject *type = Py_TYPE(item);
-    const char *tp_name = type->tp_name;
+    const Py_ssize_t nitems = PyList_GET_SIZE(list);
+    size_t length = 0;
 
-    switch (*tp_name)
+    for (Py_ssize_t i = 0; i < nitems; ++i)
     {
-    case 'b': // Bytes / Boolean
+        PyObject *item = PyList_GET_ITEM(list, i);
+
+        if (Py_TYPE(item) != &PyLong_Type)
+            return 0;
+
+        int overflow;
+        const long long num = PyLong_AsLongLongAndOverflow(item, &overflow);
+
+        if (overflow != 0)
+            return 0;
+
+        length += varint_size(ZIGZAG(num));
+    }
+
+    return length;
+}
+
+// Encode a list of integers as zigzag varints, of which the total length was calculated already
+static int encode_varint_list(encode_t *b, PyObject *list, const size_t length)
+{
+    const Py_ssize_t nitems = PyList_GET_SIZE(list);
+
+    OFFSET_CHECK(1 + MAX_METADATA_SIZE + length);
+    METADATA_EXTENSION_WR(EXT_ZZINT);
+    METADATA_VARLEN_WR(DT_BYTES, length);
+
+    // Can't fail as the items were checked when getting the length
+    for (Py_ssize_t i = 0; i < nitems; ++i)
+        VARINT_WR(ZIGZAG(PyLong_AsLongLong(PyList_GET_ITEM(list, i))));
+
+    return 0;
+}
+
+// Encode an integer that doesn't fit in 8 bytes, as an extension of bytes holding the little-endian two's complement
+static int encode_bigint(encode_t *b, PyObject *item, const size_t size)
+{
+    OFFSET_CHECK(1 + MAX_METADATA_SIZE + size);
+
+    METADATA_EXTENSION_WR(EXT_BIGNT);
+    METADATA_VARLEN_WR(DT_BYTES, size);
+
+    #if (PY_VERSION_HEX >= 0x030D0000)
+
+        if (PyLong_AsNativeBytes(item, b->offset, (Py_ssize_t)size, Py_ASNATIVEBYTES_LITTLE_ENDIAN) < 0)
+            return 1;
+
+    #else
+
+        if (_PyLong_AsByteArray((PyLongObject *)item, (unsigned char *)(b->offset), size, 1, 1) != 0)
+            return 1;
+
+    #endif
+
+    b->offset += size;
+    return 0;
+}
+
+// Maximum number of keys in the key table, so that references take at most 2 index bytes
+#define KEY_TABLE_LIMIT 65536
+
+// Minimum key length for using the key table, as references take 3 bytes
+#define KEY_TABLE_MIN_LENGTH 3
+
+/*  Write the key table metadata of a dict key. String keys are defined in the table on their first
+ *  occurrence, and written as a reference to their index on every next occurrence.
+ *
+ *  Sets `written` to 1 if the key was written as a reference, otherwise the key still has to be encoded.
+ */
+static int write_key_table(encode_t *b, PyObject *key, int *written)
+{
+    *written = 0;
+
+    if (!PyUnicode_CheckExact(key) || PyUnicode_GET_LENGTH(key) < KEY_TABLE_MIN_LENGTH)
+        return 0;
+
+    PyObject *py_idx = PyDict_GetItemWithError(b->keys, key);
+
+    if (py_idx != NULL)
     {
-        if (tp_name[1] == 'y') // Bytes
-        {
-            DT_CHECK(PyBytes_Type);
+        const size_t idx = PyLong_AsSize_t(py_idx);
+        const size_t nbytes = USED_BYTES_64(idx);
+
+        OFFSET_CHECK(2 + 8);
+        METADATA_EXTENSION_WR(EXT_KEYRF);
+        METADATA_INTEGER_WR(nbytes);
+        __MEMCPY_WRITE(idx, nbytes);
+
+        *written = 1;
+        return 0;
+    }
 
-            const size_t length = PyBytes_GET_SIZE(item);
+    if (PyErr_Occurred())
+        return 1;
 
-            OFFSET_CHECK(MAX_METADATA_SIZE + length);
-            METADATA_VARLEN_WR(DT_BYTES, length);
+    const Py_ssize_t nkeys = PyDict_GET_SIZE(b->keys);
 
-            const char *ptr = PyBytes_AS_STRING(item);
-            memcpy(b->offset, ptr, length);
-            b->offset += length;
-        }
-        else // Boolean
-        {
-            OFFSET_CHECK(1);
-            BOOLEAN_WR(item);
-        }
+    // Encode as a regular string once the table is full
+    if (nkeys >= KEY_TABLE_LIMIT)
+        return 0;
+
+    PyObject *new_idx = PyLong_FromSsize_t(nkeys);
+
+    if (new_idx == NULL)
+        return 1;
 
+    const int status = PyDict_SetItem(b->keys, key, new_idx);
+    Py_DECREF(new_idx);
+
+    if (status != 0)
+        return 1;
+
+    OFFSET_CHECK(1);
+    METADATA_EXTENSION_WR(EXT_KEYDF);
+
+    return 0;
+}
+
+// Encode a dict key, through the key table if it is used
+int encode_key(encode_t *b, PyObject *key)
+{
+    int written = 0;
+
+    if (b->keys != NULL && write_key_table(b, key, &written) == 1)
+        return 1;
+
+    return written == 1 ? 0 : encode_object(b, key);
+}
+
+/*  Write the reference table metadata of a list or dict. Lists and dicts are defined in the table on their
+ *  first occurrence, and written as a reference to their index on every next occurrence, which also ends cycles.
+ *
+ *  Sets `written` to 1 if the value was written as a reference, otherwise the value still has to be encoded.
+ */
+static int write_ref_table(encode_t *b, PyObject *item, int *written)
+{
+    memoslot_t *slot = memo_lookup(b->refs, item);
+
+    if (slot->obj != NULL)
+    {
+        const size_t idx = slot->idx;
+        const size_t nbytes = USED_BYTES_64(idx);
+
+        OFFSET_CHECK(2 + 8);
+        METADATA_EXTENSION_WR(EXT_REFRF);
+        METADATA_INTEGER_WR(nbytes);
+        __MEMCPY_WRITE(idx, nbytes);
+
+        *written = 1;
         return 0;
     }
-    case 's': // String
+
+    *written = 0;
+
+    if (memo_add(b->refs, slot, item) == 1)
+        return 1;
+
+    OFFSET_CHECK(1);
+    METADATA_EXTENSION_WR(EXT_REFDF);
+
+    return 0;
+}
+
+// Encode the data of a numeric buffer as a typed array
+static int encode_typed_array(encode_t *b, Py_buffer *view)
+{
+    const char format = packed_format(view->format, view->itemsize);
+
+    if (format == 0 || view->ndim > 1)
     {
-        DT_CHECK(PyUnicode_Type);
+        PyErr_Format(PyExc_ValueError, "Unsupported buffer format '%s' with %i dimension(s), expected a one-dimensional buffer of numbers",
+            view->format == NULL ? "B" : view->format, view->ndim);
+        return 1;
+    }
 
-        size_t length;
-        const char *bytes = PyUnicode_AsUTF8AndSize(item, (Py_ssize_t *)&length);
+    const size_t length = 1 + (size_t)view->len;
+
+    OFFSET_CHECK(1 + MAX_METADATA_SIZE + length);
+    METADATA_EXTENSION_WR(EXT_TARRY);
+    METADATA_VARLEN_WR(DT_BYTES, length);
+
+    *BUF_POST_INC = format;
+
+    memcpy(b->offset, view->buf, (size_t)view->len);
+    swap_items(b->offset, (size_t)(view->len / view->itemsize), (size_t)view->itemsize);
+
+    b->offset += view->len;
+    return 0;
+}
+
+// Encode a value that isn't a container, based on its type code
+static int encode_single(encode_t *b, PyObject *item, const int code)
+{
+    switch (code)
+    {
+    case TP_BYTES:
+    {
+        const size_t length = PyBytes_GET_SIZE(item);
+
+        OFFSET_CHECK(MAX_METADATA_SIZE + length);
+        METADATA_VARLEN_WR(DT_BYTES, length);
+
+        const char *ptr = PyBytes_AS_STRING(item);
+        memcpy(b->offset, ptr, length);
+        b->offset += length;
+
+        return 0;
+    }
+    case TP_BOOLN:
+    {
+        OFFSET_CHECK(1);
+        BOOLEAN_WR(item);
+
+        return 0;
+    }
+    case TP_STRNG:
+    {
+        /* Strings are encoded from their internal data, as getting their UTF-8 data
+         * would attach a cached UTF-8 copy to every non-ASCII string.
+         */
+        #if (PY_VERSION_HEX < 0x030C0000)
+
+            if (PyUnicode_READY(item) < 0)
+                return 1;
+
+        #endif
+
+        const void *data = PyUnicode_DATA(item);
+        const Py_ssize_t nchars = PyUnicode_GET_LENGTH(item);
+
+        if (PyUnicode_IS_ASCII(item))
+        {
+            OFFSET_CHECK(MAX_METADATA_SIZE + nchars);
+            METADATA_VARLEN_WR(DT_STRNG, nchars);
+
+            memcpy(b->offset, data, nchars);
+            b->offset += nchars;
+
+            return 0;
+        }
+
+        const int kind = PyUnicode_KIND(item);
+        const Py_ssize_t length = utf8_size_of(data, kind, nchars);
+
+        // Let Python raise the error for strings that can't be encoded (containing surrogates)
+        if (length < 0)
+        {
+            PyUnicode_AsUTF8AndSize(item, NULL);
+            return 1;
+        }
 
         OFFSET_CHECK(MAX_METADATA_SIZE + length);
         METADATA_VARLEN_WR(DT_STRNG, length);
 
-        memcpy(b->offset, bytes, length);
+        utf8_write(data, kind, nchars, b->offset);
         b->offset += length;
 
         return 0;
     }
-    case 'i': // Integer
+    case TP_INTGR:
     {
-        DT_CHECK(PyLong_Type);
         OFFSET_CHECK(9);
 
+        /* Fast path for integers that fit in a machine word, written from the word directly.
+         * Compact longs (a single digit) hold their value inline since 3.12; others are converted without the generic byte conversion.
+         */
+        long long num;
+        int overflow = 0;
+
+        #if (PY_VERSION_HEX >= 0x030C0000)
+
+            if (PyUnstable_Long_IsCompact((PyLongObject *)item))
+                num = (long long)PyUnstable_Long_CompactValue((PyLongObject *)item);
+            else
+
+        #endif
+
+        num = PyLong_AsLongLongAndOverflow(item, &overflow);
+
+        if (overflow == 0)
+        {
+            if (num == -1 && PyErr_Occurred())
+                return 1;
+
+            // Number of bytes needed for the two's complement, the magnitude of negatives is taken as their complement
+            const uint64_t magnitude = (uint64_t)(num ^ (num >> 63));
+            const size_t nbytes = magnitude == 0 ? 1 : (72 - LEADING_ZEROES_64(magnitude)) >> 3;
+
+            METADATA_INTEGER_WR(nbytes);
+            __MEMCPY_WRITE((uint64_t)num, nbytes);
+
+            return 0;
+        }
+
         #if (PY_VERSION_HEX >= 0x030D0000)
 
-            const size_t nbytes = PyLong_AsNativeBytes(item, b->offset + 1, 9, Py_ASNATIVEBYTES_LITTLE_ENDIAN);
+            const Py_ssize_t nbytes = PyLong_AsNativeBytes(item, b->offset + 1, 8, Py_ASNATIVEBYTES_LITTLE_ENDIAN);
 
-            if (nbytes == 9)
-            {
-                PyErr_SetString(EncodingError, "Only integers of up to 8 bytes are supported");
+            if (nbytes < 0)
                 return 1;
-            }
+
+            if (nbytes > 8)
+                return encode_bigint(b, item, (size_t)nbytes);
 
             METADATA_INTEGER_WR(nbytes);
             b->offset += nbytes;
@@ -89,10 +578,7 @@ int encode_object(encode_t *b, PyObject *item)
             const size_t nbytes = (_PyLong_NumBits(item) + 8) >> 3;
 
             if (nbytes > 8)
-            {
-                PyErr_SetString(EncodingError, "Only integers of up to 8 bytes are supported");
-                return 1;
-            }
+                return encode_bigint(b, item, nbytes);
 
             METADATA_INTEGER_WR(nbytes);
 
@@ -103,15 +589,29 @@ int encode_object(encode_t *b, PyObject *item)
 
         return 0;
     }
-    case 'f': // Float
+    case TP_FLOAT:
     {
-        DT_CHECK(PyFloat_Type);
         OFFSET_CHECK(9);
 
-        b->offset[0] = DT_FLOAT;
-        BUF_PRE_INC;
-
         double num = PyFloat_AS_DOUBLE(item);
+
+        if (b->compact == 1 && is_float32(num))
+        {
+            *BUF_POST_INC = DT_FLT32;
+
+            const float num32 = (float)num;
+
+            uint32_t raw;
+            memcpy(&raw, &num32, 4);
+            raw = LITTLE_32(raw);
+
+            memcpy(b->offset, &raw, 4);
+            b->offset += 4;
+
+            return 0;
+        }
+
+        *BUF_POST_INC = DT_FLOAT;
         LITTLE_DOUBLE(num);
 
         memcpy(b->offset, &num, 8);
@@ -119,166 +619,1427 @@ int encode_object(encode_t *b, PyObject *item)
 
         return 0;
     }
-    case 'N': // NoneType
+    case TP_NONTP:
     {
-        if (item != Py_None)
-            break;
-        
         OFFSET_CHECK(1);
         
         *BUF_POST_INC = DT_NONTP;
         return 0;
     }
-    case 'l': // List
+    case TP_BARRY:
+    {
+        const size_t length = (size_t)PyByteArray_GET_SIZE(item);
+
+        OFFSET_CHECK(1 + MAX_METADATA_SIZE + length);
+        METADATA_EXTENSION_WR(EXT_BARRY);
+        METADATA_VARLEN_WR(DT_BYTES, length);
+
+        memcpy(b->offset, PyByteArray_AS_STRING(item), length);
+        b->offset += length;
+
+        return 0;
+    }
+    case TP_MVIEW:
+    {
+        Py_buffer view;
+        if (PyObject_GetBuffer(item, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+            return 1;
+
+        // Memoryviews of numbers are encoded as typed arrays
+        if (view.itemsize != 1)
+        {
+            const int status = encode_typed_array(b, &view);
+            PyBuffer_Release(&view);
+
+            return status;
+        }
+
+        const size_t length = (size_t)view.len;
+
+        if (b->bufcheck(b, 1 + MAX_METADATA_SIZE + length) == 1)
+        {
+            PyBuffer_Release(&view);
+            return 1;
+        }
+
+        METADATA_EXTENSION_WR(EXT_MVIEW);
+        METADATA_VARLEN_WR(DT_BYTES, length);
+
+        memcpy(b->offset, view.buf, length);
+        b->offset += length;
+
+        PyBuffer_Release(&view);
+        return 0;
+    }
+    case TP_TARRY:
+    {
+        Py_buffer view;
+        if (PyObject_GetBuffer(item, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+            return 1;
+
+        const int status = encode_typed_array(b, &view);
+        PyBuffer_Release(&view);
+
+        return status;
+    }
+    }
+
+    PyErr_Format(PyExc_ValueError, "Received unsupported datatype '%s'", Py_TYPE(item)->tp_name);
+    return 1;
+}
+
+/*  Frame of a container of which the items are being encoded. Containers get a frame on an explicit
+ *  stack instead of being encoded recursively, so that deeply nested values can't overflow the C stack.
+ */
+typedef struct {
+    PyObject *cont; // The container, or an iterator over it for sets (owned)
+    PyObject *item; // The pending value of a dict (borrowed), or the current item of a set (owned)
+    Py_ssize_t pos; // Position of the next item
+    Py_ssize_t n;   // Number of items of the container
+    int code;       // Type code of the container
+    size_t size_at; // Offset of the size of a sized container from the buffer base, or 0 if the container isn't sized
+} enc_frame_t;
+
+// Write the size prefix of a sized container, of which the size is filled in by `end_sized` once its items are encoded
+#define SIZED_PREFIX_WR(frame) do { \
+    __SETBYTE(SIZED_BYTE); \
+    (frame)->size_at = (size_t)(b->offset - b->base); \
+    b->offset += SIZED_PREFIX_SIZE - 1; \
+} while (0)
+
+/*  Fill in the size of a sized container that's done, which covers everything after the size up to the current offset.
+ *  Offsets from the base are used, as the buffer may have moved while encoding the items.
+ */
+static inline void end_sized(encode_t *b, const enc_frame_t *frame)
+{
+    if (frame->size_at == 0)
+        return;
+
+    const size_t length = (size_t)(b->offset - b->base) - frame->size_at - (SIZED_PREFIX_SIZE - 1);
+    const uint32_t size = LITTLE_32((uint32_t)(length < SIZED_UNKNOWN ? length : SIZED_UNKNOWN));
+
+    memcpy(b->base + frame->size_at, &size, SIZED_PREFIX_SIZE - 1);
+}
+
+/*  Write the metadata of a container and set up its frame. The frame is left without items if the container
+ *  is empty, or if a list was encoded as a whole (by column or as packed integers).
+ */
+static int start_container(encode_t *b, PyObject *item, const int code, enc_frame_t *frame)
+{
+    frame->cont = item;
+    frame->item = NULL;
+    frame->pos = 0;
+    frame->n = 0;
+    frame->code = code;
+    frame->size_at = 0;
+
+    switch (code)
+    {
+    case TP_ARRAY:
+    {
+        const size_t nitems = (size_t)PyList_GET_SIZE(item);
+
+        if (b->columnar == 1)
+        {
+            const int uniform = is_uniform(item);
+
+            if (uniform == -1)
+                return 1;
+
+            /*  Columns are nested in the list holding them. Their values are encoded by recursing,
+             *  so limit the recursion in case the values are encoded by column as well.
+             */
+            if (uniform == 1)
+            {
+                if (enter_depth(&b->max_depth, 1, b->state->encoding_error) == 1)
+                    return 1;
+
+                if (Py_EnterRecursiveCall(" while encoding by column") != 0)
+                {
+                    ++b->max_depth;
+                    return 1;
+                }
+
+                const int status = encode_columns(b, item);
+
+                Py_LeaveRecursiveCall();
+                ++b->max_depth;
+
+                return status;
+            }
+        }
+
+        if (b->compact == 1 && nitems >= 2)
+        {
+            const size_t length = varint_list_size(item);
+
+            if (length != 0)
+                return encode_varint_list(b, item, length);
+        }
+
+        OFFSET_CHECK(SIZED_PREFIX_SIZE + MAX_METADATA_SIZE);
+
+        // Empty containers aren't sized, as they're skipped by reading their metadata already
+        if (b->sized == 1 && nitems != 0)
+            SIZED_PREFIX_WR(frame);
+
+        METADATA_VARLEN_WR(DT_ARRAY, nitems);
+
+        frame->n = (Py_ssize_t)nitems;
+        return 0;
+    }
+    case TP_DICTN:
+    {
+        const size_t nitems = PyDict_GET_SIZE(item);
+
+        OFFSET_CHECK(SIZED_PREFIX_SIZE + MAX_METADATA_SIZE);
+
+        if (b->sized == 1 && nitems != 0)
+            SIZED_PREFIX_WR(frame);
+
+        METADATA_VARLEN_WR(DT_DICTN, nitems);
+
+        frame->n = (Py_ssize_t)nitems;
+        return 0;
+    }
+    case TP_TUPLE:
+    {
+        const size_t nitems = (size_t)PyTuple_GET_SIZE(item);
+
+        OFFSET_CHECK(1 + MAX_METADATA_SIZE);
+        METADATA_EXTENSION_WR(EXT_TUPLE);
+        METADATA_VARLEN_WR(DT_ARRAY, nitems);
+
+        frame->n = (Py_ssize_t)nitems;
+        return 0;
+    }
+    default: // Sets and frozensets
+    {
+        const size_t nitems = (size_t)PySet_GET_SIZE(item);
+
+        OFFSET_CHECK(1 + MAX_METADATA_SIZE);
+        METADATA_EXTENSION_WR(code == TP_SETTP ? EXT_SETTP : EXT_FROZN);
+        METADATA_VARLEN_WR(DT_ARRAY, nitems);
+
+        if (nitems != 0 && (frame->cont = PyObject_GetIter(item)) == NULL)
+            return 1;
+
+        frame->n = (Py_ssize_t)nitems;
+        return 0;
+    }
+    }
+}
+
+// Get the type code of a type, which is `TP_OTHER` if it isn't in the dispatch table
+static inline int dispatch_code(const module_state_t *state, PyTypeObject *type)
+{
+    const size_t hash = DISPATCH_HASH(type, state->dispatch_mult);
+    return state->dispatch_types[hash] == type ? state->dispatch_codes[hash] : TP_OTHER;
+}
+
+/*  Get the type code to encode a value of a type with. Tuples, sets, frozensets, bytearrays, memoryviews and typed arrays
+ *  used to be encoded with custom types only, which keep taking priority over encoding them natively.
+ */
+static inline int encode_code(const encode_t *b, PyTypeObject *type)
+{
+    const int code = dispatch_code(b->state, type);
+    size_t idx;
+
+    if (code >= TP_TUPLE && b->utypes != NULL && get_custom_type(b->utypes, type, &idx) != NULL)
+        return TP_OTHER;
+
+    return code;
+}
+
+// Whether a type code is of a natively supported type that isn't a container
+#define IS_SINGLE(code) ((code) != TP_OTHER && ((code) < TP_ARRAY || (code) > TP_FROZN))
+
+// Make room for another frame once the stack is full or at the maximum depth, which are both checked against `limit`
+#define ENC_FRAMES_RESERVE() do { \
+    if (nframes == max_depth) \
+    { \
+        depth_error(b->state->encoding_error); \
+        goto error; \
+    } \
+    enc_frame_t *grown = (enc_frame_t *)frames_grow(frames, local, &capacity, sizeof(enc_frame_t)); \
+    if (grown == NULL) \
+    { \
+        PyErr_NoMemory(); \
+        goto error; \
+    } \
+    frames = grown; \
+    limit = capacity < max_depth ? capacity : max_depth; \
+} while (0)
+
+/*  Encode a container, custom type or subtype and everything nested in it, with `code` as its type code. The items of
+ *  the innermost container that aren't containers themselves are encoded directly, the others are picked up by the outer loop.
+ */
+static int encode_nested(encode_t *b, PyObject *item, int code)
+{
+    enc_frame_t local[FRAMES_INITIAL];
+    enc_frame_t *frames = local;
+    size_t capacity = FRAMES_INITIAL;
+    size_t nframes = 0;
+
+    // The depth is tracked by the number of frames, the budget of `b` is only lowered for lists that are encoded as a whole
+    const size_t max_depth = b->max_depth;
+    size_t limit = capacity < max_depth ? capacity : max_depth;
+
+    // The state holding the type dispatch table
+    const module_state_t *state = b->state;
+
+    // Whether nested lists are always encoded item by item, without going through the reference table
+    const int plain_lists = b->columnar == 0 && b->compact == 0 && b->refs == NULL;
+
+    for (;;)
+    {
+        PyTypeObject *type = Py_TYPE(item);
+
+        if (code == TP_OTHER)
+        {
+            // Custom types take priority over encoding subtypes as their base type
+            PyObject *func = NULL;
+            size_t idx;
+
+            if (b->utypes != NULL)
+                func = get_custom_type(b->utypes, type, &idx);
+
+            if (func != NULL)
+            {
+                if (encode_custom(b, item, func, idx) == 1)
+                    goto error;
+
+                goto next;
+            }
+
+            code = subtype_code(state, type);
+        }
+
+        if (code < TP_ARRAY || code > TP_FROZN)
+        {
+            if (encode_single(b, item, code) == 1)
+                goto error;
+        }
+        else
+        {
+            // Lists and dicts that were encoded before are written as a reference to them
+            if (b->refs != NULL && (code == TP_ARRAY || code == TP_DICTN))
+            {
+                int written;
+
+                if (write_ref_table(b, item, &written) == 1)
+                    goto error;
+
+                if (written == 1)
+                    goto next;
+            }
+
+            if (nframes == limit)
+                ENC_FRAMES_RESERVE();
+
+            b->max_depth = max_depth - nframes - 1;
+            const int status = start_container(b, item, code, &frames[nframes]);
+            b->max_depth = max_depth;
+
+            if (status == 1)
+                goto error;
+
+            if (frames[nframes].n != 0)
+                ++nframes;
+        }
+
+        next:
+
+        // Encode the items of the innermost container up to the next one that can't be encoded directly, leaving the containers that are done
+        for (item = NULL; item == NULL;)
+        {
+            if (nframes == 0)
+            {
+                FRAMES_FREE(frames, local);
+                return 0;
+            }
+
+            enc_frame_t *frame = &frames[nframes - 1];
+
+            if (frame->code == TP_ARRAY || frame->code == TP_TUPLE)
+            {
+                PyObject **items = PySequence_Fast_ITEMS(frame->cont);
+                Py_ssize_t n = frame->n;
+                Py_ssize_t pos = frame->pos;
+
+                for (;;)
+                {
+                    if (pos == n)
+                    {
+                        // Leave the list or tuple that's done, and carry on with its parent right away if that's a list or tuple as well
+                        if (nframes == 1 || (frame[-1].code != TP_ARRAY && frame[-1].code != TP_TUPLE))
+                            break;
+
+                        end_sized(b, frame);
+
+                        --nframes;
+                        --frame;
+                        items = PySequence_Fast_ITEMS(frame->cont);
+                        n = frame->n;
+                        pos = frame->pos;
+
+                        continue;
+                    }
+
+                    PyObject *next_item = items[pos++];
+                    const int next_code = encode_code(b, Py_TYPE(next_item));
+
+                    if (IS_SINGLE(next_code))
+                    {
+                        if (encode_single(b, next_item, next_code) == 1)
+                            goto error;
+
+                        continue;
+                    }
+
+                    // Nested lists and tuples that are encoded item by item are entered right away to save a trip through the outer loop
+                    if (next_code == TP_TUPLE || (next_code == TP_ARRAY && plain_lists == 1))
+                    {
+                        frame->pos = pos;
+
+                        if (nframes == limit)
+                        {
+                            ENC_FRAMES_RESERVE();
+                            frame = &frames[nframes - 1];
+                        }
+
+                        if (b->bufcheck(b, SIZED_PREFIX_SIZE + MAX_METADATA_SIZE) == 1)
+                            goto error;
+
+                        const Py_ssize_t nitems = Py_SIZE(next_item);
+                        enc_frame_t *next_frame = &frames[nframes];
+                        next_frame->size_at = 0;
+
+                        if (next_code == TP_TUPLE)
+                            METADATA_EXTENSION_WR(EXT_TUPLE);
+                        else if (b->sized == 1 && nitems != 0)
+                            SIZED_PREFIX_WR(next_frame);
+
+                        METADATA_VARLEN_WR(DT_ARRAY, (size_t)nitems);
+
+                        if (nitems == 0)
+                            continue;
+
+                        frame = &frames[nframes++];
+                        frame->cont = next_item;
+                        frame->item = NULL;
+                        frame->n = n = nitems;
+                        frame->code = next_code;
+
+                        items = PySequence_Fast_ITEMS(next_item);
+                        pos = 0;
+
+                        continue;
+                    }
+
+                    item = next_item;
+                    code = next_code;
+                    break;
+                }
+
+                frame->pos = pos;
+            }
+            else if (frame->code == TP_DICTN)
+            {
+                // Dicts alternate between a key and its value, which is left pending while encoding a key that's picked up by the outer loop
+                if (frame->item != NULL)
+                {
+                    item = frame->item;
+                    code = encode_code(b, Py_TYPE(item));
+                    frame->item = NULL;
+
+                    continue;
+                }
+
+                PyObject *key, *val;
+
+                while (PyDict_Next(frame->cont, &frame->pos, &key, &val))
+                {
+                    int written = 0;
+
+                    if (b->keys != NULL && write_key_table(b, key, &written) == 1)
+                        goto error;
+
+                    if (written == 0)
+                    {
+                        const int key_code = encode_code(b, Py_TYPE(key));
+
+                        if (!IS_SINGLE(key_code))
+                        {
+                            item = key;
+                            code = key_code;
+                            frame->item = val;
+                            break;
+                        }
+
+                        if (encode_single(b, key, key_code) == 1)
+                            goto error;
+                    }
+
+                    const int val_code = encode_code(b, Py_TYPE(val));
+
+                    if (!IS_SINGLE(val_code))
+                    {
+                        item = val;
+                        code = val_code;
+                        break;
+                    }
+
+                    if (encode_single(b, val, val_code) == 1)
+                        goto error;
+                }
+            }
+            else
+            {
+                // Hold on to the item of the set while encoding it
+                while (item == NULL)
+                {
+                    Py_XDECREF(frame->item);
+
+                    if ((frame->item = PyIter_Next(frame->cont)) == NULL)
+                    {
+                        // An error is set if the set changed size while iterating
+                        if (PyErr_Occurred())
+                            goto error;
+
+                        Py_DECREF(frame->cont);
+                        break;
+                    }
+
+                    const int next_code = encode_code(b, Py_TYPE(frame->item));
+
+                    if (!IS_SINGLE(next_code))
+                    {
+                        item = frame->item;
+                        code = next_code;
+                    }
+                    else if (encode_single(b, frame->item, next_code) == 1)
+                        goto error;
+                }
+            }
+
+            // The container is done if there's no item left to pick up
+            if (item == NULL)
+            {
+                end_sized(b, frame);
+                --nframes;
+            }
+        }
+    }
+
+    error:
+    for (size_t i = 0; i < nframes; ++i)
+    {
+        if (frames[i].code == TP_SETTP || frames[i].code == TP_FROZN)
+        {
+            Py_DECREF(frames[i].cont);
+            Py_XDECREF(frames[i].item);
+        }
+    }
+
+    FRAMES_FREE(frames, local);
+    return 1;
+}
+
+int encode_object(encode_t *b, PyObject *item)
+{
+    const int code = encode_code(b, Py_TYPE(item));
+
+    // Values that aren't containers are encoded directly, others are left to the nested encoding
+    if (IS_SINGLE(code))
+        return encode_single(b, item, code);
+
+    return encode_nested(b, item, code);
+}
+
+/* COLUMNAR ENCODING */
+
+// Minimum number of dicts in a list to encode it by column
+#define COLUMNAR_MIN_ROWS 2
+
+/*  Check whether a list holds dicts that all have the same keys in the same order.
+ *
+ *  Returns 1 if so, 0 if not, and -1 on error.
+ */
+static int is_uniform(PyObject *list)
+{
+    const Py_ssize_t nrows = PyList_GET_SIZE(list);
+
+    if (nrows < COLUMNAR_MIN_ROWS)
+        return 0;
+
+    PyObject *first = PyList_GET_ITEM(list, 0);
+
+    if (!PyDict_CheckExact(first) || PyDict_GET_SIZE(first) == 0)
+        return 0;
+
+    const Py_ssize_t ncols = PyDict_GET_SIZE(first);
+
+    for (Py_ssize_t i = 1; i < nrows; ++i)
+    {
+        PyObject *row = PyList_GET_ITEM(list, i);
+
+        if (!PyDict_CheckExact(row) || PyDict_GET_SIZE(row) != ncols)
+            return 0;
+
+        Py_ssize_t first_pos = 0, row_pos = 0;
+        PyObject *first_key, *row_key, *val;
+
+        while (PyDict_Next(first, &first_pos, &first_key, &val) && PyDict_Next(row, &row_pos, &row_key, &val))
+        {
+            // Keys are mostly the same objects, only compare them if they're not
+            if (first_key != row_key)
+            {
+                const int equal = PyObject_RichCompareBool(first_key, row_key, Py_EQ);
+
+                if (equal != 1)
+                    return equal;
+            }
+        }
+    }
+
+    return 1;
+}
+
+// Get the smallest packed integer format that holds all values between `min` and `max`
+static inline char packed_int_format(const long long min, const long long max)
+{
+    if (min >= INT8_MIN && max <= INT8_MAX)
+        return 'b';
+    if (min >= INT16_MIN && max <= INT16_MAX)
+        return 'h';
+    if (min >= INT32_MIN && max <= INT32_MAX)
+        return 'i';
+
+    return 'q';
+}
+
+/*  Get the packed format of a column if all its values are ints that fit in 8 bytes, or all floats.
+ *
+ *  Returns 0 if the column can't be packed.
+ */
+static char column_format(PyObject **values, const size_t nrows, const int compact)
+{
+    PyTypeObject *type = Py_TYPE(values[0]);
+
+    if (type == &PyFloat_Type)
+    {
+        // Compact columns use floats if all values survive the conversion
+        int all_float32 = compact;
+
+        for (size_t i = 0; i < nrows; ++i)
+        {
+            if (Py_TYPE(values[i]) != &PyFloat_Type)
+                return 0;
+
+            all_float32 = all_float32 && is_float32(PyFloat_AS_DOUBLE(values[i]));
+        }
+
+        return all_float32 ? 'f' : 'd';
+    }
+
+    if (type != &PyLong_Type)
+        return 0;
+
+    long long min = 0, max = 0;
+
+    for (size_t i = 0; i < nrows; ++i)
+    {
+        if (Py_TYPE(values[i]) != &PyLong_Type)
+            return 0;
+
+        int overflow;
+        const long long num = PyLong_AsLongLongAndOverflow(values[i], &overflow);
+
+        if (overflow != 0)
+            return 0;
+
+        if (num < min) min = num;
+        if (num > max) max = num;
+    }
+
+    return packed_int_format(min, max);
+}
+
+// Encode the values of a column, either packed or as a regular list
+static int encode_column(encode_t *b, PyObject **values, const size_t nrows)
+{
+    const char format = column_format(values, nrows, b->compact);
+
+    if (format == 0)
+    {
+        OFFSET_CHECK(MAX_METADATA_SIZE);
+        METADATA_VARLEN_WR(DT_ARRAY, nrows);
+
+        for (size_t i = 0; i < nrows; ++i)
+            if (encode_object(b, values[i]) == 1) return 1;
+
+        return 0;
+    }
+
+    const size_t width = format_width(format);
+    const size_t length = 1 + (nrows * width);
+
+    // Integers are copied 8 bytes at a time, so reserve 8 extra bytes
+    OFFSET_CHECK(1 + MAX_METADATA_SIZE + length + 8);
+    METADATA_EXTENSION_WR(EXT_NMCOL);
+    METADATA_VARLEN_WR(DT_BYTES, length);
+
+    *BUF_POST_INC = format;
+
+    if (format == 'd')
+    {
+        for (size_t i = 0; i < nrows; ++i)
+        {
+            double num = PyFloat_AS_DOUBLE(values[i]);
+            LITTLE_DOUBLE(num);
+
+            memcpy(b->offset, &num, 8);
+            b->offset += 8;
+        }
+    }
+    else if (format == 'f')
+    {
+        for (size_t i = 0; i < nrows; ++i)
+        {
+            const float num = (float)PyFloat_AS_DOUBLE(values[i]);
+
+            uint32_t raw;
+            memcpy(&raw, &num, 4);
+            raw = LITTLE_32(raw);
+
+            memcpy(b->offset, &raw, 4);
+            b->offset += 4;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < nrows; ++i)
+        {
+            // Can't fail as the values were checked when getting the format
+            const uint64_t num = (uint64_t)PyLong_AsLongLong(values[i]);
+            __MEMCPY_WRITE(num, width);
+        }
+    }
+
+    return 0;
+}
+
+/*  Encode a list of dicts with the same keys by column. Written as an extension of a list
+ *  holding the list of keys, followed by the values of each key as a packed column or regular list.
+ */
+static int encode_columns(encode_t *b, PyObject *list)
+{
+    const size_t nrows = (size_t)PyList_GET_SIZE(list);
+    PyObject *first = PyList_GET_ITEM(list, 0);
+    const size_t ncols = (size_t)PyDict_GET_SIZE(first);
+    const size_t nitems = ncols + 1;
+
+    OFFSET_CHECK(1 + (MAX_METADATA_SIZE * 2));
+    METADATA_EXTENSION_WR(EXT_COLMN);
+    METADATA_VARLEN_WR(DT_ARRAY, nitems);
+    METADATA_VARLEN_WR(DT_ARRAY, ncols);
+
+    Py_ssize_t pos = 0;
+    PyObject *key, *val;
+
+    while (PyDict_Next(first, &pos, &key, &val))
+        if (encode_object(b, key) == 1) return 1;
+
+    // Holds the (borrowed) values of the current column
+    PyObject **values = (PyObject **)malloc(nrows * sizeof(PyObject *));
+
+    if (values == NULL)
+    {
+        PyErr_NoMemory();
+        return 1;
+    }
+
+    pos = 0;
+    while (PyDict_Next(first, &pos, &key, &val))
+    {
+        values[0] = val;
+
+        for (size_t i = 1; i < nrows; ++i)
+        {
+            values[i] = PyDict_GetItemWithError(PyList_GET_ITEM(list, i), key);
+
+            if (values[i] == NULL)
+            {
+                if (!PyErr_Occurred())
+                    PyErr_SetString(PyExc_RuntimeError, "A dict changed while encoding it by column");
+
+                free(values);
+                return 1;
+            }
+        }
+
+        if (encode_column(b, values, nrows) == 1)
+        {
+            free(values);
+            return 1;
+        }
+    }
+
+    free(values);
+    return 0;
+}
+
+/* DECODING */
+
+// Macro for calling and testing the overread check function
+#define OVERREAD_CHECK(length) do { \
+    if (b->bufcheck(b, length) == 1) return NULL; \
+} while (0)
+
+// Metadata reading macros for specific metadata modes
+#define RD_LN0(length) do { \
+    (length) = (byte & 0xFF) >> 4; \
+    BUF_PRE_INC; \
+} while (0)
+#define RD_LN1(length) do { \
+    (length)  = (*BUF_POST_INC & 0xFF) >> 5; \
+    (length) |= (*BUF_POST_INC & 0xFF) << 3; \
+} while (0)
+#define RD_LN2(length) do { \
+    const int num_bytes = ((*BUF_POST_INC & 0b11100000) >> 5) + 1; \
+    RD_METADATA_LM2(b->offset, length, num_bytes); \
+} while (0)
+
+// Mode 0 metadata cases (`0b10000` case for mode 0 where first length bit is set)
+#define MODE0(dt) case (dt): case ((dt) | 0b10000):
+// Mode 1 metadata case
+#define MODE1(dt) case ((dt) | 0b01000):
+// Mode 2 metadata case
+#define MODE2(dt) case ((dt) | 0b11000):
+
+#define TYPE_BYTES(RD_LNx) { \
+    size_t length; \
+    RD_LNx(length); \
+    OVERREAD_CHECK(length); \
+    \
+    PyObject *value; \
+    if (b->bufd != NULL) \
+        value = cbytes_create(b->state, b->bufd, b->offset, length); \
+    else \
+        value = PyBytes_FromStringAndSize(b->offset, (Py_ssize_t)(length)); \
+    \
+    b->offset += length; \
+    return value; \
+}
+
+#define TYPE_STRNG(RD_LNx) { \
+    size_t length; \
+    RD_LNx(length); \
+    OVERREAD_CHECK(length); \
+    PyObject *value; \
+    \
+    if (b->bufd != NULL) \
+        value = cstr_create(b->state, b->bufd, b->offset, length); \
+    else \
+        value = PyUnicode_DecodeUTF8(b->offset, length, "strict"); \
+    \
+    b->offset += length; \
+    return value; \
+}
+
+#define TYPE_ARRAY(RD_LNx) { \
+    size_t nitems; \
+    RD_LNx(nitems); \
+    OVERREAD_CHECK(nitems); \
+    PyObject *list = PyList_New(nitems); \
+    \
+    if (list == NULL) \
+        return PyErr_NoMemory(); \
+    \
+    for (size_t i = 0; i < nitems; ++i) \
+    { \
+        PyObject *item = decode_bytes(b); \
+        if (item == NULL) \
+        { \
+            Py_DECREF(list); \
+            return NULL; \
+        } \
+        PyList_SET_ITEM(list, i, item); \
+    } \
+    return list; \
+}
+
+#define TYPE_DICTN(RD_LNx) { \
+    size_t nitems; \
+    RD_LNx(nitems); \
+    PyObject *dict = PyDict_New(); \
+    \
+    if (dict == NULL) \
+        return PyErr_NoMemory(); \
+    \
+    for (size_t i = 0; i < nitems; ++i) \
+    { \
+        PyObject *key = decode_bytes(b); \
+        if (key == NULL) \
+        { \
+            Py_DECREF(dict); \
+            return NULL; \
+        } \
+        PyObject *val = decode_bytes(b); \
+        if (val == NULL) \
+        { \
+            Py_DECREF(dict); \
+            Py_DECREF(key); \
+            return NULL; \
+        } \
+        PyDict_SetItem(dict, key, val); \
+        Py_DECREF(key); \
+        Py_DECREF(val); \
+    } \
+    return dict; \
+}
+
+#define ANYMODE(dt, TYPE_x) MODE0(dt) TYPE_x(RD_LN0) MODE1(dt) TYPE_x(RD_LN1) MODE2(dt) TYPE_x(RD_LN2) 
+
+// Loop for decoding packed integers of a specific size into the rows of a column
+#define PACKED_INT_LOOP(type, utype, LITTLE_x) do { \
+    for (size_t i = 0; i < nrows; ++i) \
+    { \
+        utype raw; \
+        memcpy(&raw, b->offset, sizeof(utype)); \
+        b->offset += sizeof(utype); \
+        \
+        PyObject *value = PyLong_FromLongLong((long long)(type)LITTLE_x(raw)); \
+        if (value == NULL || set_column_value(rows, i, key, value) == 1) return 1; \
+    } \
+} while (0)
+
+// Set the value of a column in a row, stealing the reference to `value`
+static inline int set_column_value(PyObject *rows, const size_t row, PyObject *key, PyObject *value)
+{
+    const int status = PyDict_SetItem(PyList_GET_ITEM(rows, row), key, value);
+    Py_DECREF(value);
+
+    return status != 0;
+}
+
+// Decode the items of a packed column into the rows, each with its own type-specific loop
+static int decode_packed_column(decode_t *b, PyObject *rows, const size_t nrows, PyObject *key, const char format)
+{
+    switch (format)
+    {
+    case 'b': PACKED_INT_LOOP(int8_t, uint8_t, ); return 0;
+    case 'h': PACKED_INT_LOOP(int16_t, uint16_t, LITTLE_16); return 0;
+    case 'i': PACKED_INT_LOOP(int32_t, uint32_t, LITTLE_32); return 0;
+    case 'q': PACKED_INT_LOOP(int64_t, uint64_t, LITTLE_64); return 0;
+    case 'f':
+    {
+        for (size_t i = 0; i < nrows; ++i)
+        {
+            uint32_t raw;
+            memcpy(&raw, b->offset, 4);
+            raw = LITTLE_32(raw);
+
+            float num;
+            memcpy(&num, &raw, 4);
+
+            b->offset += 4;
+
+            PyObject *value = PyFloat_FromDouble((double)num);
+            if (value == NULL || set_column_value(rows, i, key, value) == 1) return 1;
+        }
+
+        return 0;
+    }
+    default: // 'd'
+    {
+        for (size_t i = 0; i < nrows; ++i)
+        {
+            double num;
+            memcpy(&num, b->offset, 8);
+            LITTLE_DOUBLE(num);
+
+            b->offset += 8;
+
+            PyObject *value = PyFloat_FromDouble(num);
+            if (value == NULL || set_column_value(rows, i, key, value) == 1) return 1;
+        }
+
+        return 0;
+    }
+    }
+}
+
+// Create the list of empty dicts to decode the columns into
+static PyObject *create_rows(const size_t nrows)
+{
+    PyObject *rows = PyList_New(nrows);
+
+    if (rows == NULL)
+        return NULL;
+
+    for (size_t i = 0; i < nrows; ++i)
+    {
+        PyObject *row = PyDict_New();
+
+        if (row == NULL)
+        {
+            Py_DECREF(rows);
+            return NULL;
+        }
+
+        PyList_SET_ITEM(rows, i, row);
+    }
+
+    return rows;
+}
+
+/*  Decode a column into the rows, creating the rows based on the number of items in the first column.
+ *  Columns are either packed or a regular list, and all have to hold the same number of items.
+ */
+static int decode_column(decode_t *b, PyObject **rows, PyObject *key)
+{
+    if (b->bufcheck(b, 1) == 1)
+        return 1;
+
+    const unsigned char byte = b->offset[0] & 0xFF;
+
+    size_t nvalues;
+    char format = 0;
+
+    if (byte == (DT_EXTNS | (EXT_NMCOL << 3)))
+    {
+        BUF_PRE_INC;
+
+        if (b->bufcheck(b, 1) == 1)
+            return 1;
+        if ((b->offset[0] & 0b111) != DT_BYTES || b->bufcheck(b, METADATA_VARLEN_SIZE(b->offset[0] & 0xFF)) == 1)
+            goto invalid;
+
+        size_t length;
+        METADATA_VARLEN_RD(length);
+
+        if (length == 0 || b->bufcheck(b, length) == 1)
+            goto invalid;
+
+        format = *BUF_POST_INC;
+        const size_t width = format_width(format);
+
+        // Columns only hold signed integers, floats and doubles
+        if (width == 0 || strchr("bhiqfd", format) == NULL || (length - 1) % width != 0)
+            goto invalid;
+
+        nvalues = (length - 1) / width;
+    }
+    else if ((byte & 0b111) == DT_ARRAY)
+    {
+        if (b->bufcheck(b, METADATA_VARLEN_SIZE(byte)) == 1)
+            return 1;
+
+        METADATA_VARLEN_RD(nvalues);
+
+        // Every value takes at least a byte
+        if (b->bufcheck(b, nvalues) == 1)
+            return 1;
+    }
+    else
+    {
+        goto invalid;
+    }
+
+    if (*rows == NULL)
+    {
+        if ((*rows = create_rows(nvalues)) == NULL)
+            return 1;
+    }
+    else if ((size_t)PyList_GET_SIZE(*rows) != nvalues)
+    {
+        goto invalid;
+    }
+
+    if (format != 0)
+        return decode_packed_column(b, *rows, nvalues, key, format);
+
+    for (size_t i = 0; i < nvalues; ++i)
+    {
+        PyObject *value = decode_bytes(b);
+        if (value == NULL || set_column_value(*rows, i, key, value) == 1) return 1;
+    }
+
+    return 0;
+
+    invalid:
+    if (!PyErr_Occurred())
+        PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+
+    return 1;
+}
+
+// Decode the list of keys and the columns of a list of dicts that was encoded by column
+static PyObject *decode_column_lists(decode_t *b, const size_t nitems)
+{
+    PyObject *keys = decode_bytes(b);
+
+    if (keys == NULL)
+        return NULL;
+
+    if (!PyList_CheckExact(keys) || PyList_GET_SIZE(keys) == 0 || (size_t)PyList_GET_SIZE(keys) != nitems - 1)
+    {
+        PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+        Py_DECREF(keys);
+        return NULL;
+    }
+
+    // The columns are at the same depth as the list of keys
+    if (enter_depth(&b->max_depth, 1, b->state->decoding_error) == 1)
+    {
+        Py_DECREF(keys);
+        return NULL;
+    }
+
+    PyObject *rows = NULL;
+    int status = 0;
+
+    for (size_t i = 0; i < nitems - 1 && status == 0; ++i)
+        status = decode_column(b, &rows, PyList_GET_ITEM(keys, i));
+
+    ++b->max_depth;
+    Py_DECREF(keys);
+
+    if (status == 1)
+    {
+        Py_XDECREF(rows);
+        return NULL;
+    }
+
+    return rows;
+}
+
+// Decode a list of dicts that was encoded by column. The list holds the keys, followed by a column per key
+static PyObject *decode_columns(decode_t *b, const size_t nitems)
+{
+    // The keys and columns are nested in the list holding them
+    if (enter_depth(&b->max_depth, 1, b->state->decoding_error) == 1)
+        return NULL;
+
+    // The values of columns are decoded by recursing, so limit the recursion in case those are columnar as well
+    if (Py_EnterRecursiveCall(" while decoding by column") != 0)
+    {
+        ++b->max_depth;
+        return NULL;
+    }
+
+    PyObject *rows = decode_column_lists(b, nitems);
+
+    Py_LeaveRecursiveCall();
+    ++b->max_depth;
+
+    return rows;
+}
+
+// Get a reference to a value in the key table or the reference table, raising `undefined` if it isn't defined yet
+static PyObject *decode_reference(decode_t *b, PyObject *table, const char *undefined)
+{
+    size_t nbytes;
+    METADATA_INTEGER_RD(nbytes);
+
+    if (nbytes > 8)
+    {
+        PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+        return NULL;
+    }
+
+    OVERREAD_CHECK(nbytes);
+
+    uint64_t idx = 0;
+    memcpy(&idx, b->offset, nbytes);
+    idx = LITTLE_64(idx);
+
+    b->offset += nbytes;
+
+    if (table == NULL || idx >= (uint64_t)PyList_GET_SIZE(table))
+    {
+        PyErr_SetString(b->state->decoding_error, undefined);
+        return NULL;
+    }
+
+    PyObject *value = PyList_GET_ITEM(table, idx);
+    Py_INCREF(value);
+
+    return value;
+}
+
+// Decode a key and add it to the key table as an interned string
+static PyObject *decode_key_definition(decode_t *b, const size_t length)
+{
+    OVERREAD_CHECK(length);
+
+    PyObject *key = PyUnicode_DecodeUTF8(b->offset, (Py_ssize_t)length, "strict");
+
+    if (key == NULL)
+        return NULL;
+
+    b->offset += length;
+    PyUnicode_InternInPlace(&key);
+
+    if (b->keys == NULL)
+    {
+        b->keys = PyList_New(0);
+
+        if (b->keys == NULL)
+        {
+            Py_DECREF(key);
+            return NULL;
+        }
+    }
+
+    if (PyList_Append(b->keys, key) != 0)
+    {
+        Py_DECREF(key);
+        return NULL;
+    }
+
+    return key;
+}
+
+/*  Decode a typed array to an `array.array`, or to a read-only memoryview of the items if referencing the buffer.
+ *  The memoryview can't reference the data on big-endian systems, as it has to be converted to native byte order.
+ */
+static PyObject *decode_typed_array(decode_t *b, const size_t length)
+{
+    OVERREAD_CHECK(length);
+
+    const char format = length == 0 ? 0 : b->offset[0];
+    const size_t width = format_width(format);
+
+    if (width == 0 || (length - 1) % width != 0)
+    {
+        PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+        return NULL;
+    }
+
+    const char typecode[2] = {format, 0};
+    char *data = b->offset + 1;
+    const size_t nbytes = length - 1;
+
+    b->offset += length;
+
+    if (b->bufd != NULL && IS_LITTLE_ENDIAN == 1)
+    {
+        PyObject *ref = cbytes_create(b->state, b->bufd, data, (Py_ssize_t)nbytes);
+
+        if (ref == NULL)
+            return NULL;
+
+        PyObject *view = PyMemoryView_FromObject(ref);
+        Py_DECREF(ref);
+
+        if (view == NULL)
+            return NULL;
+
+        PyObject *cast = PyObject_CallMethod(view, "cast", "s", typecode);
+        Py_DECREF(view);
+
+        return cast;
+    }
+
+    PyObject *array = PyObject_CallFunction((PyObject *)b->state->array_type, "s", typecode);
+
+    if (array == NULL)
+        return NULL;
+
+    // Copy the items over directly from the buffer
+    PyObject *items = PyMemoryView_FromMemory(data, (Py_ssize_t)nbytes, PyBUF_READ);
+
+    if (items == NULL)
+    {
+        Py_DECREF(array);
+        return NULL;
+    }
+
+    PyObject *result = PyObject_CallMethod(array, "frombytes", "O", items);
+    Py_DECREF(items);
+
+    if (result == NULL)
+    {
+        Py_DECREF(array);
+        return NULL;
+    }
+
+    Py_DECREF(result);
+
+    #if (IS_LITTLE_ENDIAN == 0)
+
+        Py_buffer view;
+        if (PyObject_GetBuffer(array, &view, PyBUF_WRITABLE) != 0)
+        {
+            Py_DECREF(array);
+            return NULL;
+        }
+
+        swap_items((char *)view.buf, nbytes / width, width);
+        PyBuffer_Release(&view);
+
+    #endif
+
+    return array;
+}
+
+// Decode a list of integers from zigzag varints
+static PyObject *decode_varint_list(decode_t *b, const size_t length)
+{
+    OVERREAD_CHECK(length);
+
+    const unsigned char *data = (const unsigned char *)b->offset;
+
+    // Every varint ends with a byte without the high bit set
+    size_t nitems = 0;
+    for (size_t i = 0; i < length; ++i)
+        nitems += data[i] < 0x80;
+
+    if (length != 0 && data[length - 1] >= 0x80)
+    {
+        PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+        return NULL;
+    }
+
+    PyObject *list = PyList_New(nitems);
+
+    if (list == NULL)
+        return NULL;
+
+    for (size_t i = 0; i < nitems; ++i)
+    {
+        uint64_t num = 0;
+        unsigned int shift = 0;
+        unsigned char byte;
+
+        do
+        {
+            if (shift > 63)
+            {
+                PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+                Py_DECREF(list);
+                return NULL;
+            }
+
+            byte = *data++;
+            num |= (uint64_t)(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte >= 0x80);
+
+        PyObject *item = PyLong_FromLongLong((long long)UNZIGZAG(num));
+
+        if (item == NULL)
+        {
+            Py_DECREF(list);
+            return NULL;
+        }
+
+        PyList_SET_ITEM(list, i, item);
+    }
+
+    b->offset += length;
+    return list;
+}
+
+/*  Decode an extension type. The extension byte is followed by the metadata of the value it extends.
+ *  Tuples, sets and frozensets are containers, which are decoded by `decode_bytes` instead.
+ */
+static PyObject *decode_extension(decode_t *b)
+{
+    unsigned int ext;
+    METADATA_EXTENSION_RD(ext);
+
+    OVERREAD_CHECK(1);
+
+    const unsigned char tpmask = b->offset[0] & 0b111;
+
+    if (ext > EXT_LIMIT || tpmask != ext_tpmasks[ext])
+    {
+        PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+        return NULL;
+    }
+
+    // References are followed by integer metadata instead of varlen metadata
+    if (ext == EXT_KEYRF)
+        return decode_reference(b, b->keys, "Received a reference to an undefined key");
+    if (ext == EXT_REFRF)
+        return decode_reference(b, b->refs, "Received a reference to an undefined value");
+
+    OVERREAD_CHECK(METADATA_VARLEN_SIZE(b->offset[0] & 0xFF));
+
+    size_t length;
+    METADATA_VARLEN_RD(length);
+
+    switch (ext)
+    {
+    case EXT_KEYDF:
+    {
+        return decode_key_definition(b, length);
+    }
+    case EXT_COLMN:
+    {
+        return decode_columns(b, length);
+    }
+    case EXT_NMCOL:
+    case EXT_REFDF:
+    case EXT_SIZED:
+    {
+        // Packed columns only exist within columnar data, and definitions and sizes are read by `decode_bytes` before the container they precede
+        PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+        return NULL;
+    }
+    case EXT_TARRY:
+    {
+        return decode_typed_array(b, length);
+    }
+    case EXT_ZZINT:
     {
-        DT_CHECK(PyList_Type);
-
-        const size_t nitems = (size_t)PyList_GET_SIZE(item);
-
-        OFFSET_CHECK(MAX_METADATA_SIZE);
-        METADATA_VARLEN_WR(DT_ARRAY, nitems);
-
-        for (size_t i = 0; i < nitems; ++i)
-            if (encode_object(b, PyList_GET_ITEM(item, i)) == 1) return 1;
-        
-        return 0;
+        return decode_varint_list(b, length);
     }
-    case 'd': // Dict
+    case EXT_BIGNT:
     {
-        DT_CHECK(PyDict_Type);
-
-        const size_t nitems = PyDict_GET_SIZE(item);
+        OVERREAD_CHECK(length);
 
-        OFFSET_CHECK(MAX_METADATA_SIZE);
-        METADATA_VARLEN_WR(DT_DICTN, nitems);
+        #if (PY_VERSION_HEX >= 0x030D0000)
 
-        Py_ssize_t pos = 0;
-        PyObject *key, *val;
-        
-        while (PyDict_Next(item, &pos, &key, &val))
-            if (encode_object(b, key) == 1 || encode_object(b, val) == 1) return 1;
-        
-        return 0;
-    }
-    }
+            PyObject *value = PyLong_FromNativeBytes(b->offset, length, Py_ASNATIVEBYTES_LITTLE_ENDIAN);
 
-    // Check for custom types
-    return encode_custom(b, item);
-}
+        #else
 
-/* DECODING */
+            PyObject *value = _PyLong_FromByteArray((const unsigned char *)(b->offset), length, 1, 1);
 
-// Macro for calling and testing the overread check function
-#define OVERREAD_CHECK(length) do { \
-    if (b->bufcheck(b, length) == 1) return NULL; \
-} while (0)
+        #endif
 
-// Metadata reading macros for specific metadata modes
-#define RD_LN0(length) do { \
-    (length) = (byte & 0xFF) >> 4; \
-    BUF_PRE_INC; \
-} while (0)
-#define RD_LN1(length) do { \
-    (length)  = (*BUF_POST_INC & 0xFF) >> 5; \
-    (length) |= (*BUF_POST_INC & 0xFF) << 3; \
-} while (0)
-#define RD_LN2(length) do { \
-    const int num_bytes = ((*BUF_POST_INC & 0b11100000) >> 5) + 1; \
-    RD_METADATA_LM2(b->offset, length, num_bytes); \
-} while (0)
+        b->offset += length;
+        return value;
+    }
+    default: // Bytearrays and memoryviews
+    {
+        OVERREAD_CHECK(length);
 
-// Mode 0 metadata cases (`0b10000` case for mode 0 where first length bit is set)
-#define MODE0(dt) case (dt): case ((dt) | 0b10000):
-// Mode 1 metadata case
-#define MODE1(dt) case ((dt) | 0b01000):
-// Mode 2 metadata case
-#define MODE2(dt) case ((dt) | 0b11000):
+        PyObject *value = ext == EXT_BARRY ?
+            PyByteArray_FromStringAndSize(b->offset, (Py_ssize_t)length) :
+            PyBytes_FromStringAndSize(b->offset, (Py_ssize_t)length);
 
-#define TYPE_BYTES(RD_LNx) { \
-    size_t length; \
-    RD_LNx(length); \
-    OVERREAD_CHECK(length); \
-    \
-    PyObject *value; \
-    if (b->bufd != NULL) \
-        value = cbytes_create(b->bufd, b->offset, length); \
-    else \
-        value = PyBytes_FromStringAndSize(b->offset, (Py_ssize_t)(length)); \
-    \
-    b->offset += length; \
-    return value; \
-}
+        b->offset += length;
 
-#define TYPE_STRNG(RD_LNx) { \
-    size_t length; \
-    RD_LNx(length); \
-    OVERREAD_CHECK(length); \
-    PyObject *value; \
-    \
-    if (b->bufd != NULL) \
-        value = cstr_create(b->bufd, b->offset, length); \
-    else \
-        value = PyUnicode_DecodeUTF8(b->offset, length, "strict"); \
-    \
-    b->offset += length; \
-    return value; \
-}
+        if (value == NULL || ext == EXT_BARRY)
+            return value;
 
-#define TYPE_ARRAY(RD_LNx) { \
-    size_t nitems; \
-    RD_LNx(nitems); \
-    OVERREAD_CHECK(nitems); \
-    PyObject *list = PyList_New(nitems); \
-    \
-    if (list == NULL) \
-        return PyErr_NoMemory(); \
-    \
-    for (size_t i = 0; i < nitems; ++i) \
-    { \
-        PyObject *item = decode_bytes(b); \
-        if (item == NULL) \
-        { \
-            Py_DECREF(list); \
-            return NULL; \
-        } \
-        PyList_SET_ITEM(list, i, item); \
-    } \
-    return list; \
-}
+        // Memoryviews keep the bytes object alive themselves
+        PyObject *view = PyMemoryView_FromObject(value);
+        Py_DECREF(value);
 
-#define TYPE_DICTN(RD_LNx) { \
-    size_t nitems; \
-    RD_LNx(nitems); \
-    PyObject *dict = PyDict_New(); \
-    \
-    if (dict == NULL) \
-        return PyErr_NoMemory(); \
-    \
-    for (size_t i = 0; i < nitems; ++i) \
-    { \
-        PyObject *key = decode_bytes(b); \
-        if (key == NULL) \
-        { \
-            Py_DECREF(dict); \
-            return NULL; \
-        } \
-        PyObject *val = decode_bytes(b); \
-        if (val == NULL) \
-        { \
-            Py_DECREF(dict); \
-            Py_DECREF(key); \
-            return NULL; \
-        } \
-        PyDict_SetItem(dict, key, val); \
-        Py_DECREF(key); \
-        Py_DECREF(val); \
-    } \
-    return dict; \
+        return view;
+    }
+    }
 }
 
-#define ANYMODE(dt, TYPE_x) MODE0(dt) TYPE_x(RD_LN0) MODE1(dt) TYPE_x(RD_LN1) MODE2(dt) TYPE_x(RD_LN2) 
-
-PyObject *decode_bytes(decode_t *b)
+// Decode a value that isn't a list, dict, tuple, set or frozenset
+static PyObject *decode_single(decode_t *b)
 {
     const char byte = *b->offset;
     switch (byte & 0b11111)
@@ -288,6 +2049,23 @@ PyObject *decode_bytes(decode_t *b)
     {
         BUF_PRE_INC;
 
+        // Floats are stored as 4 bytes if the upper bits are set
+        if (byte == (char)DT_FLT32)
+        {
+            OVERREAD_CHECK(4);
+
+            uint32_t raw;
+            memcpy(&raw, b->offset, 4);
+            raw = LITTLE_32(raw);
+
+            float num;
+            memcpy(&num, &raw, 4);
+
+            b->offset += 4;
+
+            return PyFloat_FromDouble((double)num);
+        }
+
         OVERREAD_CHECK(8);
 
         double num;
@@ -324,11 +2102,19 @@ PyObject *decode_bytes(decode_t *b)
         METADATA_INTEGER_RD(nbytes);
         OVERREAD_CHECK(nbytes);
 
-        /* Use the efficient memcpy to get the integer value */
-        //int64_t num;
-        //__MEMCPY_READ(num, nbytes);
+        // Integers of up to 8 bytes are read into a machine word, which lets small values come from the small int cache
+        if (nbytes - 1 < 8)
+        {
+            uint64_t raw = 0;
+            memcpy(&raw, b->offset, nbytes);
+            raw = LITTLE_64(raw);
+
+            b->offset += nbytes;
 
-        //num = LITTLE_64(num);
+            // Sign-extend from the highest used byte
+            const unsigned int shift = 64 - (nbytes << 3);
+            return PyLong_FromLongLong((long long)((int64_t)(raw << shift) >> shift));
+        }
 
         #if (PY_VERSION_HEX >= 0x030D0000)
 
@@ -345,13 +2131,18 @@ PyObject *decode_bytes(decode_t *b)
         return value;
     }
 
+    CASES_AS_5BIT(DT_EXTNS)
+    {
+        return decode_extension(b);
+    }
+
     VARLEN_READ_CASES(DT_BYTES,
     {
         OVERREAD_CHECK(length);
         
         PyObject *value;
         if (b->bufd != NULL)
-            value = cbytes_create(b->bufd, b->offset, length);
+            value = cbytes_create(b->state, b->bufd, b->offset, length);
         else
             value = PyBytes_FromStringAndSize(b->offset, (Py_ssize_t)(length));
         
@@ -365,73 +2156,300 @@ PyObject *decode_bytes(decode_t *b)
 
         PyObject *value;
         if (b->bufd != NULL)
-            value = cstr_create(b->bufd, b->offset, length);
+            value = cstr_create(b->state, b->bufd, b->offset, length);
         else
             value = PyUnicode_DecodeUTF8(b->offset, length, "strict");
         
         b->offset += length;
         return value;
     })
+    }
+
+    // Try as a custom type
+    return decode_custom(b);
+}
 
-    VARLEN_READ_CASES(DT_ARRAY,
+/*  Frame of a container of which the items are being decoded. Containers get a frame on an explicit
+ *  stack instead of being decoded recursively, so that deeply nested data can't overflow the C stack.
+ */
+typedef struct {
+    PyObject *cont; // The container being filled (owned)
+    PyObject *key;  // The key of a dict of which the value is decoded next (owned), NULL otherwise
+    size_t pos;     // Number of items (pairs for dicts) added so far
+    size_t n;       // Number of items (pairs for dicts) of the container
+    size_t end;     // Position at which the container ends if it's sized, SIZE_MAX otherwise
+    int code;       // Type code of the container
+} dec_frame_t;
+
+// Position in the data being decoded, which stays the same when the buffer is refreshed
+#define DEC_POSITION() (b->dropped + (size_t)(b->offset - b->base))
+
+// Whether a sized container that's complete ends where its size says it does
+#define SIZED_END_CHECK(end) ((end) == SIZE_MAX || DEC_POSITION() == (end))
+
+// Whether a metadata byte starts a list, dict, tuple, set or frozenset
+#define IS_CONTAINER(byte) ( \
+    ((byte) & 0b110) == 0 || \
+    (((byte) & 0b111) == DT_EXTNS && ((byte) >> 3) <= EXT_FROZN) \
+)
+
+// Read the metadata of a container and set up its frame. Returns the new, empty container
+static PyObject *create_container(decode_t *b, dec_frame_t *frame)
+{
+    const unsigned char byte = b->offset[0] & 0xFF;
+    int code = (byte & 0b111) == DT_ARRAY ? TP_ARRAY : TP_DICTN;
+
+    if ((byte & 0b111) == DT_EXTNS)
     {
-        OVERREAD_CHECK(0);
-        
-        PyObject *list = PyList_New(length);
-    
-        if (list == NULL)
-            return PyErr_NoMemory();
-    
-        for (size_t i = 0; i < length; ++i)
-        {
-            PyObject *item = decode_bytes(b);
-            if (item == NULL)
+        unsigned int ext;
+        METADATA_EXTENSION_RD(ext);
+
+        OVERREAD_CHECK(1);
+
+        if ((b->offset[0] & 0b111) != DT_ARRAY)
+        {
+            PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+            return NULL;
+        }
+
+        code = ext == EXT_TUPLE ? TP_TUPLE : (ext == EXT_SETTP ? TP_SETTP : TP_FROZN);
+    }
+
+    OVERREAD_CHECK(METADATA_VARLEN_SIZE(b->offset[0] & 0xFF));
+
+    size_t length;
+    METADATA_VARLEN_RD(length);
+
+    // Every item takes at least a byte, so this also stops corrupted lengths from being allocated
+    OVERREAD_CHECK(length);
+
+    PyObject *cont;
+    switch (code)
+    {
+    case TP_ARRAY: cont = PyList_New(length); break;
+    case TP_DICTN: cont = PyDict_New(); break;
+    case TP_TUPLE: cont = PyTuple_New(length); break;
+    case TP_SETTP: cont = PySet_New(NULL); break;
+    default:       cont = PyFrozenSet_New(NULL); break;
+    }
+
+    frame->cont = cont;
+    frame->key = NULL;
+    frame->pos = 0;
+    frame->n = length;
+    frame->code = code;
+
+    return cont;
+}
+
+// Metadata byte of a definition in the reference table
+#define REFDF_BYTE (unsigned char)(DT_EXTNS | (EXT_REFDF << 3))
+
+// Add a value to the reference table, so that references decoded later on resolve to it
+static int define_reference(decode_t *b, PyObject *value)
+{
+    if (b->refs == NULL && (b->refs = PyList_New(0)) == NULL)
+        return 1;
+
+    return PyList_Append(b->refs, value) != 0;
+}
+
+PyObject *decode_bytes(decode_t *b)
+{
+    dec_frame_t local[FRAMES_INITIAL];
+    dec_frame_t *frames = local;
+    size_t capacity = FRAMES_INITIAL;
+    size_t nframes = 0;
+
+    for (;;)
+    {
+        PyObject *value;
+        int define = 0;
+        size_t end = SIZE_MAX;
+
+        // Every value starts with a metadata byte, of which the rest of the metadata is checked once it's known how long it is
+        if (b->offset >= b->max_offset && b->bufcheck(b, 1) == 1)
+            goto error;
+
+        /*  Definitions in the reference table precede the value they define. Containers are defined as soon as
+         *  they're created, so that references to them from within (cycles) resolve to the same object.
+         */
+        if ((b->offset[0] & 0xFF) == REFDF_BYTE)
+        {
+            ++(b->offset);
+
+            if (b->bufcheck(b, 1) == 1)
+                goto error;
+
+            define = 1;
+        }
+
+        // The size of sized lists and dicts is used for skipping over them, and checked once they're decoded
+        if ((b->offset[0] & 0xFF) == SIZED_BYTE)
+        {
+            if (b->bufcheck(b, SIZED_PREFIX_SIZE + 1) == 1)
+                goto error;
+
+            uint32_t size;
+            memcpy(&size, b->offset + 1, SIZED_PREFIX_SIZE - 1);
+            size = LITTLE_32(size);
+
+            b->offset += SIZED_PREFIX_SIZE;
+
+            if (size != SIZED_UNKNOWN)
+                end = DEC_POSITION() + size;
+
+            if ((b->offset[0] & 0b110) != 0)
             {
-                Py_DECREF(list);
-                return NULL;
+                PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+                goto error;
             }
-            PyList_SET_ITEM(list, i, item);
         }
-        return list;
-    })
 
-    VARLEN_READ_CASES(DT_DICTN, {
-        OVERREAD_CHECK(0);
+        const unsigned char byte = b->offset[0] & 0xFF;
 
-        PyObject *dict = PyDict_New();
-    
-        if (dict == NULL)
-            return PyErr_NoMemory();
-    
-        for (size_t i = 0; i < length; ++i)
+        if (IS_CONTAINER(byte))
         {
-            PyObject *key = decode_bytes(b);
-            if (key == NULL)
+            // Tuples, sets and frozensets can't be defined, as a reference to an incomplete one could end up being hashed
+            if (define == 1 && (byte & 0b111) == DT_EXTNS)
             {
-                Py_DECREF(dict);
-                return NULL;
+                PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+                goto error;
             }
 
-            PyObject *val = decode_bytes(b);
-            if (val == NULL)
+            if (nframes == capacity)
             {
-                Py_DECREF(dict);
-                Py_DECREF(key);
-                return NULL;
+                dec_frame_t *grown = (dec_frame_t *)frames_grow(frames, local, &capacity, sizeof(dec_frame_t));
+
+                if (grown == NULL)
+                {
+                    PyErr_NoMemory();
+                    goto error;
+                }
+
+                frames = grown;
             }
 
-            PyDict_SetItem(dict, key, val);
+            if (enter_depth(&b->max_depth, 1, b->state->decoding_error) == 1)
+                goto error;
 
-            Py_DECREF(key);
-            Py_DECREF(val);
+            if ((value = create_container(b, &frames[nframes])) == NULL)
+            {
+                ++b->max_depth;
+                goto error;
+            }
+
+            frames[nframes].end = end;
+
+            if (define == 1 && define_reference(b, value) == 1)
+            {
+                Py_DECREF(value);
+                ++b->max_depth;
+                goto error;
+            }
+
+            if (frames[nframes].n != 0)
+            {
+                ++nframes;
+                continue;
+            }
+
+            ++b->max_depth;
+
+            if (!SIZED_END_CHECK(end))
+            {
+                Py_DECREF(value);
+                PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+                goto error;
+            }
+        }
+        else
+        {
+            if ((value = decode_single(b)) == NULL)
+                goto error;
+
+            if (define == 1 && define_reference(b, value) == 1)
+            {
+                Py_DECREF(value);
+                goto error;
+            }
+        }
+
+        // Add the value to its container, leaving the containers that are complete
+        for (;;)
+        {
+            if (nframes == 0)
+            {
+                FRAMES_FREE(frames, local);
+                return value;
+            }
+
+            dec_frame_t *frame = &frames[nframes - 1];
+
+            if (frame->code == TP_ARRAY)
+            {
+                PyList_SET_ITEM(frame->cont, frame->pos, value);
+            }
+            else if (frame->code == TP_DICTN)
+            {
+                // Dicts alternate between decoding a key and its value
+                if (frame->key == NULL)
+                {
+                    frame->key = value;
+                    break;
+                }
+
+                const int status = PyDict_SetItem(frame->cont, frame->key, value);
+
+                Py_DECREF(frame->key);
+                Py_DECREF(value);
+                frame->key = NULL;
+
+                if (status != 0)
+                    goto error;
+            }
+            else if (frame->code == TP_TUPLE)
+            {
+                PyTuple_SET_ITEM(frame->cont, frame->pos, value);
+            }
+            else
+            {
+                // Also works for frozensets that aren't exposed yet
+                const int status = PySet_Add(frame->cont, value);
+                Py_DECREF(value);
+
+                if (status != 0)
+                    goto error;
+            }
+
+            if (++frame->pos < frame->n)
+                break;
+
+            // The container is still on the stack, so it's released along with the others if it doesn't end at its size
+            if (!SIZED_END_CHECK(frame->end))
+            {
+                PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+                goto error;
+            }
+
+            value = frame->cont;
+
+            --nframes;
+            ++b->max_depth;
         }
-        
-        return dict;
-    })
     }
 
-    // Try as a custom type
-    return decode_custom(b);
+    error:
+    for (size_t i = 0; i < nframes; ++i)
+    {
+        Py_DECREF(frames[i].cont);
+        Py_XDECREF(frames[i].key);
+    }
+
+    b->max_depth += nframes;
+    FRAMES_FREE(frames, local);
+
+    return NULL;
 }
 
 #define TYPE_DICTN(RD_LNx) { \
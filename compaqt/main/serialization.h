@@ -4,7 +4,10 @@
 #include <Python.h>
 #include "globals/typedefs.h"
 
+int setup_dispatch(module_state_t *state);
+
 int encode_object(encode_t *b, PyObject *item);
+int encode_key(encode_t *b, PyObject *key);
 PyObject *decode_bytes(decode_t *b);
 
 #endif // SERIALIZATION_H
\ No newline at end of file
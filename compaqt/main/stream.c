@@ -3,11 +3,16 @@
 #include <Python.h>
 
 #include "main/serialization.h"
+#include "main/compression.h"
+#include "main/checksum.h"
 
 #include "globals/exceptions.h"
 #include "globals/typemasks.h"
 #include "globals/buftricks.h"
 #include "globals/typedefs.h"
+#include "globals/framestack.h"
+#include "globals/atomics.h"
+#include "globals/modstate.h"
 
 #include "types/usertypes.h"
 
@@ -17,22 +22,124 @@
 typedef struct {
     PyObject_HEAD
     stream_encode_t b;
+    PyObject *module; // The module that created the encoder, which keeps the module state of `b` alive
+    int busy; // Whether a write is in progress, which may release the GIL while using the buffer
 } stream_encode_ob;
 
 typedef struct {
     PyObject_HEAD
     stream_decode_t b;
+    PyObject *module; // The module that created the decoder, which keeps the module state of `b` alive
+    int busy; // Whether a read is in progress, which may release the GIL while using the buffer
 } stream_decode_ob;
 
+// Set the error matching a FILE_* result of a stream file operation
+static void set_file_error(const module_state_t *state, const int status, const char *filename, const size_t offset)
+{
+    switch (status)
+    {
+    case FILE_OPEN_FAILED:
+        PyErr_Format(PyExc_FileNotFoundError, "Failed to create/open file '%s'", filename);
+        break;
+    case FILE_SEEK_FAILED:
+        PyErr_Format(state->file_offset_error, "Unable to set the file offset to %zu", offset);
+        break;
+    case FILE_READ_FAILED:
+        PyErr_Format(state->file_offset_error, "Failed to read the file from offset %zu", offset);
+        break;
+    case FILE_WRITE_FAILED:
+        PyErr_Format(PyExc_OSError, "Failed to write to file '%s'", filename);
+        break;
+    case FILE_CORRUPTED:
+        PyErr_Format(state->decoding_error, "Received an invalid or corrupted block at offset %zu", offset);
+        break;
+    default:
+        PyErr_NoMemory();
+        break;
+    }
+}
+
+/*  Read the 9-byte metadata of the stream container at `offset` in a file into `buf`, followed by the first byte of its data,
+ *  which is set to zero if there's no data. This doesn't use the Python API, so it can run without holding the GIL.
+ *
+ *  Returns 0 on success, or one of the FILE_* results otherwise.
+ */
+static int read_stream_metadata(const char *filename, const size_t offset, char *buf)
+{
+    FILE *file = fopen(filename, "rb");
+
+    if (file == NULL)
+        return FILE_OPEN_FAILED;
+
+    int status = 0;
+    size_t nread;
+
+    if (fseek(file, offset, SEEK_SET) != 0)
+        status = FILE_SEEK_FAILED;
+    else if ((nread = fread(buf, 1, 10, file)) < 9)
+        status = FILE_READ_FAILED;
+    else if (nread == 9)
+        buf[9] = 0;
+
+    fclose(file);
+    return status;
+}
+
+// Make sure the scratch buffer holds at least `length` bytes. Returns 1 if out of memory, without setting an error
+static inline int reserve_scratch(char **scratch, size_t *scratch_size, const size_t length)
+{
+    if (*scratch_size >= length)
+        return 0;
+
+    // Don't use realloc as we don't need to preserve data
+    free(*scratch);
+    *scratch = (char *)malloc(length);
+    *scratch_size = *scratch == NULL ? 0 : length;
+
+    return *scratch == NULL;
+}
+
 /* ENCODING */
 
-// Function to write the chunk to the file and start a new chunk
-static inline int flush_chunk(stream_encode_t *b)
+/*  Write the chunk to the file, as a compressed and/or checksummed block if enabled, and start a new chunk.
+ *  This doesn't use the Python API, so it can run without holding the GIL.
+ *
+ *  Returns 0 on success, or one of the FILE_* results otherwise.
+ */
+static int write_chunk(stream_encode_t *b)
 {
-    // Write the current buffer
-    fwrite(b->base, BUF_GET_OFFSET, 1, b->file);
+    const size_t length = BUF_GET_OFFSET;
 
-    b->curr_offset += BUF_GET_OFFSET;
+    if (length == 0)
+        return 0;
+
+    const char *data = b->base;
+    size_t size = length;
+
+    if (b->block_flags & BLOCK_COMPRESS)
+    {
+        if (reserve_scratch(&b->scratch, &b->scratch_size, compress_bound(length, 1)) == 1)
+            return FILE_NO_MEMORY;
+
+        size = write_block(b->base, length, b->scratch, b->block_flags);
+        data = b->scratch;
+    }
+    else if (b->block_flags & BLOCK_CHECKSUM)
+    {
+        // Blocks that are only checksummed store the chunk as is, so only the frame header has to be written in front of it
+        char header[CHECKED_FRAME_HEADER_SIZE];
+        write_frame_header(header, length, b->base, length, b->block_flags);
+
+        if (fwrite(header, 1, CHECKED_FRAME_HEADER_SIZE, b->file) != CHECKED_FRAME_HEADER_SIZE)
+            return FILE_WRITE_FAILED;
+
+        b->curr_offset += CHECKED_FRAME_HEADER_SIZE;
+    }
+
+    if (fwrite(data, 1, size, b->file) != size)
+        return FILE_WRITE_FAILED;
+
+    b->curr_offset += size;
     
     // Start the chunk offset at the base again
     b->offset = b->base;
@@ -40,10 +147,54 @@ static inline int flush_chunk(stream_encode_t *b)
     return 0;
 }
 
+// Function to write the chunk to the file and start a new chunk
+static inline int flush_chunk(stream_encode_t *b)
+{
+    const int status = write_chunk(b);
+
+    if (status != 0)
+    {
+        set_file_error(b->state, status, b->filename, b->curr_offset);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Grow the chunk to fit `length` more bytes, as blocks hold whole items
+static int grow_chunk(stream_encode_t *b, const size_t length)
+{
+    const size_t used = BUF_GET_OFFSET;
+
+    if (used + length > MAX_BLOCK_SIZE)
+    {
+        PyErr_SetString(b->state->encoding_error, "Items of compressed or checksummed streams cannot be larger than 4 GiB");
+        return 1;
+    }
+
+    const size_t new_length = (used + length) << 1;
+    char *tmp = (char *)realloc(b->base, new_length);
+
+    if (tmp == NULL)
+    {
+        PyErr_NoMemory();
+        return 1;
+    }
+
+    b->base = tmp;
+    b->offset = tmp + used;
+    b->max_offset = tmp + new_length;
+
+    return 0;
+}
+
 static inline int flush_check(stream_encode_t *b, const size_t length)
 {
     if (b->offset + length >= b->max_offset)
     {
+        if (b->block_flags != 0)
+            return grow_chunk(b, length);
+
         /* Check whether the length doesn't exceed the chunk limit on its own */
         if (length > BUF_GET_LENGTH)
         {
@@ -57,13 +208,31 @@ static inline int flush_check(stream_encode_t *b, const size_t length)
     return 0;
 }
 
-// Encode a list type
+// Write the chunk as a block once it's full. This is only done between items, so that blocks hold whole items
+static inline int flush_item(stream_encode_t *b)
+{
+    if (b->block_flags != 0 && (size_t)BUF_GET_OFFSET >= b->chunk_size)
+        return flush_chunk(b);
+
+    return 0;
+}
+
+// Encode a list type. The items are nested in the container of the stream
 static inline int encode_list(stream_encode_t *b, PyObject *value)
 {
     const size_t nitems = PyList_GET_SIZE(value);
-    
-    for (size_t i = 0; i < nitems; ++i)
-        if (encode_object((encode_t *)b, PyList_GET_ITEM(value, i)) == 1) return 1;
+
+    if (enter_depth(&b->max_depth, 1, b->state->encoding_error) == 1)
+        return 1;
+
+    int status = 0;
+    for (size_t i = 0; i < nitems && status == 0; ++i)
+        status = encode_object((encode_t *)b, PyList_GET_ITEM(value, i)) == 1 || flush_item(b) == 1;
+
+    ++b->max_depth;
+
+    if (status == 1)
+        return 1;
 
     b->nitems += nitems;
     return 0;
@@ -74,22 +243,68 @@ static inline int encode_dict(stream_encode_t *b, PyObject *value)
     Py_ssize_t pos = 0;
     PyObject *key, *val;
 
-    while (PyDict_Next(value, &pos, &key, &val))
-        if (encode_object((encode_t *)b, key) == 1 || encode_object((encode_t *)b, val) == 1) return 1;
+    if (enter_depth(&b->max_depth, 1, b->state->encoding_error) == 1)
+        return 1;
+
+    int status = 0;
+    while (status == 0 && PyDict_Next(value, &pos, &key, &val))
+        status = encode_object((encode_t *)b, key) == 1 || encode_object((encode_t *)b, val) == 1 || flush_item(b) == 1;
+
+    ++b->max_depth;
+
+    if (status == 1)
+        return 1;
 
     b->nitems += PyDict_GET_SIZE(value);
     return 0;
 }
 
+/*  Write the rest of the chunk to the open stream file and close it, then update the number of items in the stream metadata.
+ *  This doesn't use the Python API, so it can run without holding the GIL.
+ *
+ *  Returns 0 on success, or one of the FILE_* results otherwise.
+ */
+static int finish_write(stream_encode_t *b)
+{
+    int status = write_chunk(b);
+
+    if (fclose(b->file) != 0 && status == 0)
+        status = FILE_WRITE_FAILED;
+
+    if (status != 0)
+        return status;
+
+    // Re-open the file in r+ to write to the metadata bytes
+    b->file = fopen(b->filename, "r+");
+    if (b->file == NULL)
+        return FILE_OPEN_FAILED;
+
+    // Write the number of items metadata to the file
+    char nitems_buf[8];
+    memcpy(nitems_buf, &b->nitems, 8);
+
+    if (fseek(b->file, b->start_offset + 1, SEEK_SET) != 0)
+        status = FILE_SEEK_FAILED;
+    else if (fwrite(nitems_buf, 8, 1, b->file) != 1)
+        status = FILE_WRITE_FAILED;
+
+    if (fclose(b->file) != 0 && status == 0)
+        status = FILE_WRITE_FAILED;
+
+    return status;
+}
+
 #define CLEAR_MEMORY do { \
     if (clear_memory == 1) \
     { \
         free(b->base); \
-        b->base = NULL; \
+        free(b->scratch); \
+        b->base = b->scratch = NULL; \
+        b->scratch_size = 0; \
     } \
 } while (0)
 
-static PyObject *update_encoder(stream_encode_ob *ob, PyObject *args, PyObject *kwargs)
+static PyObject *write_stream(stream_encode_ob *ob, PyObject *args, PyObject *kwargs)
 {
     PyObject *value;
     int clear_memory = 0;
@@ -153,47 +368,53 @@ static PyObject *update_encoder(stream_encode_ob *ob, PyObject *args, PyObject *
         return NULL;
     }
 
-    // Write the last changes
-    fwrite(b->base, BUF_GET_OFFSET, 1, b->file);
-    fclose(b->file);
+    /*  Write the last changes. The encoded value isn't referenced anymore and the buffer is ours,
+     *  so let other threads run meanwhile. Flushes while encoding keep the GIL, as the encoder
+     *  holds borrowed references to the items of the containers it's walking through.
+     */
+    int file_status;
 
-    // Re-open the file in r+ to write to the metadata bytes
-    b->file = fopen(b->filename, "r+");
-    if (b->file == NULL)
+    Py_BEGIN_ALLOW_THREADS
+    file_status = finish_write(b);
+    Py_END_ALLOW_THREADS
+
+    if (file_status != 0)
     {
-        PyErr_Format(PyExc_FileNotFoundError, "Failed to open file '%s''", b->filename);
-        fclose(b->file);
+        set_file_error(b->state, file_status, b->filename, b->start_offset + 1);
         return NULL;
     }
 
-    if (fseek(b->file, b->start_offset + 1, SEEK_SET) != 0)
+    CLEAR_MEMORY;
+    Py_RETURN_NONE;
+}
+
+static PyObject *update_encoder(stream_encode_ob *ob, PyObject *args, PyObject *kwargs)
+{
+    // Don't let another thread use the buffer while it's written to the file without the GIL
+    if (atomic_try_set(&ob->busy) == 0)
     {
-        PyErr_Format(FileOffsetError, "Unable to set the file offset to %zu\n", b->curr_offset);
-        fclose(b->file);
+        PyErr_SetString(PyExc_RuntimeError, "The stream encoder is already in use");
         return NULL;
     }
 
-    // Write the number of items metadata to the file
-    char nitems_buf[8];
-    memcpy(nitems_buf, &b->nitems, 8);
-
-    fwrite(nitems_buf, 8, 1, b->file);
-    fclose(b->file);
+    PyObject *result = write_stream(ob, args, kwargs);
+    ATOMIC_CLEAR(&ob->busy);
 
-    b->curr_offset += BUF_GET_OFFSET;
-
-    CLEAR_MEMORY;
-    Py_RETURN_NONE;
+    return result;
 }
 
 static void encoder_dealloc(stream_encode_ob *ob)
 {
+    PyTypeObject *type = Py_TYPE(ob);
     stream_encode_t b = ob->b;
 
     free(b.filename);
     free(b.base);
+    free(b.scratch);
+    Py_DECREF(ob->module);
 
-    PyObject_Del(ob);
+    type->tp_free((PyObject *)ob);
+    HEAPTYPE_DECREF(type);
 }
 
 static PyObject *start_offset_encoder(stream_encode_ob *ob)
@@ -217,30 +438,78 @@ static PyMethodDef stream_encoder_methods[] = {
     {NULL, NULL, 0, NULL}
 };
 
-PyTypeObject stream_encoder_t = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "compaqt.StreamEncoder",
-    .tp_basicsize = sizeof(stream_encode_ob),
-    .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_methods = stream_encoder_methods,
-    .tp_dealloc = (destructor)encoder_dealloc,
-    .tp_getset = stream_encoder_getset,
+static PyType_Slot stream_encoder_slots[] = {
+    {Py_tp_methods, stream_encoder_methods},
+    {Py_tp_dealloc, (destructor)encoder_dealloc},
+    {Py_tp_getset, stream_encoder_getset},
+    {0, NULL}
 };
 
+PyType_Spec stream_encoder_spec = {
+    .name = "compaqt.StreamEncoder",
+    .basicsize = sizeof(stream_encode_ob),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    .slots = stream_encoder_slots,
+};
+
+/*  Write the 9-byte metadata of a new stream container in `buf` to the file of the encoder, either at the end of the
+ *  existing file data (`preserve_file`) or at the start offset of a new file. This doesn't use the Python API, so it
+ *  can run without holding the GIL.
+ *
+ *  Returns 0 on success, or one of the FILE_* results otherwise.
+ */
+static int write_stream_metadata(stream_encode_t *b, const char *buf, const int preserve_file)
+{
+    FILE *file;
+
+    if (preserve_file == 1)
+    {
+        // Open in append mode and set the metadata offset to the current end of the file
+        if ((file = fopen(b->filename, "ab")) == NULL)
+            return FILE_OPEN_FAILED;
+        
+        b->curr_offset = ftell(file);
+    }
+    else
+    {
+        // Open in binary write mode to overwrite any existing data
+        if ((file = fopen(b->filename, "wb")) == NULL)
+            return FILE_OPEN_FAILED;
+
+        // Set the file to the stream offset
+        if (fseek(file, b->start_offset, SEEK_SET) != 0)
+        {
+            fclose(file);
+            return FILE_SEEK_FAILED;
+        }
+    }
+
+    int status = fwrite(buf, 9, 1, file) != 1 ? FILE_WRITE_FAILED : 0;
+
+    if (fclose(file) != 0)
+        status = FILE_WRITE_FAILED;
+
+    return status;
+}
+
 // Init function for encoder objects
 PyObject *get_stream_encoder(PyObject *self, PyObject *args, PyObject *kwargs)
 {
+    module_state_t *state = MODULE_STATE(self);
+
     char *filename;
     PyTypeObject *value_type = &PyList_Type;
     size_t chunk_size = DEFAULT_CHUNK_SIZE;
-    utypes_encode_ob *utypes;
+    utypes_encode_ob *utypes = NULL;
     int resume_stream = 0;
     int preserve_file = 0;
     size_t start_offset = 0;
+    int compress = 0;
+    int checksum = 0;
 
-    static char *kwlist[] = {"file_name", "value_type", "chunk_size", "custom_types", "resume_stream", "file_offset", "preserve_file", NULL};
+    static char *kwlist[] = {"file_name", "value_type", "chunk_size", "custom_types", "resume_stream", "file_offset", "preserve_file", "compress", "checksum", NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|OnO!ini", kwlist, &filename, (PyObject **)&value_type, (Py_ssize_t *)&chunk_size, &utypes_encode_t, &utypes, &resume_stream, (Py_ssize_t *)&start_offset, &preserve_file))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|OnO!inipp", kwlist, &filename, (PyObject **)&value_type, (Py_ssize_t *)&chunk_size, state->utypes_encode_type, &utypes, &resume_stream, (Py_ssize_t *)&start_offset, &preserve_file, &compress, &checksum))
         return NULL;
 
     if (value_type != &PyList_Type && value_type != &PyDict_Type)
@@ -249,15 +518,20 @@ PyObject *get_stream_encoder(PyObject *self, PyObject *args, PyObject *kwargs)
         return NULL;
     }
 
-    stream_encode_ob *ob = PyObject_New(stream_encode_ob, &stream_encoder_t);
+    stream_encode_ob *ob = PyObject_New(stream_encode_ob, state->stream_encoder_type);
 
     if (ob == NULL)
         return PyErr_NoMemory();
     
+    ob->module = self;
+    Py_INCREF(self);
+
     stream_encode_t *b = &ob->b;
 
     b->filename = (char *)malloc(strlen(filename) + 1);
     b->base = NULL;
+    b->scratch = NULL;
+    b->scratch_size = 0;
 
     if (b->filename == NULL)
     {
@@ -271,35 +545,34 @@ PyObject *get_stream_encoder(PyObject *self, PyObject *args, PyObject *kwargs)
     b->start_offset = start_offset;
     b->curr_offset = start_offset + MAX_METADATA_SIZE;
     b->utypes = utypes;
+    b->keys = NULL;
+    b->columnar = 0;
+    b->compact = 0;
+    b->sized = 0;
+    b->max_depth = DEFAULT_MAX_DEPTH;
+    b->refs = NULL;
+    b->state = state;
     b->bufcheck = (bufcheck_t)flush_check;
+    b->block_flags = (compress ? BLOCK_COMPRESS : 0) | (checksum ? BLOCK_CHECKSUM : 0);
+
+    ob->busy = 0;
+
+    int file_status;
 
     // Check if we need to resume a previous stream
     if (resume_stream == 1)
     {
-        // Open the file in binary read mode as we don't have to write, and we have to read the current number of items
-        FILE *file = fopen(filename, "rb");
-        if (file == NULL)
-        {
-            PyErr_Format(PyExc_FileNotFoundError, "Failed to create/open file '%s'", filename);
-            Py_DECREF(b);
-            return NULL;
-        }
+        // Buffer to read the current metadata to, followed by the first byte of the data
+        char buf[10];
 
-        if (fseek(file, b->start_offset, SEEK_SET) != 0)
-        {
-            PyErr_Format(FileOffsetError, "Unable to set the file offset to %zu\n", b->start_offset);
-            fclose(file);
-            Py_DECREF(b);
-            return NULL;
-        }
+        Py_BEGIN_ALLOW_THREADS
+        file_status = read_stream_metadata(filename, b->start_offset, buf);
+        Py_END_ALLOW_THREADS
 
-        // Buffer to write the current metadata to
-        char buf[9];
-        if (fread(buf, 9, 1, file) == 0)
+        if (file_status != 0)
         {
-            PyErr_Format(FileOffsetError, "Failed to read the file from offset %zu", b->start_offset);
-            fclose(file);
-            Py_DECREF(b);
+            set_file_error(state, file_status, filename, b->start_offset);
+            Py_DECREF(ob);
             return NULL;
         }
 
@@ -310,53 +583,34 @@ PyObject *get_stream_encoder(PyObject *self, PyObject *args, PyObject *kwargs)
         if ((*buf & 0b11111000) != 0b11111000 || (tpmask != DT_ARRAY && tpmask != DT_DICTN))
         {
             PyErr_SetString(PyExc_ValueError, "The existing file data does not match the encoding stream expectations");
-            fclose(file);
-            Py_DECREF(b);
+            Py_DECREF(ob);
             return NULL;
         }
         
         b->type = tpmask == DT_ARRAY ? &PyList_Type : &PyDict_Type;
         memcpy(&b->nitems, buf + 1, 8);
 
-        fclose(file);
-    }
-    else
-    {
-        FILE *file;
+        /*  Streams are either checksummed entirely or not at all. Checksummed blocks can be compressed or not, but other
+         *  streams are either compressed entirely or not at all.
+         */
+        const int checksummed = (buf[9] & 0xFF) == CHECKED_FRAME_BYTE;
 
-        if (preserve_file == 1)
+        if (b->nitems != 0 && checksummed != checksum)
         {
-            // Open in append mode and set the metadata offset to the current end of the file
-            file = fopen(filename, "ab");
-            b->curr_offset = ftell(file);
-            if (file == NULL)
-            {
-                PyErr_Format(PyExc_FileNotFoundError, "Failed to create/open file '%s'", filename);
-                Py_DECREF(ob);
-                return NULL;
-            }
+            PyErr_Format(PyExc_ValueError, "The existing stream is %s, while the 'checksum' argument is %s", checksum ? "not checksummed" : "checksummed", checksum ? "True" : "False");
+            Py_DECREF(ob);
+            return NULL;
         }
-        else
+
+        if (b->nitems != 0 && !checksummed && ((buf[9] & 0xFF) == FRAME_BYTE) != compress)
         {
-            // Open in binary write mode to overwrite any existing data
-            file = fopen(filename, "wb");
-            if (file == NULL)
-            {
-                PyErr_Format(PyExc_FileNotFoundError, "Failed to create/open file '%s'", filename);
-                Py_DECREF(ob);
-                return NULL;
-            }
-
-            // Set the file to the stream offset
-            if (fseek(file, b->start_offset, SEEK_SET) != 0)
-            {
-                PyErr_Format(FileOffsetError, "Unable to set the file offset to %zu\n", b->start_offset);
-                fclose(file);
-                Py_DECREF(ob);
-                return NULL;
-            }
+            PyErr_Format(PyExc_ValueError, "The existing stream is %s, while the 'compress' argument is %s", compress ? "not compressed" : "compressed", compress ? "True" : "False");
+            Py_DECREF(ob);
+            return NULL;
         }
-
+    }
+    else
+    {
         /*  Write the extendable metadata to the file in advance. Initialize it with
          *  zero items; that number will be updated as new values are written.
          */
@@ -368,8 +622,16 @@ PyObject *get_stream_encoder(PyObject *self, PyObject *args, PyObject *kwargs)
         
         METADATA_VARLEN_WR_MODE3(tpmask, 0, 8);
 
-        fwrite(buf, 9, 1, file);
-        fclose(file);
+        Py_BEGIN_ALLOW_THREADS
+        file_status = write_stream_metadata(b, buf, preserve_file);
+        Py_END_ALLOW_THREADS
+
+        if (file_status != 0)
+        {
+            set_file_error(state, file_status, filename, b->start_offset);
+            Py_DECREF(ob);
+            return NULL;
+        }
 
         b->type = value_type;
         b->nitems = 0;
@@ -382,22 +644,120 @@ PyObject *get_stream_encoder(PyObject *self, PyObject *args, PyObject *kwargs)
 
 static inline int refresh_chunk(stream_decode_t *b)
 {
-    // Update the total offset and reset the chunk offset
+    // Update the total offset and reset the chunk offset, keeping the position within the value being decoded
+    b->dropped += BUF_GET_OFFSET;
     b->curr_offset += BUF_GET_OFFSET;
     b->offset = b->base;
 
-    // Go to the reading point of the file
-    if (fseek(b->file, b->curr_offset, SEEK_SET) != 0)
+    int seek_status;
+    size_t nread = 0;
+
+    // Go to the reading point of the file and read the next chunk. The buffer is ours and the decoded
+    // objects aren't reachable from other threads yet, so let those run meanwhile
+    Py_BEGIN_ALLOW_THREADS
+    seek_status = fseek(b->file, b->curr_offset, SEEK_SET);
+
+    if (seek_status == 0)
+        nread = fread(b->base, 1, b->chunk_size, b->file);
+    Py_END_ALLOW_THREADS
+
+    if (seek_status != 0)
     {
-        PyErr_Format(FileOffsetError, "Failed to open the file at offset %zu", b->curr_offset);
+        PyErr_Format(b->state->file_offset_error, "Failed to open the file at offset %zu", b->curr_offset);
         return 1;
     }
 
     // Set the chunk size to the number of items read, so that it gets smaller if the file limit is reached.
     // It doesn't matter that this overrides the user value, as the end of the file is reached and thus only the smaller chunk size is needed
-    if ((b->max_offset = b->base - fread(b->base, 1, b->chunk_size, b->file)) == b->base)
+    if ((b->max_offset = b->base + nread) == b->base)
     {
-        PyErr_Format(FileOffsetError, "Failed to read the file from offset %zu", b->curr_offset);
+        PyErr_Format(b->state->file_offset_error, "Failed to read the file from offset %zu", b->curr_offset);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*  Read the block at `offset` in the open file of the decoder, verify its checksum if it has one, and decompress it into the
+ *  chunk buffer, which grows to fit the block if needed. Blocks stored as is are read into the chunk buffer directly.
+ *  This doesn't use the Python API, so it can run without holding the GIL.
+ *
+ *  Returns 0 on success, or one of the FILE_* results otherwise.
+ */
+static int read_block(stream_decode_t *b, const size_t offset)
+{
+    char header[CHECKED_FRAME_HEADER_SIZE];
+    frame_t frame;
+
+    if (fseek(b->file, offset, SEEK_SET) != 0)
+        return FILE_SEEK_FAILED;
+    if (fread(header, FRAME_HEADER_SIZE, 1, b->file) != 1)
+        return FILE_READ_FAILED;
+    if (!IS_FRAME_BYTE(header[0]))
+        return FILE_CORRUPTED;
+
+    // The checksum of checked blocks follows the rest of the header
+    if ((header[0] & 0xFF) == CHECKED_FRAME_BYTE && fread(header + FRAME_HEADER_SIZE, CHECKSUM_SIZE, 1, b->file) != 1)
+        return FILE_READ_FAILED;
+    if (read_frame_header(header, &frame) == 1)
+        return FILE_CORRUPTED;
+
+    const size_t raw_length = frame.raw_length;
+    const size_t stored_length = frame.stored_length;
+
+    // Leave room for reading the metadata of a value past the end of the block, which is checked afterwards
+    const size_t needed = raw_length + MAX_METADATA_SIZE;
+
+    if (needed > b->chunk_size)
+    {
+        // Don't use realloc as we don't need to preserve data
+        free(b->base);
+        b->base = (char *)malloc(needed);
+        b->chunk_size = needed;
+
+        if (b->base == NULL)
+            return FILE_NO_MEMORY;
+    }
+
+    if (stored_length == raw_length)
+    {
+        if (fread(b->base, 1, raw_length, b->file) != raw_length)
+            return FILE_READ_FAILED;
+        if (verify_block(&frame, b->base) == 1)
+            return FILE_CORRUPTED;
+    }
+    else
+    {
+        if (reserve_scratch(&b->scratch, &b->scratch_size, stored_length) == 1)
+            return FILE_NO_MEMORY;
+        if (fread(b->scratch, 1, stored_length, b->file) != stored_length)
+            return FILE_READ_FAILED;
+        if (unpack_block(&frame, b->scratch, b->base) == 1)
+            return FILE_CORRUPTED;
+    }
+
+    b->offset = b->base;
+    b->max_offset = b->base + raw_length;
+    b->curr_offset = offset;
+    b->next_offset = offset + frame.header_size + stored_length;
+
+    return 0;
+}
+
+// Continue with the next block once the one in the chunk buffer is done. Returns 1 with an error set on failure
+static int next_block(stream_decode_t *b)
+{
+    const size_t offset = b->next_offset;
+    int status;
+
+    // The buffer is ours and the decoded objects aren't reachable from other threads yet, so let those run meanwhile
+    Py_BEGIN_ALLOW_THREADS
+    status = read_block(b, offset);
+    Py_END_ALLOW_THREADS
+
+    if (status != 0)
+    {
+        set_file_error(b->state, status, b->filename, offset);
         return 1;
     }
 
@@ -406,15 +766,29 @@ static inline int refresh_chunk(stream_decode_t *b)
 
 static inline int chunk_refresh_check(stream_decode_t *b, const size_t length)
 {
-    if (b->offset + length > b->max_offset)
+    if (b->offset > b->max_offset || (size_t)(b->max_offset - b->offset) < length)
     {
+        // Blocks hold whole items, so running out of data within one means it's corrupted
+        if (b->in_blocks == 1)
+        {
+            PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+            return 1;
+        }
+
         if (length > b->chunk_size)
         {
-            PyErr_Format(PyExc_ValueError, "Found a value that requires %zu bytes to store, while the chunk limit is %s", length, b->chunk_size);
+            PyErr_Format(PyExc_ValueError, "Found a value that requires %zu bytes to store, while the chunk limit is %zu", length, b->chunk_size);
             return 1;
         }
 
         if (refresh_chunk(b) == 1) return 1;
+
+        // The file ended before the value did
+        if ((size_t)(b->max_offset - b->offset) < length)
+        {
+            PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+            return 1;
+        }
     }
 
     return 0;
@@ -432,6 +806,12 @@ static inline PyObject *decode_list(stream_decode_t *b, const size_t nitems)
 
     for (size_t i = 0; i < nitems; ++i)
     {
+        if (b->in_blocks == 1 && b->offset == b->max_offset && next_block(b) == 1)
+        {
+            Py_DECREF(list);
+            return NULL;
+        }
+
         PyObject *val = decode_bytes((decode_t *)b);
 
         if (val == NULL)
@@ -460,6 +840,12 @@ static inline PyObject *decode_dict(stream_decode_t *b, const size_t nitems)
 
     for (size_t i = 0; i < nitems; ++i)
     {
+        if (b->in_blocks == 1 && b->offset == b->max_offset && next_block(b) == 1)
+        {
+            Py_DECREF(dict);
+            return NULL;
+        }
+
         PyObject *key = decode_bytes((decode_t *)b);
 
         if (key == NULL)
@@ -485,7 +871,47 @@ static inline PyObject *decode_dict(stream_decode_t *b, const size_t nitems)
     return dict;
 }
 
-static PyObject *update_decoder(stream_decode_ob *ob, PyObject *args, PyObject *kwargs)
+/*  Open the file of the decoder and read the first chunk from the current stream offset. If the stream is made up of blocks, the
+ *  current block is read instead, continuing from where the last read left off in it. The file is left open if successful.
+ *  This doesn't use the Python API, so it can run without holding the GIL.
+ *
+ *  Returns 0 on success, or one of the FILE_* results otherwise.
+ */
+static int start_read(stream_decode_t *b)
+{
+    if ((b->file = fopen(b->filename, "rb")) == NULL)
+        return FILE_OPEN_FAILED;
+
+    int status = 0;
+    char first;
+
+    // Go to the current stream offset to read from where we left off, and copy the first chunk into the message buffer
+    if (fseek(b->file, b->curr_offset, SEEK_SET) != 0)
+        status = FILE_SEEK_FAILED;
+    else if (fread(&first, 1, 1, b->file) != 1)
+        status = FILE_READ_FAILED;
+    else if ((b->in_blocks = IS_FRAME_BYTE(first)) == 1)
+    {
+        if ((status = read_block(b, b->curr_offset)) == 0)
+        {
+            if (b->block_skip > (size_t)BUF_GET_LENGTH)
+                status = FILE_CORRUPTED;
+
+            b->offset = b->base + b->block_skip;
+        }
+    }
+    else if (fseek(b->file, b->curr_offset, SEEK_SET) != 0)
+        status = FILE_SEEK_FAILED;
+    else if ((b->max_offset = b->base + fread(b->base, 1, b->chunk_size, b->file)) == b->base)
+        status = FILE_READ_FAILED;
+
+    if (status != 0)
+        fclose(b->file);
+
+    return status;
+}
+
+static PyObject *read_stream(stream_decode_ob *ob, PyObject *args, PyObject *kwargs)
 {
     stream_decode_t *b = &ob->b;
 
@@ -525,29 +951,22 @@ static PyObject *update_decoder(stream_decode_ob *ob, PyObject *args, PyObject *
             return PyErr_NoMemory();
     }
 
-    BUF_INIT_OFFSETS(b->chunk_size);
+    // The items are nested in the container of the stream
+    if (enter_depth(&b->max_depth, 1, b->state->decoding_error) == 1)
+        return NULL;
 
-    b->file = fopen(b->filename, "rb");
+    b->offset = b->base;
 
-    if (b->file == NULL)
-    {
-        PyErr_Format(PyExc_FileNotFoundError, "Failed to open file '%s'", b->filename);
-        return NULL;
-    }
+    int file_status;
 
-    // Go to the current stream offset to read from where we left off
-    if (fseek(b->file, b->curr_offset, SEEK_SET) != 0)
-    {
-        PyErr_Format(FileOffsetError, "Failed to open the file at offset %zu", b->curr_offset);
-        fclose(b->file);
-        return NULL;
-    }
+    Py_BEGIN_ALLOW_THREADS
+    file_status = start_read(b);
+    Py_END_ALLOW_THREADS
 
-    // Copy the first chunk into the message buffer
-    if (fread(b->base, 1, b->chunk_size, b->file) == 0)
+    if (file_status != 0)
     {
-        PyErr_Format(FileOffsetError, "Failed to read the file from offset %zu", b->curr_offset);
-        fclose(b->file);
+        ++b->max_depth;
+        set_file_error(b->state, file_status, b->filename, b->curr_offset);
         return NULL;
     }
 
@@ -557,21 +976,61 @@ static PyObject *update_decoder(stream_decode_ob *ob, PyObject *args, PyObject *
         result = decode_list(b, nitems);
     else
         result = decode_dict(b, nitems);
-    
-    b->curr_offset += BUF_GET_OFFSET;
+
+    ++b->max_depth;
+    fclose(b->file);
+
+    if (b->in_blocks == 1)
+    {
+        // Continue from the next block if this one is done, or from within it otherwise
+        if (b->offset >= b->max_offset)
+        {
+            b->curr_offset = b->next_offset;
+            b->block_skip = 0;
+        }
+        else
+        {
+            b->block_skip = BUF_GET_OFFSET;
+        }
+    }
+    else
+    {
+        b->curr_offset += BUF_GET_OFFSET;
+    }
 
     CLEAR_MEMORY;
     return result;
 }
 
+static PyObject *update_decoder(stream_decode_ob *ob, PyObject *args, PyObject *kwargs)
+{
+    // Don't let another thread use the buffer while chunks are read into it without the GIL
+    if (atomic_try_set(&ob->busy) == 0)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "The stream decoder is already in use");
+        return NULL;
+    }
+
+    PyObject *result = read_stream(ob, args, kwargs);
+    ATOMIC_CLEAR(&ob->busy);
+
+    return result;
+}
+
 static void decoder_dealloc(stream_decode_ob *ob)
 {
+    PyTypeObject *type = Py_TYPE(ob);
     stream_decode_t b = ob->b;
 
     free(b.filename);
     free(b.base);
+    free(b.scratch);
+    Py_XDECREF(b.keys);
+    Py_XDECREF(b.refs);
+    Py_DECREF(ob->module);
 
-    PyObject_Del(ob);
+    type->tp_free((PyObject *)ob);
+    HEAPTYPE_DECREF(type);
 }
 
 static PyObject *items_remaining_decoder(stream_decode_ob *ob)
@@ -591,7 +1050,7 @@ static PyObject *curr_offset_decoder(stream_encode_ob *ob)
 
 static PyGetSetDef stream_decoder_getset[] = {
     {"start_offset", (getter)start_offset_decoder, NULL, "The offset the decoder started reading from", NULL},
-    {"curr_offset", (getter)curr_offset_decoder, NULL, "The total file offset the decoder is currently at", NULL},
+    {"curr_offset", (getter)curr_offset_decoder, NULL, "The total file offset the decoder is currently at, or the offset of the current block if the stream is compressed or checksummed", NULL},
     {"items_remaining", (getter)items_remaining_decoder, NULL, "The amount of items remaining to be read", NULL},
     {NULL, NULL, NULL, NULL, NULL}
 };
@@ -601,19 +1060,25 @@ static PyMethodDef stream_decoder_methods[] = {
     {NULL, NULL, 0, NULL}
 };
 
-PyTypeObject stream_decoder_t = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "compaqt.StreamDecoder",
-    .tp_basicsize = sizeof(stream_decode_ob),
-    .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_methods = stream_decoder_methods,
-    .tp_dealloc = (destructor)decoder_dealloc,
-    .tp_getset = stream_decoder_getset,
+static PyType_Slot stream_decoder_slots[] = {
+    {Py_tp_methods, stream_decoder_methods},
+    {Py_tp_dealloc, (destructor)decoder_dealloc},
+    {Py_tp_getset, stream_decoder_getset},
+    {0, NULL}
+};
+
+PyType_Spec stream_decoder_spec = {
+    .name = "compaqt.StreamDecoder",
+    .basicsize = sizeof(stream_decode_ob),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    .slots = stream_decoder_slots,
 };
 
 // Init function for encoder objects
 PyObject *get_stream_decoder(PyObject *self, PyObject *args, PyObject *kwargs)
 {
+    module_state_t *state = MODULE_STATE(self);
+
     char *filename;
     size_t chunk_size = DEFAULT_CHUNK_SIZE;
     utypes_decode_ob *utypes = NULL;
@@ -621,18 +1086,26 @@ PyObject *get_stream_decoder(PyObject *self, PyObject *args, PyObject *kwargs)
 
     static char *kwlist[] = {"file_name", "chunk_size", "custom_types", "file_offset", NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|nO!n", kwlist, &filename, (Py_ssize_t *)&chunk_size, &utypes_decode_t, &utypes, (Py_ssize_t *)&stream_offset))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|nO!n", kwlist, &filename, (Py_ssize_t *)&chunk_size, state->utypes_decode_type, &utypes, (Py_ssize_t *)&stream_offset))
         return NULL;
     
-    stream_decode_ob *ob = PyObject_New(stream_decode_ob, &stream_decoder_t);
+    stream_decode_ob *ob = PyObject_New(stream_decode_ob, state->stream_decoder_type);
 
     if (ob == NULL)
         return PyErr_NoMemory();
     
+    ob->module = self;
+    Py_INCREF(self);
+
     stream_decode_t *b = &ob->b;
 
     b->filename = (char *)malloc(strlen(filename) + 1);
     b->base = NULL;
+    b->scratch = NULL;
+    b->scratch_size = 0;
+    b->in_blocks = 0;
+    b->block_skip = 0;
+    b->next_offset = 0;
 
     if (b->filename == NULL)
     {
@@ -645,36 +1118,30 @@ PyObject *get_stream_decoder(PyObject *self, PyObject *args, PyObject *kwargs)
     b->start_offset = stream_offset;
     b->chunk_size = chunk_size;
     b->utypes = utypes;
+    b->keys = NULL;
+    b->max_depth = DEFAULT_MAX_DEPTH;
+    b->refs = NULL;
+    b->state = state;
+    b->dropped = 0;
     b->bufcheck = (bufcheck_t)chunk_refresh_check;
     b->bufd = NULL;
 
-    // Open the file in binary read mode to read the current number of items
-    FILE *file = fopen(filename, "rb");
-    if (file == NULL)
-    {
-        PyErr_Format(PyExc_FileNotFoundError, "Failed to create/open file '%s'", filename);
-        Py_DECREF(ob);
-        return NULL;
-    }
-
-    if (fseek(file, stream_offset, SEEK_SET) != 0)
-    {
-        PyErr_Format(FileOffsetError, "Unable to set the file offset to offset %zu\n", stream_offset);
-        fclose(file);
-        Py_DECREF(ob);
-        return NULL;
-    }
+    ob->busy = 0;
 
     // Read the type and current number of items
-    char buf[9];
-    if (fread(buf, 9, 1, file) == 0)
+    char buf[10];
+    int file_status;
+
+    Py_BEGIN_ALLOW_THREADS
+    file_status = read_stream_metadata(filename, stream_offset, buf);
+    Py_END_ALLOW_THREADS
+
+    if (file_status != 0)
     {
-        PyErr_Format(FileOffsetError, "Failed to read the file from offset %zu", stream_offset);
-        fclose(file);
+        set_file_error(state, file_status, filename, stream_offset);
         Py_DECREF(ob);
         return NULL;
     }
-    fclose(file);
 
     // Get which datatype we have stored
     const char tpmask = buf[0] & 0b111;
@@ -3,8 +3,8 @@
 
 #include <Python.h>
 
-extern PyTypeObject stream_encoder_t;
-extern PyTypeObject stream_decoder_t;
+extern PyType_Spec stream_encoder_spec;
+extern PyType_Spec stream_decoder_spec;
 
 PyObject *get_stream_encoder(PyObject *self, PyObject *args, PyObject *kwargs);
 PyObject *get_stream_decoder(PyObject *self, PyObject *args, PyObject *kwargs);
@@ -2,25 +2,57 @@
 
 #include <Python.h>
 
+#include "main/compression.h"
+#include "main/checksum.h"
+
 #include "globals/exceptions.h"
 #include "globals/typemasks.h"
 #include "globals/buftricks.h"
 #include "globals/typedefs.h"
+#include "globals/framestack.h"
+#include "globals/modstate.h"
+
+// Minimum size of a bytes object to validate with the GIL released
+#define GIL_RELEASE_MIN_SIZE 1024*64
+
+// Whether fewer than `length` bytes are left, also if the metadata of a value was already read past the end of the data
+#define OVERREAD(length) (b->offset > b->max_offset || (size_t)(b->max_offset - b->offset) < (size_t)(length))
 
 #define OVERREAD_CHECK(length) do { \
-    if (b->offset + length > b->max_offset) return 1; \
+    if (OVERREAD(length)) return 1; \
+} while (0)
+
+// Number of bytes read as the metadata of a value before its length is checked
+#define METADATA_LOOKAHEAD (MAX_METADATA_SIZE + 2)
+
+/*  Move the unread part of the chunk to the start of the buffer and fill the rest of it from the file.
+ *  The data that's read is added to the running checksum if there is one, so that it's verified in the same pass.
+ *  The bytes that are dropped from the chunk are added to `dropped`, which keeps the position in the data.
+ */
+#define BUFFER_REFILL() do { \
+    const size_t unread = (size_t)(b->max_offset - b->offset); \
+    const size_t chunk_size = BUF_GET_LENGTH; \
+    *dropped += (size_t)(b->offset - b->base); \
+    memmove(b->base, b->offset, unread); \
+    b->offset = b->base; \
+    const size_t nread = fread(b->base + unread, 1, chunk_size - unread, file); \
+    if (checksum != NULL) \
+        checksum_update(checksum, b->base + unread, nread); \
+    b->max_offset = b->base + unread + nread; \
 } while (0)
 
 #define BUFFER_REFRESH(length) do { \
-    if (b->offset + length > b->max_offset) \
+    if (OVERREAD(length)) \
     { \
-        b->max_offset = b->base + fread(b->base, 1, BUF_GET_LENGTH, file); \
-        if (b->max_offset == b->base) return 1; /* EOF or error */ \
-        if ((size_t)(b->max_offset - b->base) <= length) return 1; /* File not big enough */ \
-        b->offset = b->base; \
+        if (b->offset > b->max_offset) return 1; /* Metadata went past the end of the file */ \
+        BUFFER_REFILL(); \
+        if (OVERREAD(length)) return 1; /* File not big enough, or the value doesn't fit in a chunk */ \
     } \
 } while (0)
 
+// Position of the offset in the data, also when it's read in chunks
+#define POSITION() (*dropped + (size_t)(b->offset - b->base))
+
 #define CHECK(length) do { \
     if (file != NULL) \
         BUFFER_REFRESH(length); \
@@ -28,35 +60,245 @@
         OVERREAD_CHECK(length); \
 } while (0)
 
-static inline int _validate(decode_t *b, FILE *file)
+// Check that the varlen metadata of a value is available before reading it
+#define CHECK_VARLEN() CHECK(METADATA_VARLEN_SIZE(b->offset[0] & 0xFF))
+
+/*  Whether zigzag varints end with a byte without the high bit set, and hold at most 64 bits in 10 bytes each.
+ *  The bytes are checked 8 at a time, of which only the bytes around the ends of the varints in them count.
+ */
+static inline int valid_varints(const unsigned char *data, const size_t length)
+{
+    if (length == 0)
+        return 1;
+    if (data[length - 1] >= 0x80)
+        return 0;
+
+    // Number of bytes with the high bit set since the end of the last varint
+    size_t run = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        word = LITTLE_64(word);
+
+        const uint64_t ends = ~word & 0x8080808080808080ULL;
+
+        if (ends == 0)
+        {
+            run += 8;
+        }
+        else
+        {
+            // The bytes before the first end continue the run, and the bytes after the last end start a new one
+            if (run + (TRAILING_ZEROES_64(ends) >> 3) >= 10)
+                return 0;
+
+            run = LEADING_ZEROES_64(ends) >> 3;
+        }
+
+        if (run >= 10)
+            return 0;
+    }
+
+    for (; i < length; ++i)
+    {
+        run = data[i] >= 0x80 ? run + 1 : 0;
+
+        if (run >= 10)
+            return 0;
+    }
+
+    return 1;
+}
+
+/*  Validate the bytes object extended by a typed array, packed column or list of integers, and skip over it. For typed
+ *  arrays and packed columns, `nitems` is set to the number of items in it unless it's NULL.
+ *
+ *  Returns 1 if invalid, and 0 otherwise.
+ */
+static NOINLINE int validate_packed(decode_t *b, FILE *file, checksum_t *checksum, size_t *dropped, const unsigned int ext, size_t *nitems)
+{
+    size_t length;
+    CHECK_VARLEN();
+    METADATA_VARLEN_RD(length);
+    CHECK(length);
+
+    const unsigned char *data = (const unsigned char *)b->offset;
+    b->offset += length;
+
+    if (ext == EXT_ZZINT)
+        return valid_varints(data, length) == 0;
+
+    // A format character followed by whole items, where columns only hold signed integers, floats and doubles
+    const size_t width = length == 0 ? 0 : format_width(data[0]);
+
+    if (width == 0 || (length - 1) % width != 0 || (ext == EXT_NMCOL && strchr("bhiqfd", data[0]) == NULL))
+        return 1;
+
+    if (nitems != NULL)
+        *nitems = (length - 1) / width;
+
+    return 0;
+}
+
+/*  Validate the metadata of a value, and skip over it unless it's a list or dict. For those, `nitems` is set to the number
+ *  of values they hold, and `end` to the position at which a sized one ends (SIZE_MAX otherwise). `nkeys` and `nrefs` hold
+ *  the number of values defined in the key table and reference table so far, to validate references to them. Extensions
+ *  are checked the same way as when decoding them.
+ *
+ *  Returns 1 if invalid, 2 for a list or dict, 3 for a list of dicts by column, and 0 for any other value.
+ */
+static ALWAYS_INLINE int validate_value(decode_t *b, FILE *file, checksum_t *checksum, size_t *nkeys, size_t *nrefs, size_t *nitems, size_t *dropped, size_t *end)
 {
-    CHECK(0);
+    *end = SIZE_MAX;
+
+    read_value:
+    // Make sure the metadata of the value is in the chunk, as it's read before the length of the value is checked
+    if (file != NULL && b->offset + METADATA_LOOKAHEAD > b->max_offset)
+    {
+        if (b->offset > b->max_offset) return 1;
+        BUFFER_REFILL();
+    }
+    
+    CHECK(1);
     
     const char tpmask = b->offset[0] & 0b11111;
     switch (tpmask)
     {
-    case DT_FLOAT: CHECK(9); b->offset += 9; return 0;
+    case DT_FLOAT:
+    {
+        // Floats are stored as 4 bytes if the upper bits are set
+        const size_t total_len = b->offset[0] == (char)DT_FLT32 ? 5 : 9;
+
+        CHECK(total_len);
+        b->offset += total_len;
+
+        return 0;
+    }
     case DT_BOOLF:
     case DT_BOOLT:
     case DT_NONTP: ++(b->offset); return 0;
     
     CASES_AS_5BIT(DT_UTYPE)
     {
-        ++(b->offset);
+        // The index is stored in the first byte of the metadata, and the number of length bytes in the second
+        CHECK(2);
+        const size_t nbytes = b->offset[1] & 0b111;
+        CHECK(1 + nbytes);
 
-        int idx; // Unused
-        size_t length;
+        // Only read the length bytes, as a small custom value at the end of the data has fewer than 8 bytes after it
+        uint64_t length = 0;
+        memcpy(&length, b->offset + 1, nbytes);
+        length = LITTLE_64(length) >> 3;
 
-        METADATA_UTYPE_RD(idx, length);
+        b->offset += 1 + nbytes;
         CHECK(length);
 
         b->offset += length;
 
         return 0;
     }
+    CASES_AS_5BIT(DT_EXTNS)
+    {
+        // Extensions are followed by the value they extend, which is validated as usual
+        const unsigned int ext = (b->offset[0] & 0xFF) >> 3;
+
+        if (ext > EXT_LIMIT)
+            return 1;
+
+        ++(b->offset);
+
+        if (ext == EXT_SIZED)
+        {
+            // The 4 size bytes and the first byte of the container, which has to be a list or dict
+            CHECK(SIZED_PREFIX_SIZE);
+
+            uint32_t size;
+            memcpy(&size, b->offset, SIZED_PREFIX_SIZE - 1);
+            size = LITTLE_32(size);
+
+            b->offset += SIZED_PREFIX_SIZE - 1;
+
+            if ((b->offset[0] & 0b110) != 0)
+                return 1;
+
+            if (size != SIZED_UNKNOWN)
+                *end = POSITION() + size;
+
+            goto read_value;
+        }
+
+        // The other extensions are followed by the value they extend, of which the first byte is checked along with them
+        CHECK(1);
+
+        if (ext == EXT_REFDF)
+        {
+            // Tuples, sets and frozensets can't be defined, and neither can another definition
+            const unsigned int next = (b->offset[0] & 0xFF) >> 3;
+            if ((b->offset[0] & 0b111) == DT_EXTNS && (next <= EXT_FROZN || next == EXT_REFDF))
+                return 1;
+
+            ++(*nrefs);
+            goto read_value;
+        }
+
+        if (ext == EXT_KEYDF || ext == EXT_KEYRF || ext == EXT_REFRF)
+        {
+            const char expected = ext == EXT_KEYDF ? DT_STRNG : DT_INTGR;
+            if ((b->offset[0] & 0b111) != expected)
+                return 1;
+
+            if (ext == EXT_KEYDF)
+            {
+                ++(*nkeys);
+                goto read_value;
+            }
+
+            // Check that the reference points to an already defined key or value
+            const size_t nbytes = (b->offset[0] & 0xFF) >> 3;
+            if (nbytes > 8)
+                return 1;
+
+            CHECK(nbytes + 1);
+
+            uint64_t idx = 0;
+            memcpy(&idx, b->offset + 1, nbytes);
+            idx = LITTLE_64(idx);
+
+            b->offset += nbytes + 1;
+
+            return idx >= (ext == EXT_KEYRF ? *nkeys : *nrefs);
+        }
+
+        // Packed columns only exist as the columns of a list of dicts by column, which are validated along with it
+        if (ext == EXT_NMCOL)
+            return 1;
+
+        // The other extensions are followed by the datatype they extend
+        if ((b->offset[0] & 0b111) != ext_tpmasks[ext])
+            return 1;
+
+        if (ext == EXT_TARRY || ext == EXT_ZZINT)
+            return validate_packed(b, file, checksum, dropped, ext, NULL) == 1;
+
+        if (ext == EXT_COLMN)
+        {
+            // Columnar lists hold at least the keys and one column
+            CHECK_VARLEN();
+            METADATA_VARLEN_RD(*nitems);
+            CHECK(0);
+
+            return *nitems < 2 ? 1 : 3;
+        }
+
+        goto read_value;
+    }
     CASES_AS_5BIT(DT_INTGR)
     {
-        const size_t total_len = ((b->offset[0] & 0xFF) >> 5) + 1;
+        // The metadata byte holds the number of bytes in the upper 5 bits
+        const size_t total_len = ((b->offset[0] & 0xFF) >> 3) + 1;
         CHECK(total_len);
 
         b->offset += total_len;
@@ -67,101 +309,537 @@ static inline int _validate(decode_t *b, FILE *file)
     CASES_AS_5BIT(DT_STRNG)
     {
         size_t length;
+        CHECK_VARLEN();
         METADATA_VARLEN_RD(length);
         CHECK(length);
 
         b->offset += length;
         return 0;
     }
-    CASES_AS_5BIT(DT_ARRAY)
-    CASES_AS_5BIT(DT_DICTN)
+    default: // Lists and dicts
     {
-        size_t nitems;
-        METADATA_VARLEN_RD(nitems);
+        CHECK_VARLEN();
+        METADATA_VARLEN_RD(*nitems);
+        CHECK(0);
 
         // Twice as much items if it's a dict, as dicts work with pairs
         if ((tpmask & 0b111) == DT_DICTN)
-            nitems *= 2;
+            *nitems *= 2;
 
-        for (size_t i = 0; i < nitems; ++i)
-            if (_validate(b, file) == 1) return 1;
-        
-        return 0;
+        return 2;
     }
     }
 }
 
+// Frame of a container of which the values are being validated
+typedef struct {
+    size_t left;    // Number of values left in the container
+    size_t end;     // Position at which the container ends if it's sized, SIZE_MAX otherwise
+    size_t columns; // Number of columns left to start if the container entered with this frame is a list of dicts by column, SIZE_MAX otherwise
+    size_t keys;    // Number of its keys, 0 before its list of keys is started
+    size_t rows;    // Number of rows in its columns, set once the first one is started
+} val_frame_t;
+
+/*  Start the list of keys or the next column of the list of dicts by column entered with `frame`, which are plain lists
+ *  as written when encoding, or packed columns. Packed columns are validated here, while the values of lists are
+ *  validated as usual after entering them. The list of keys holds a key per column, and the columns all hold a value for
+ *  every row.
+ *
+ *  Returns 1 if invalid, 2 if a list is entered, of which `nitems` is set to the number of values, and 0 once all its
+ *  columns are validated.
+ */
+static NOINLINE int validate_columns(decode_t *b, FILE *file, checksum_t *checksum, size_t *dropped, val_frame_t *frame, size_t *nitems)
+{
+    while (frame->keys == 0 || frame->columns != 0)
+    {
+        CHECK(1);
+
+        const unsigned char byte = b->offset[0] & 0xFF;
+        size_t count;
+
+        if ((byte & 0b111) == DT_ARRAY)
+        {
+            CHECK_VARLEN();
+            METADATA_VARLEN_RD(count);
+            CHECK(0);
+        }
+        else if (frame->keys != 0 && byte == (DT_EXTNS | (EXT_NMCOL << 3)))
+        {
+            ++(b->offset);
+            CHECK(1);
+
+            if ((b->offset[0] & 0b111) != DT_BYTES || validate_packed(b, file, checksum, dropped, EXT_NMCOL, &count) == 1)
+                return 1;
+        }
+        else
+        {
+            return 1;
+        }
+
+        if (frame->keys == 0)
+        {
+            if (count != frame->columns)
+                return 1;
+
+            frame->keys = count;
+        }
+        else
+        {
+            if (frame->columns != frame->keys && count != frame->rows)
+                return 1;
+
+            frame->rows = count;
+            --(frame->columns);
+        }
+
+        if ((byte & 0b111) == DT_ARRAY)
+        {
+            *nitems = count;
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
+// Store the innermost container in a new frame to validate the values of a nested one
+#define VAL_FRAMES_PUSH() do { \
+    if (nframes == capacity) \
+    { \
+        val_frame_t *grown = (val_frame_t *)frames_grow(frames, local, &capacity, sizeof(val_frame_t)); \
+        if (grown == NULL) \
+        { \
+            result = -1; \
+            goto done; \
+        } \
+        frames = grown; \
+    } \
+    frames[nframes].left = left; \
+    frames[nframes].end = end; \
+    frames[nframes].columns = SIZE_MAX; \
+    ++nframes; \
+} while (0)
+
+/*  Validate a value and everything nested in it. Lists and dicts are validated with an explicit stack
+ *  holding the number of values left in each, so that deeply nested data can't overflow the C stack.
+ *  Sized lists and dicts are checked to end exactly where their size says they do, and lists of dicts by column to hold
+ *  a list of keys followed by a column of the same number of rows per key.
+ *
+ *  Returns 0 if valid, 1 if invalid or nested deeper than `max_depth`, and -1 if out of memory. This doesn't use the
+ *  Python API, so it can run without holding the GIL.
+ */
+static int _validate(decode_t *b, FILE *file, checksum_t *checksum, size_t *nkeys, size_t *nrefs, const size_t max_depth)
+{
+    val_frame_t local[FRAMES_INITIAL];
+    val_frame_t *frames = local;
+    size_t capacity = FRAMES_INITIAL;
+    size_t nframes = 0;
+
+    // The innermost container, which is only stored in its frame while validating a nested container
+    size_t left = 1;
+    size_t end = SIZE_MAX;
+
+    // Number of bytes dropped from the start of the chunk when reading a file, to get the position in the data
+    size_t start = 0;
+    size_t *dropped = &start;
+
+    int result = 0;
+
+    while (left != 0)
+    {
+        size_t nitems;
+        size_t value_end;
+        const int status = validate_value(b, file, checksum, nkeys, nrefs, &nitems, dropped, &value_end);
+
+        if (status == 1)
+        {
+            result = 1;
+            break;
+        }
+
+        --left;
+
+        if (status >= 2)
+        {
+            if (nframes == max_depth)
+            {
+                result = 1;
+                break;
+            }
+
+            if (nitems != 0)
+            {
+                VAL_FRAMES_PUSH();
+
+                left = nitems;
+                end = value_end;
+
+                if (status == 2)
+                    continue;
+
+                // The list of keys and the columns of lists of dicts by column are started one at a time when leaving it below
+                frames[nframes - 1].columns = nitems - 1;
+                frames[nframes - 1].keys = 0;
+                left = 0;
+            }
+
+            if (value_end != SIZE_MAX && POSITION() != value_end)
+            {
+                result = 1;
+                break;
+            }
+        }
+
+        // Leave the containers of which this was the last value
+        while (left == 0 && nframes != 0)
+        {
+            if (end != SIZE_MAX && POSITION() != end)
+            {
+                result = 1;
+                break;
+            }
+
+            if (frames[nframes - 1].columns != SIZE_MAX)
+            {
+                size_t nvalues;
+                const int next = validate_columns(b, file, checksum, dropped, &frames[nframes - 1], &nvalues);
+
+                if (next == 1 || (next == 2 && nframes == max_depth))
+                {
+                    result = 1;
+                    break;
+                }
+
+                // Enter the next list of keys or column, which can't be sized
+                if (next == 2)
+                {
+                    if (nvalues != 0)
+                    {
+                        VAL_FRAMES_PUSH();
+
+                        left = nvalues;
+                        end = SIZE_MAX;
+                    }
+
+                    continue;
+                }
+            }
+
+            --nframes;
+            left = frames[nframes].left;
+            end = frames[nframes].end;
+        }
+
+        if (result == 1)
+            break;
+    }
+
+    done:
+    FRAMES_FREE(frames, local);
+    return result;
+}
+
+/*  Skip over the value at the offset of `b` and everything nested in it, validating it on the way. This finds where the
+ *  items of lazily decoded containers start without decoding them. Sized lists and dicts are skipped at once instead,
+ *  leaving their items to be validated once they're read. This doesn't use the Python API.
+ *
+ *  Returns the same as `_validate`, or 2 if the value uses the key table or reference table, which only resolve when
+ *  all data before them is decoded.
+ */
+int skip_value(decode_t *b, const size_t max_depth)
+{
+    if (b->max_offset - b->offset > SIZED_PREFIX_SIZE && (b->offset[0] & 0xFF) == SIZED_BYTE && max_depth != 0)
+    {
+        uint32_t size;
+        memcpy(&size, b->offset + 1, SIZED_PREFIX_SIZE - 1);
+        size = LITTLE_32(size);
+
+        char *cont = b->offset + SIZED_PREFIX_SIZE;
+
+        if (size != SIZED_UNKNOWN && size != 0 && size <= (size_t)(b->max_offset - cont) && (cont[0] & 0b110) == 0)
+        {
+            b->offset = cont + size;
+            return 0;
+        }
+    }
+
+    size_t nkeys = 0;
+    size_t nrefs = 0;
+
+    const int result = _validate(b, NULL, NULL, &nkeys, &nrefs, max_depth);
+
+    if (result == 0 && (nkeys != 0 || nrefs != 0))
+        return 2;
+
+    return result;
+}
+
+/*  Decompress the compressed `data`, of which the blocks start at `start`, and validate the result.
+ *  This doesn't use the Python API, so it can run without holding the GIL.
+ *
+ *  Returns the same as `_validate`, where corrupted blocks make the data invalid.
+ */
+static int validate_compressed(decode_t *b, const char *data, const size_t length, const size_t start, size_t *nkeys, size_t *nrefs, const size_t max_depth)
+{
+    char *raw;
+    size_t raw_length;
+
+    const int status = decompress_data(data, length, start, &raw, &raw_length);
+
+    if (status != 0)
+        return status;
+
+    b->base = b->offset = raw;
+    b->max_offset = raw + raw_length;
+
+    const int result = _validate(b, NULL, NULL, nkeys, nrefs, max_depth);
+
+    free(raw);
+    return result;
+}
+
+/*  Validate `length` bytes of encoded `data`, after verifying its checksum and decompressing it if needed.
+ *  This doesn't use the Python API, so it can run without holding the GIL.
+ *
+ *  Returns the same as `_validate`, where data that doesn't match its checksum is invalid.
+ */
+static int validate_data(decode_t *b, const char *data, size_t length, size_t *nkeys, size_t *nrefs, const size_t max_depth)
+{
+    if (length != 0 && (data[0] & 0xFF) == CHECKSUM_BYTE)
+    {
+        if (verify_checksum(data, length) == 1)
+            return 1;
+
+        ++data;
+        length -= CHECKSUM_OVERHEAD;
+    }
+
+    const size_t start = length == 0 ? NO_FRAME : frame_offset(data, length);
+
+    if (start != NO_FRAME)
+        return validate_compressed(b, data, length, start, nkeys, nrefs, max_depth);
+
+    b->base = b->offset = (char *)data;
+    b->max_offset = b->base + length;
+
+    return _validate(b, NULL, NULL, nkeys, nrefs, max_depth);
+}
+
+/*  Validate the data in a file from `file_offset` onwards, reading it in chunks of `chunk_size` bytes.
+ *  The checksum of checksummed data is computed over the chunks as they're read, and compared at the end.
+ *  This doesn't use the Python API, so it can run without holding the GIL.
+ *
+ *  Returns the same as `_validate` (without setting an error), or FILE_OPEN_FAILED or FILE_SEEK_FAILED if the file can't be read.
+ */
+static int validate_file(decode_t *b, const char *filename, const size_t file_offset, const size_t chunk_size, size_t *nkeys, size_t *nrefs, const size_t max_depth)
+{
+    FILE *file = fopen(filename, "rb");
+
+    if (file == NULL)
+        return FILE_OPEN_FAILED;
+
+    if (fseek(file, file_offset, SEEK_SET) != 0)
+    {
+        fclose(file);
+        return FILE_SEEK_FAILED;
+    }
+
+    // Leave room for reading the metadata of a value past the end of the file, which is checked afterwards
+    b->base = b->offset = (char *)malloc(chunk_size + METADATA_LOOKAHEAD);
+
+    if (b->base == NULL)
+    {
+        fclose(file);
+        return -1;
+    }
+
+    const size_t nread = fread(b->base, 1, chunk_size, file);
+    b->max_offset = b->base + nread;
+
+    const int checksummed = nread != 0 && (b->base[0] & 0xFF) == CHECKSUM_BYTE;
+
+    // The file offset of the end of the file
+    long end = 0;
+
+    if (checksummed && (fseek(file, 0, SEEK_END) != 0 || (end = ftell(file)) < 0 || fseek(file, file_offset + nread, SEEK_SET) != 0))
+    {
+        fclose(file);
+        free(b->base);
+        return FILE_SEEK_FAILED;
+    }
+
+    // The blocks of compressed data don't line up with the chunks, so the rest of the file is read and decompressed at once
+    const size_t start = nread <= (size_t)checksummed ? NO_FRAME : frame_offset(b->base + checksummed, nread - checksummed);
+
+    if (start != NO_FRAME)
+    {
+        free(b->base);
+
+        int result;
+        char *data;
+
+        if ((!checksummed && (fseek(file, 0, SEEK_END) != 0 || (end = ftell(file)) < 0)) || fseek(file, file_offset, SEEK_SET) != 0)
+            result = FILE_SEEK_FAILED;
+        else if ((data = (char *)malloc((size_t)end - file_offset)) == NULL)
+            result = -1;
+        else
+        {
+            const size_t length = fread(data, 1, (size_t)end - file_offset, file);
+
+            result = validate_data(b, data, length, nkeys, nrefs, max_depth);
+            free(data);
+        }
+
+        fclose(file);
+        return result;
+    }
+
+    // The checksum covers the data between the checksum byte and the checksum at the end of the file
+    checksum_t checksum = {0, 0};
+
+    if (checksummed)
+    {
+        if ((size_t)end - file_offset <= CHECKSUM_OVERHEAD)
+        {
+            fclose(file);
+            free(b->base);
+            return 1;
+        }
+
+        checksum.remaining = (size_t)end - file_offset - CHECKSUM_OVERHEAD;
+        checksum_update(&checksum, b->base + 1, nread - 1);
+
+        ++(b->offset);
+    }
+
+    int result = _validate(b, file, checksummed ? &checksum : NULL, nkeys, nrefs, max_depth);
+
+    // Do an extra overread check at the end
+    if (result == 0)
+    {
+        // The file offset before the last read
+        const size_t last_offset = ftell(file) - (size_t)(b->max_offset - b->base);
+
+        // The file offset of the end of the data, which is followed by the checksum of checksummed data
+        fseek(file, 0, SEEK_END);
+        const size_t end_offset = ftell(file) - (checksummed ? CHECKSUM_SIZE : 0);
+
+        // Invalid data if we exceeded the highest possible offset (the end of the file)
+        if (last_offset + (size_t)(b->offset - b->base) > end_offset)
+            result = 1;
+        else if (checksummed)
+        {
+            // Checksum the rest of the data that wasn't needed to validate it, followed by reading the checksum itself
+            fseek(file, end_offset - checksum.remaining, SEEK_SET);
+
+            size_t nchunk;
+            while (checksum.remaining != 0 && (nchunk = fread(b->base, 1, chunk_size, file)) != 0)
+                checksum_update(&checksum, b->base, nchunk);
+
+            char stored[CHECKSUM_SIZE];
+
+            if (checksum.remaining != 0 || fseek(file, end_offset, SEEK_SET) != 0 || fread(stored, 1, CHECKSUM_SIZE, file) != CHECKSUM_SIZE ||
+                read_checksum(stored) != checksum.crc)
+                result = 1;
+        }
+    }
+
+    fclose(file);
+    free(b->base);
+
+    return result;
+}
+
 PyObject *validate(PyObject *self, PyObject *args, PyObject *kwargs)
 {
+    module_state_t *state = MODULE_STATE(self);
+
     PyObject *value = NULL;
     char *filename = NULL;
     size_t file_offset = 0;
     size_t chunk_size = 1024*32;
     int err_on_invalid = 0;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *py_offset = NULL;
+    PyObject *py_length = NULL;
 
-    static char *kwlist[] = {"value", "file_name", "file_offset", "chunk_size", "err_on_invalid", NULL};
+    static char *kwlist[] = {"value", "file_name", "file_offset", "chunk_size", "err_on_invalid", "max_depth", "offset", "length", NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O!siii", kwlist, &PyBytes_Type, &value, &filename, (Py_ssize_t *)(&file_offset), (Py_ssize_t *)(&chunk_size), &err_on_invalid))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OsiiinOO", kwlist, &value, &filename, (Py_ssize_t *)(&file_offset), (Py_ssize_t *)(&chunk_size), &err_on_invalid, &max_depth, &py_offset, &py_length))
         return NULL;
 
-    decode_t b;
+    if (max_depth < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "The maximum depth cannot be negative");
+        return NULL;
+    }
 
-    int result;
-    if (value != NULL)
+    if (value == NULL && filename != NULL && (py_offset != NULL || py_length != NULL))
     {
-        PyBytes_AsStringAndSize(value, &b.base, (Py_ssize_t *)&b.max_offset);
+        PyErr_SetString(PyExc_ValueError, "The 'offset' and 'length' arguments can only be used with the 'encoded' argument");
+        return NULL;
+    }
 
-        b.offset = b.base;
-        b.max_offset += (size_t)b.base;
+    decode_t b;
+    size_t nkeys = 0;
+    size_t nrefs = 0;
 
-        result = _validate(&b, NULL);
-    }
-    else if (filename != NULL)
+    int result;
+    if (value != NULL)
     {
-        FILE *file = fopen(filename, "rb");
+        // Any C-contiguous buffer can be validated, of which the part from `offset` up to `length` bytes is used
+        Py_buffer view;
+        Py_ssize_t offset = 0;
+        Py_ssize_t length = -1;
 
-        if (file == NULL)
-        {
-            PyErr_Format(PyExc_FileNotFoundError, "Unable to open file '%s'", filename);
+        if (py_offset != NULL && (offset = PyLong_AsSsize_t(py_offset)) == -1 && PyErr_Occurred())
             return NULL;
-        }
 
-        if (fseek(file, file_offset, SEEK_SET) != 0)
-        {
-            PyErr_Format(FileOffsetError, "Unable to find position %zu of file '%s'", file_offset, filename);
+        if (py_length != NULL && py_length != Py_None && (length = PyLong_AsSsize_t(py_length)) == -1 && PyErr_Occurred())
             return NULL;
-        }
 
-        b.base = b.offset = (char *)malloc(chunk_size);
+        if (PyObject_GetBuffer(value, &view, PyBUF_SIMPLE) != 0)
+            return NULL;
 
-        if (b.base == NULL)
+        if (offset < 0 || offset > view.len || length < -1 || (length != -1 && length > view.len - offset))
         {
-            PyErr_NoMemory();
-            fclose(file);
+            PyErr_Format(PyExc_ValueError, "The offset and length have to lie within the buffer of %zi bytes", view.len);
+            PyBuffer_Release(&view);
             return NULL;
         }
 
-        b.max_offset = b.base + fread(b.base, 1, chunk_size, file);
+        const char *data = (const char *)view.buf + offset;
+        const size_t size = length != -1 ? (size_t)length : (size_t)(view.len - offset);
 
-        result = _validate(&b, file);
+        /*  The buffer stays exported to us until it's released, so the object can't resize or free it and the GIL doesn't
+         *  have to be held while scanning it. Releasing it isn't free though, so only do so if there's enough data for it to pay off.
+         */
+        PyThreadState *tstate = size >= GIL_RELEASE_MIN_SIZE ? PyEval_SaveThread() : NULL;
 
-        // Do an extra overread check at the end
-        if (result == 0)
-        {
-            // The file offset before the last read
-            const size_t last_offset = ftell(file) - (size_t)(b.max_offset - b.base);
+        result = validate_data(&b, data, size, &nkeys, &nrefs, (size_t)max_depth);
 
-            // The file offset of the end of the file
-            fseek(file, 0, SEEK_END);
-            const size_t end_offset = ftell(file);
+        if (tstate != NULL)
+            PyEval_RestoreThread(tstate);
 
-            // Invalid data if we exceeded the highest possible offset (the end of the file)
-            if (last_offset + (size_t)(b.offset - b.base) > end_offset)
-                result = 1;
-        }
+        PyBuffer_Release(&view);
+    }
+    else if (filename != NULL)
+    {
+        // Validating a file doesn't touch any Python objects, so let other threads run meanwhile
+        Py_BEGIN_ALLOW_THREADS
+        result = validate_file(&b, filename, file_offset, chunk_size, &nkeys, &nrefs, (size_t)max_depth);
+        Py_END_ALLOW_THREADS
 
-        fclose(file);
-        free(b.base);
+        if (result == FILE_OPEN_FAILED)
+        {
+            PyErr_Format(PyExc_FileNotFoundError, "Unable to open file '%s'", filename);
+            return NULL;
+        }
+        else if (result == FILE_SEEK_FAILED)
+        {
+            PyErr_Format(state->file_offset_error, "Unable to find position %zu of file '%s'", file_offset, filename);
+            return NULL;
+        }
     }
     else
     {
@@ -169,13 +847,17 @@ PyObject *validate(PyObject *self, PyObject *args, PyObject *kwargs)
         return NULL;
     }
 
+    // Ran out of memory
+    if (result == -1)
+        return PyErr_NoMemory();
+
     if (result == 0)
         Py_RETURN_TRUE;
     else if (err_on_invalid == 0)
         Py_RETURN_FALSE;
     else
     {
-        PyErr_SetString(ValidationError, "The received object does not appear to be valid");
+        PyErr_SetString(state->validation_error, "The received object does not appear to be valid");
         return NULL;
     }
 }
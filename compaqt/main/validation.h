@@ -2,6 +2,9 @@
 #define VALIDATION_H
 
 #include <Python.h>
+#include "globals/typedefs.h"
+
+int skip_value(decode_t *b, const size_t max_depth);
 
 PyObject *validate(PyObject *self, PyObject *args, PyObject *kwargs);
 
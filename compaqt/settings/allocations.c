@@ -1,11 +1,33 @@
 #include <Python.h>
+#include <math.h>
+#include "globals/typedefs.h"
+#include "globals/internals.h"
+#include "globals/atomics.h"
+#include "globals/modstate.h"
 
 #define AVG_REALLOC_MIN 64
 #define AVG_ITEM_MIN 4
 
-size_t avg_item_size = 12;
-size_t avg_realloc_size = 128;
-int dynamic_allocation_tweaks = 1;
+/*  Allocation sizes tweaked by the values encoded on this thread. These are kept per thread,
+ *  so that the values encoded by one thread don't tweak the sizes used by others.
+ *  They belong to the module state they were seeded from, as each interpreter has its own settings.
+ */
+static THREAD_LOCAL allocdata_t thread_allocs;
+static THREAD_LOCAL const module_state_t *thread_allocs_state = NULL;
+static THREAD_LOCAL size_t thread_allocs_version = 0;
+
+// Set the default allocation settings in the module state
+void setup_allocation_settings(module_state_t *state)
+{
+    state->allocdata.item_size = 12;
+    state->allocdata.realloc_size = 128;
+    state->allocdata_version = 1;
+    state->dynamic_allocation_tweaks = 1;
+
+    // Geometric growth of encode buffers, so that large payloads don't get re-allocated for every `realloc_size` bytes
+    state->realloc_growth_factor = 1.5;
+    state->realloc_growth_cap = 1024*1024*256;
+}
 
 // Function to set manual allocation settings
 PyObject *manual_allocations(PyObject *self, PyObject *args)
@@ -22,9 +44,12 @@ PyObject *manual_allocations(PyObject *self, PyObject *args)
         return NULL;
     }
 
-    dynamic_allocation_tweaks = 0;
-    avg_item_size = (size_t)item_size;
-    avg_realloc_size = (size_t)realloc_size;
+    module_state_t *state = MODULE_STATE(self);
+
+    state->dynamic_allocation_tweaks = 0;
+    ATOMIC_STORE_SIZE(&state->allocdata.item_size, (size_t)item_size);
+    ATOMIC_STORE_SIZE(&state->allocdata.realloc_size, (size_t)realloc_size);
+    ATOMIC_INCREMENT(&state->allocdata_version);
 
     Py_RETURN_NONE;
 }
@@ -46,27 +71,97 @@ PyObject *dynamic_allocations(PyObject *self, PyObject *args, PyObject *kwargs)
         return NULL;
     }
 
-    dynamic_allocation_tweaks = 1;
+    module_state_t *state = MODULE_STATE(self);
+
+    state->dynamic_allocation_tweaks = 1;
 
     if (item_size != 0)
-        avg_item_size = (size_t)item_size;
+        ATOMIC_STORE_SIZE(&state->allocdata.item_size, (size_t)item_size);
     if (realloc_size != 0)
-        avg_realloc_size = (size_t)realloc_size;
+        ATOMIC_STORE_SIZE(&state->allocdata.realloc_size, (size_t)realloc_size);
+
+    ATOMIC_INCREMENT(&state->allocdata_version);
+
+    Py_RETURN_NONE;
+}
+
+// Function to set the buffer growth settings
+PyObject *buffer_growth(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    module_state_t *state = MODULE_STATE(self);
+
+    double factor = ATOMIC_LOAD_DOUBLE(&state->realloc_growth_factor);
+    Py_ssize_t cap = (Py_ssize_t)ATOMIC_LOAD_SIZE(&state->realloc_growth_cap);
+
+    static char *kwlist[] = {"factor", "cap", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|dn", kwlist, &factor, &cap))
+        return NULL;
+
+    // NaN and infinite factors can't be converted to a buffer size
+    if (!(factor >= 1.0) || !isfinite(factor))
+    {
+        PyErr_SetString(PyExc_ValueError, "The growth factor must be a finite number of at least 1.0");
+        return NULL;
+    }
+
+    if (cap <= 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Size values must be larger than zero");
+        return NULL;
+    }
+
+    ATOMIC_STORE_DOUBLE(&state->realloc_growth_factor, factor);
+    ATOMIC_STORE_SIZE(&state->realloc_growth_cap, (size_t)cap);
 
     Py_RETURN_NONE;
 }
 
-void update_allocation_settings(const int reallocs, const size_t offset, const size_t initial_allocated, const size_t nitems)
+// Get the allocation sizes of the current thread, which start out as the module settings whenever those change
+allocdata_t *thread_allocdata(module_state_t *state)
+{
+    const size_t version = ATOMIC_LOAD_SIZE(&state->allocdata_version);
+
+    if (thread_allocs_state != state || thread_allocs_version != version)
+    {
+        thread_allocs.item_size = ATOMIC_LOAD_SIZE(&state->allocdata.item_size);
+        thread_allocs.realloc_size = ATOMIC_LOAD_SIZE(&state->allocdata.realloc_size);
+        thread_allocs_state = state;
+        thread_allocs_version = version;
+    }
+
+    return &thread_allocs;
+}
+
+// Get the new size of a buffer that needs to hold at least `needed` bytes
+size_t grown_buffer_size(const module_state_t *state, const allocdata_t *allocs, const size_t curr_length, const size_t needed)
+{
+    // Grow by the factor, but never by more than the cap at once
+    size_t growth = (size_t)((double)curr_length * (ATOMIC_LOAD_DOUBLE((double *)&state->realloc_growth_factor) - 1.0));
+    const size_t cap = ATOMIC_LOAD_SIZE((size_t *)&state->realloc_growth_cap);
+
+    if (growth > cap)
+        growth = cap;
+
+    const size_t grown = curr_length + growth;
+    const size_t minimum = needed + allocs->realloc_size;
+
+    return grown > minimum ? grown : minimum;
+}
+
+void update_allocation_settings(const module_state_t *state, allocdata_t *allocs, const int reallocs, const size_t offset, const size_t initial_allocated, const size_t nitems)
 {
-    if (dynamic_allocation_tweaks == 1)
+    if (state->dynamic_allocation_tweaks == 1)
     {
-        if (reallocs != 0)
+        // The offset can exceed the initial allocation without re-allocating if the buffer was larger already
+        if (reallocs != 0 || offset > initial_allocated)
         {
-            const size_t difference = offset - initial_allocated;
+            // Re-allocations can happen while staying below the initial allocation due to the headroom of offset checks
+            const size_t difference = (offset > initial_allocated ? offset - initial_allocated : 0) + AVG_REALLOC_MIN;
             const size_t med_diff = difference / (nitems + 1);
 
-            avg_realloc_size += difference >> 1;
-            avg_item_size += med_diff >> 1;
+            allocs->realloc_size += difference >> 1;
+            allocs->item_size += med_diff >> 1;
         }
         else
         {
@@ -75,15 +170,15 @@ void update_allocation_settings(const int reallocs, const size_t offset, const s
             const size_t diff_small = difference >> 4;
             const size_t med_small = med_diff >> 5;
 
-            if (diff_small + AVG_REALLOC_MIN < avg_realloc_size)
-                avg_realloc_size -= diff_small;
+            if (diff_small + AVG_REALLOC_MIN < allocs->realloc_size)
+                allocs->realloc_size -= diff_small;
             else
-                avg_realloc_size = AVG_REALLOC_MIN;
+                allocs->realloc_size = AVG_REALLOC_MIN;
 
-            if (med_small + AVG_ITEM_MIN < avg_item_size)
-                avg_item_size -= med_small;
+            if (med_small + AVG_ITEM_MIN < allocs->item_size)
+                allocs->item_size -= med_small;
             else
-                avg_item_size = AVG_ITEM_MIN;
+                allocs->item_size = AVG_ITEM_MIN;
         }
     }
 }
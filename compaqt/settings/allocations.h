@@ -2,14 +2,18 @@
 #define ALLOCATIONS_H
 
 #include <Python.h>
+#include "globals/typedefs.h"
 
-extern size_t avg_item_size;
-extern size_t avg_realloc_size;
-extern int dynamic_allocation_tweaks;
+void setup_allocation_settings(module_state_t *state);
 
 PyObject *manual_allocations(PyObject *self, PyObject *args);
 PyObject *dynamic_allocations(PyObject *self, PyObject *args, PyObject *kwargs);
+PyObject *buffer_growth(PyObject *self, PyObject *args, PyObject *kwargs);
 
-void update_allocation_settings(const int reallocs, const size_t offset, const size_t initial_allocated, const size_t nitems);
+allocdata_t *thread_allocdata(module_state_t *state);
+
+size_t grown_buffer_size(const module_state_t *state, const allocdata_t *allocs, const size_t curr_length, const size_t needed);
+
+void update_allocation_settings(const module_state_t *state, allocdata_t *allocs, const int reallocs, const size_t offset, const size_t initial_allocated, const size_t nitems);
 
 #endif // ALLOCATIONS_H
\ No newline at end of file
@@ -3,17 +3,30 @@
 
 #include <Python.h>
 
+#include "main/filemap.h"
+
+#include "globals/atomics.h"
+#include "globals/typedefs.h"
+
+// Free, release or unmap the data held by a reference buffer, depending on its kind
+static inline void release_bufd_data(bufdata_t *bufd)
+{
+    if (bufd->kind == BUFD_BUFFER)
+        PyBuffer_Release(&bufd->view);
+    else if (bufd->kind == BUFD_MAPPED)
+        unmap_file((char *)bufd->base, bufd->size);
+    else
+        free(bufd->base);
+}
+
 #define INCREF_BUFD(bufd) do { \
-    ++((bufd)->refcnt); \
+    ATOMIC_INCREMENT(&(bufd)->refcnt); \
 } while (0)
 
 #define DECREF_BUFD(bufd) do { \
-    if (--((bufd)->refcnt) == 0) \
+    if (ATOMIC_DECREMENT(&(bufd)->refcnt) == 0) \
     { \
-        if ((bufd)->is_PyOb == 1) \
-            Py_DECREF((bufd)->base); \
-        else \
-            free((bufd)->base); \
+        release_bufd_data(bufd); \
         PyObject_Free(bufd); \
     } \
 } while (0)
@@ -2,6 +2,8 @@
 #include "globals/typedefs.h"
 #include "types/base.h"
 
+#include "globals/modstate.h"
+
 // Custom bytes object
 typedef struct {
     PyObject_HEAD
@@ -10,7 +12,10 @@ typedef struct {
     Py_ssize_t len;
 } cbytes_ob;
 
-PyTypeObject cbytes_t;
+void cbytes_dealloc(cbytes_ob *ob);
+
+// Check if an object is a Compaqt bytes, of the type created by any interpreter
+#define CBYTES_CHECK(ob) (Py_TYPE(ob)->tp_dealloc == (destructor)cbytes_dealloc)
 
 static PyObject *cbytes_concat(cbytes_ob *ob, PyObject *args)
 {
@@ -30,7 +35,7 @@ static PyObject *cbytes_concat(cbytes_ob *ob, PyObject *args)
     {
         PyBytes_AsStringAndSize(other, &other_data, &other_len);
     }
-    else if (other_tp == &cbytes_t)
+    else if (CBYTES_CHECK(other))
     {
         cbytes_ob *other_ob = (cbytes_ob *)other;
 
@@ -60,27 +65,45 @@ static PyMethodDef cbytes_methods[] = {
     {NULL, NULL, 0, NULL}
 };
 
+// Expose the referenced data as a read-only buffer, which keeps the reference buffer alive through this object
+static int cbytes_getbuffer(cbytes_ob *ob, Py_buffer *view, int flags)
+{
+    return PyBuffer_FillInfo(view, (PyObject *)ob, ob->data, ob->len, 1, flags);
+}
+
+// Buffer functions, which are set after creating the type on versions that don't support them in type specs
+PyBufferProcs cbytes_as_buffer = {
+    .bf_getbuffer = (getbufferproc)cbytes_getbuffer,
+};
+
 void cbytes_dealloc(cbytes_ob *ob)
 {
+    PyTypeObject *type = Py_TYPE(ob);
+
     DECREF_BUFD(ob->bufd);
-    PyObject_Del(ob);
+    type->tp_free((PyObject *)ob);
+    HEAPTYPE_DECREF(type);
 }
 
-PyTypeObject cbytes_t = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "compaqt.bytes",
-    .tp_basicsize = sizeof(cbytes_ob),
-    .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_methods = cbytes_methods,
-    .tp_new = PyType_GenericNew,
-    .tp_alloc = PyType_GenericAlloc,
-    .tp_dealloc = (destructor)cbytes_dealloc,
-    .tp_free = PyObject_Del
+static PyType_Slot cbytes_slots[] = {
+    {Py_tp_methods, cbytes_methods},
+    {Py_tp_dealloc, (destructor)cbytes_dealloc},
+    #ifdef Py_bf_getbuffer
+    {Py_bf_getbuffer, (getbufferproc)cbytes_getbuffer},
+    #endif
+    {0, NULL}
+};
+
+PyType_Spec cbytes_spec = {
+    .name = "compaqt.bytes",
+    .basicsize = sizeof(cbytes_ob),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    .slots = cbytes_slots,
 };
 
-PyObject *cbytes_create(bufdata_t *bufd, const char *data, const Py_ssize_t len)
+PyObject *cbytes_create(module_state_t *state, bufdata_t *bufd, const char *data, const Py_ssize_t len)
 {
-    cbytes_ob *ob = PyObject_New(cbytes_ob, &cbytes_t);
+    cbytes_ob *ob = PyObject_New(cbytes_ob, state->cbytes_type);
 
     if (ob == NULL)
         return PyErr_NoMemory();
@@ -12,8 +12,9 @@ typedef struct {
     Py_ssize_t len;
 } cbytes_ob;
 
-extern PyTypeObject cbytes_t;
+extern PyType_Spec cbytes_spec;
+extern PyBufferProcs cbytes_as_buffer;
 
-PyObject *cbytes_create(bufdata_t *bufd, const char *data, const Py_ssize_t len);
+PyObject *cbytes_create(module_state_t *state, bufdata_t *bufd, const char *data, const Py_ssize_t len);
 
 #endif // CBYTES_H
\ No newline at end of file
@@ -3,7 +3,7 @@
 #include "types/strdata.h"
 #include "types/base.h"
 
-#include "globals/exceptions.h"
+#include "globals/modstate.h"
 
 // Custom string object
 typedef struct {
@@ -17,7 +17,10 @@ typedef struct {
 // Check if a cstr is ASCII by comparing the total length to the number of codepoints
 #define IS_ASCII(ob) (ob->len == ob->codepoints)
 
-PyTypeObject cstr_t;
+void cstr_dealloc(cstr_ob *ob);
+
+// Check if an object is a Compaqt string, of the type created by any interpreter
+#define CSTR_CHECK(ob) (Py_TYPE(ob)->tp_dealloc == (destructor)cstr_dealloc)
 
 static inline int get_ob_data(PyObject *self, char **data, Py_ssize_t *len)
 {
@@ -30,7 +33,7 @@ static inline int get_ob_data(PyObject *self, char **data, Py_ssize_t *len)
         if (data == NULL)
             return 1;
     }
-    else if (other_tp == &cstr_t)
+    else if (CSTR_CHECK(self))
     {
         cstr_ob *ob = (cstr_ob *)self;
 
@@ -178,7 +181,7 @@ static int cstr_getbuffer(PyObject *self, Py_buffer *buf, int flags)
     buf->suboffsets = NULL;
     buf->internal = (void *)ob->bufd;
 
-    ob->bufd->refcnt++;
+    INCREF_BUFD(ob->bufd);
 
     return 0;
 }
@@ -272,59 +275,58 @@ static PyMethodDef cstr_methods[] = {
     {NULL, NULL, 0, NULL}
 };
 
-static PySequenceMethods cstr_assequence = {
-    .sq_length = (lenfunc)cstr_len,
-    .sq_item = (ssizeargfunc)cstr_getitem,
-};
-
-static PyNumberMethods cstr_asnumber = {
-    .nb_add = (binaryfunc)cstr_add,
-    .nb_multiply = (binaryfunc)cstr_mul,
-};
-
-static PyBufferProcs cstr_asbuffer = {
+// Buffer functions, which are set after creating the type on versions that don't support them in type specs
+PyBufferProcs cstr_asbuffer = {
     .bf_getbuffer = cstr_getbuffer,
     .bf_releasebuffer = cstr_releasebuffer,
 };
 
 void cstr_dealloc(cstr_ob *ob)
 {
+    PyTypeObject *type = Py_TYPE(ob);
+
     DECREF_BUFD(ob->bufd);
-    PyObject_Del(ob);
+    type->tp_free((PyObject *)ob);
+    HEAPTYPE_DECREF(type);
 }
 
-PyTypeObject cstr_t = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "compaqt.str",
-    .tp_doc = "a string object referencing a buffer of another object",
-    .tp_basicsize = sizeof(cstr_ob),
-    .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_new = PyType_GenericNew,
-    .tp_alloc = PyType_GenericAlloc,
-    .tp_dealloc = (destructor)cstr_dealloc,
-    .tp_free = PyObject_Del,
-    .tp_str = (reprfunc)cstr_str,
-    .tp_repr = (reprfunc)cstr_str,
-    .tp_hash = (hashfunc)cstr_hash,
-    .tp_methods = cstr_methods,
-    .tp_richcompare = (richcmpfunc)cstr_richcompare,
-    .tp_as_sequence = &cstr_assequence,
-    .tp_as_number = &cstr_asnumber,
-    .tp_as_buffer = &cstr_asbuffer,
-    .tp_itemsize = sizeof(cstr_ob),
+static PyType_Slot cstr_slots[] = {
+    {Py_tp_doc, "a string object referencing a buffer of another object"},
+    {Py_tp_dealloc, (destructor)cstr_dealloc},
+    {Py_tp_str, (reprfunc)cstr_str},
+    {Py_tp_repr, (reprfunc)cstr_str},
+    {Py_tp_hash, (hashfunc)cstr_hash},
+    {Py_tp_methods, cstr_methods},
+    {Py_tp_richcompare, (richcmpfunc)cstr_richcompare},
+    {Py_sq_length, (lenfunc)cstr_len},
+    {Py_sq_item, (ssizeargfunc)cstr_getitem},
+    {Py_nb_add, (binaryfunc)cstr_add},
+    {Py_nb_multiply, (binaryfunc)cstr_mul},
+    #ifdef Py_bf_getbuffer
+    {Py_bf_getbuffer, cstr_getbuffer},
+    {Py_bf_releasebuffer, cstr_releasebuffer},
+    #endif
+    {0, NULL}
+};
+
+PyType_Spec cstr_spec = {
+    .name = "compaqt.str",
+    .basicsize = sizeof(cstr_ob),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    .slots = cstr_slots,
 };
 
-PyObject *cstr_create(bufdata_t *bufd, char *data, Py_ssize_t len)
+PyObject *cstr_create(module_state_t *state, bufdata_t *bufd, char *data, Py_ssize_t len)
 {
     Py_ssize_t codepoints = utf8_codepoints(data, len);
 
     if (codepoints == -1)
     {
-        PyErr_SetString(DecodingError, "Found a string object with invalid UTF-8 data");
+        PyErr_SetString(state->decoding_error, "Found a string object with invalid UTF-8 data");
         return NULL;
     }
 
-    cstr_ob *ob = PyObject_New(cstr_ob, &cstr_t);
+    cstr_ob *ob = PyObject_New(cstr_ob, state->cstr_type);
 
     if (ob == NULL)
         return PyErr_NoMemory();
@@ -13,8 +13,9 @@ typedef struct {
     Py_ssize_t codepoints;
 } cstr_ob;
 
-extern PyTypeObject cstr_t;
+extern PyType_Spec cstr_spec;
+extern PyBufferProcs cstr_asbuffer;
 
-PyObject *cstr_create(bufdata_t *bufd, char *data, Py_ssize_t len);
+PyObject *cstr_create(module_state_t *state, bufdata_t *bufd, char *data, Py_ssize_t len);
 
 #endif // CSTR_H
\ No newline at end of file
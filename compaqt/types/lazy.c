@@ -0,0 +1,722 @@
+// This file contains the lazily decoded list and dict types, which decode their items only once they're accessed
+
+#include <Python.h>
+
+#include "types/lazy.h"
+#include "types/base.h"
+
+#include "main/serialization.h"
+#include "main/validation.h"
+
+#include "globals/typemasks.h"
+#include "globals/typedefs.h"
+#include "globals/framestack.h"
+#include "globals/modstate.h"
+
+/*  Items are decoded from the buffer when they're accessed, and kept afterwards so that accessing them again returns the
+ *  same object. Nested lists and dicts are decoded lazily as well. The offsets of the items are found by skipping over the
+ *  ones before them with the validation logic, which doesn't create any objects.
+ */
+
+// Free-threaded builds lock the object while finding and decoding items, as that fills in its tables
+#ifdef Py_GIL_DISABLED
+    #define LAZY_LOCK(ob) Py_BEGIN_CRITICAL_SECTION(ob)
+    #define LAZY_UNLOCK() Py_END_CRITICAL_SECTION()
+#else
+    #define LAZY_LOCK(ob) {
+    #define LAZY_UNLOCK() }
+#endif
+
+typedef struct {
+    PyObject_HEAD
+    bufdata_t *bufd;          // Reference buffer holding the encoded data, which is kept alive by this object.
+    PyObject *module;         // The module, of which the state holds the types and exceptions used for decoding.
+    utypes_decode_ob *utypes; // Custom types to decode the items with. Is NULL if not used.
+    char *base;               // Start of the metadata of the container, or of its size if it's sized.
+    char *start;              // Start of the first item (the first key for dicts).
+    char *end;                // End of the container if it's sized, the end of the encoded data otherwise.
+    size_t nitems;            // Number of items (pairs for dicts).
+    size_t max_depth;         // Number of container levels that can still be nested within the items.
+    int referenced;           // Whether strings and bytes are decoded as objects referencing the buffer.
+    char **offsets;           // Offsets of the items (the values for dicts). Is NULL until an item is accessed.
+    size_t nfound;            // Number of items of which the offset is found, for lists.
+    PyObject **items;         // Decoded items (values for dicts), which are NULL until they're decoded.
+    PyObject *index;          // Dict mapping the keys of a dict to their position. Is NULL until a key is looked up.
+} lazy_ob;
+
+static int overread_check(decode_t *b, const size_t length)
+{
+    if (b->offset > b->max_offset || (size_t)(b->max_offset - b->offset) < length)
+    {
+        PyErr_SetString(b->state->decoding_error, "Received invalid or corrupted bytes");
+        return 1;
+    }
+
+    return 0;
+}
+
+// Set up `b` for decoding the value at `offset`
+static void init_decode(lazy_ob *ob, decode_t *b, char *offset, const int referenced)
+{
+    b->base = b->offset = offset;
+    b->max_offset = ob->end;
+    b->bufd = referenced == 1 ? ob->bufd : NULL;
+    b->bufcheck = (bufcheck_t)overread_check;
+    b->utypes = ob->utypes;
+    b->keys = NULL;
+    b->max_depth = ob->max_depth;
+    b->refs = NULL;
+    b->state = MODULE_STATE(ob->module);
+    b->dropped = 0;
+}
+
+// Skip over the value at `*offset`, setting it to the end of the value. Returns 1 with an error set if the value is invalid
+static int skip_item(lazy_ob *ob, char **offset)
+{
+    decode_t b;
+    init_decode(ob, &b, *offset, 0);
+
+    const int status = skip_value(&b, ob->max_depth);
+
+    if (status == 0)
+    {
+        *offset = b.offset;
+        return 0;
+    }
+
+    if (status == -1)
+        PyErr_NoMemory();
+    else if (status == 2)
+        PyErr_SetString(b.state->decoding_error, "Data encoded with a key table or preserved references can't be decoded lazily");
+    else
+        PyErr_SetString(b.state->decoding_error, "Received invalid or corrupted bytes");
+
+    return 1;
+}
+
+// Decode the value at `offset`, as a lazily decoded container if it's a list or dict
+static PyObject *decode_item(lazy_ob *ob, char *offset, const int referenced)
+{
+    if (offset < ob->end && IS_LAZY_CONTAINER(offset[0] & 0xFF))
+        return lazy_create(ob->module, ob->bufd, ob->utypes, offset, ob->end, ob->max_depth, ob->referenced);
+
+    // Other values are validated first, so that they're rejected the same way as when skipping over them
+    char *value_end = offset;
+
+    if (skip_item(ob, &value_end) == 1)
+        return NULL;
+
+    decode_t b;
+    init_decode(ob, &b, offset, referenced);
+
+    return decode_bytes(&b);
+}
+
+// Allocate the tables holding the offsets and decoded items, which are set up on the first access
+static int alloc_tables(lazy_ob *ob)
+{
+    ob->offsets = (char **)malloc(ob->nitems * sizeof(char *));
+    ob->items = (PyObject **)calloc(ob->nitems, sizeof(PyObject *));
+
+    if (ob->offsets == NULL || ob->items == NULL)
+    {
+        free(ob->offsets);
+        free(ob->items);
+
+        ob->offsets = NULL;
+        ob->items = NULL;
+
+        PyErr_NoMemory();
+        return 1;
+    }
+
+    return 0;
+}
+
+// Get the item at `idx`, decoding it if it's not decoded yet. The offset of the item has to be found already
+static PyObject *get_item(lazy_ob *ob, const size_t idx)
+{
+    if (ob->items[idx] == NULL)
+    {
+        PyObject *item = decode_item(ob, ob->offsets[idx], ob->referenced);
+
+        if (item == NULL)
+            return NULL;
+
+        // Custom types run Python code while decoding, which could have decoded the item already
+        if (ob->items[idx] != NULL)
+            Py_DECREF(item);
+        else
+            ob->items[idx] = item;
+    }
+
+    Py_INCREF(ob->items[idx]);
+    return ob->items[idx];
+}
+
+// Decode the entire container at once, including everything nested in it
+static PyObject *lazy_materialize(lazy_ob *ob, PyObject *Py_UNUSED(ignored))
+{
+    decode_t b;
+    init_decode(ob, &b, ob->base, ob->referenced);
+
+    // The container itself was already entered when creating this object
+    ++b.max_depth;
+
+    PyObject *result = decode_bytes(&b);
+    Py_XDECREF(b.keys);
+    Py_XDECREF(b.refs);
+
+    return result;
+}
+
+// Compare as the decoded container, also when comparing with another lazily decoded container
+static PyObject *lazy_richcompare(lazy_ob *ob, PyObject *other, int op)
+{
+    PyObject *value = lazy_materialize(ob, NULL);
+
+    if (value == NULL)
+        return NULL;
+
+    if (Py_TYPE(other)->tp_richcompare == (richcmpfunc)lazy_richcompare)
+        other = lazy_materialize((lazy_ob *)other, NULL);
+    else
+        Py_INCREF(other);
+
+    if (other == NULL)
+    {
+        Py_DECREF(value);
+        return NULL;
+    }
+
+    PyObject *result = PyObject_RichCompare(value, other, op);
+
+    Py_DECREF(value);
+    Py_DECREF(other);
+
+    return result;
+}
+
+static PyObject *lazy_repr(lazy_ob *ob)
+{
+    return PyUnicode_FromFormat("<%s of %zu %s>", Py_TYPE(ob)->tp_name, ob->nitems, Py_TYPE(ob)->tp_as_sequence->sq_item != NULL ? "items" : "pairs");
+}
+
+static Py_ssize_t lazy_len(lazy_ob *ob)
+{
+    return (Py_ssize_t)ob->nitems;
+}
+
+static void lazy_dealloc(lazy_ob *ob)
+{
+    PyTypeObject *type = Py_TYPE(ob);
+
+    if (ob->items != NULL)
+    {
+        for (size_t i = 0; i < ob->nitems; ++i)
+            Py_XDECREF(ob->items[i]);
+
+        free(ob->items);
+    }
+
+    free(ob->offsets);
+    Py_XDECREF(ob->index);
+    Py_XDECREF((PyObject *)ob->utypes);
+    Py_DECREF(ob->module);
+    DECREF_BUFD(ob->bufd);
+
+    type->tp_free((PyObject *)ob);
+    HEAPTYPE_DECREF(type);
+}
+
+/* LAZY LIST */
+
+// Find the offsets of the items up to the one at `idx`, by skipping over the ones before it
+static int find_offsets(lazy_ob *ob, const size_t idx)
+{
+    if (ob->nfound == 0)
+    {
+        ob->offsets[0] = ob->start;
+        ob->nfound = 1;
+    }
+
+    while (ob->nfound <= idx)
+    {
+        char *offset = ob->offsets[ob->nfound - 1];
+
+        if (skip_item(ob, &offset) == 1)
+            return 1;
+
+        ob->offsets[ob->nfound++] = offset;
+    }
+
+    return 0;
+}
+
+static PyObject *lazy_list_item(lazy_ob *ob, Py_ssize_t idx)
+{
+    if (idx < 0 || (size_t)idx >= ob->nitems)
+    {
+        PyErr_SetString(PyExc_IndexError, "list index out of range");
+        return NULL;
+    }
+
+    PyObject *item = NULL;
+
+    LAZY_LOCK(ob);
+
+    if ((ob->items != NULL || alloc_tables(ob) == 0) && find_offsets(ob, (size_t)idx) == 0)
+        item = get_item(ob, (size_t)idx);
+
+    LAZY_UNLOCK();
+
+    return item;
+}
+
+static PyObject *lazy_list_subscript(lazy_ob *ob, PyObject *key)
+{
+    if (PyIndex_Check(key))
+    {
+        Py_ssize_t idx = PyNumber_AsSsize_t(key, PyExc_IndexError);
+
+        if (idx == -1 && PyErr_Occurred())
+            return NULL;
+
+        if (idx < 0)
+            idx += (Py_ssize_t)ob->nitems;
+
+        return lazy_list_item(ob, idx);
+    }
+
+    if (PySlice_Check(key))
+    {
+        Py_ssize_t start, stop, step;
+
+        if (PySlice_Unpack(key, &start, &stop, &step) != 0)
+            return NULL;
+
+        const Py_ssize_t length = PySlice_AdjustIndices((Py_ssize_t)ob->nitems, &start, &stop, step);
+        PyObject *list = PyList_New(length);
+
+        if (list == NULL)
+            return NULL;
+
+        for (Py_ssize_t i = 0; i < length; ++i)
+        {
+            PyObject *item = lazy_list_item(ob, start + i * step);
+
+            if (item == NULL)
+            {
+                Py_DECREF(list);
+                return NULL;
+            }
+
+            PyList_SET_ITEM(list, i, item);
+        }
+
+        return list;
+    }
+
+    PyErr_Format(PyExc_TypeError, "list indices must be integers or slices, not %s", Py_TYPE(key)->tp_name);
+    return NULL;
+}
+
+static PyMethodDef lazy_list_methods[] = {
+    {"materialize", (PyCFunction)lazy_materialize, METH_NOARGS, NULL},
+
+    {NULL, NULL, 0, NULL}
+};
+
+static PyType_Slot lazy_list_slots[] = {
+    {Py_tp_doc, "a list that decodes its items once they're accessed"},
+    {Py_tp_dealloc, (destructor)lazy_dealloc},
+    {Py_tp_repr, (reprfunc)lazy_repr},
+    {Py_tp_hash, PyObject_HashNotImplemented},
+    {Py_tp_richcompare, (richcmpfunc)lazy_richcompare},
+    {Py_tp_methods, lazy_list_methods},
+    {Py_sq_length, (lenfunc)lazy_len},
+    {Py_sq_item, (ssizeargfunc)lazy_list_item},
+    {Py_mp_length, (lenfunc)lazy_len},
+    {Py_mp_subscript, (binaryfunc)lazy_list_subscript},
+    {0, NULL}
+};
+
+PyType_Spec lazy_list_spec = {
+    .name = "compaqt.LazyList",
+    .basicsize = sizeof(lazy_ob),
+    #ifdef Py_TPFLAGS_SEQUENCE
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION | Py_TPFLAGS_SEQUENCE,
+    #else
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    #endif
+    .slots = lazy_list_slots,
+};
+
+/* LAZY DICT */
+
+/*  Decode the keys of a dict into its index, and find the offsets of their values. The keys are decoded as regular
+ *  strings, so that they can be looked up with them. This is done for all keys at once, on the first access.
+ */
+static int index_dict(lazy_ob *ob)
+{
+    PyObject *index = PyDict_New();
+
+    if (index == NULL)
+        return 1;
+
+    if (ob->nitems != 0 && ob->items == NULL && alloc_tables(ob) == 1)
+    {
+        Py_DECREF(index);
+        return 1;
+    }
+
+    char *offset = ob->start;
+
+    for (size_t i = 0; i < ob->nitems; ++i)
+    {
+        char *key_offset = offset;
+
+        if (skip_item(ob, &offset) == 1)
+            goto error;
+
+        decode_t b;
+        init_decode(ob, &b, key_offset, 0);
+
+        PyObject *key = decode_bytes(&b);
+
+        if (key == NULL)
+            goto error;
+
+        PyObject *pos = PyLong_FromSize_t(i);
+        const int status = pos == NULL ? -1 : PyDict_SetItem(index, key, pos);
+
+        Py_DECREF(key);
+        Py_XDECREF(pos);
+
+        if (status != 0)
+            goto error;
+
+        ob->offsets[i] = offset;
+
+        if (skip_item(ob, &offset) == 1)
+            goto error;
+    }
+
+    // Custom types run Python code while decoding keys, which could have indexed the dict already
+    if (ob->index != NULL)
+        Py_DECREF(index);
+    else
+        ob->index = index;
+
+    return 0;
+
+    error:
+    Py_DECREF(index);
+    return 1;
+}
+
+// Get the value of `key`, setting a KeyError if it's not in the dict if `missing` is NULL, or returning `missing` otherwise
+static PyObject *dict_get(lazy_ob *ob, PyObject *key, PyObject *missing)
+{
+    PyObject *value = NULL;
+
+    LAZY_LOCK(ob);
+
+    if (ob->index != NULL || index_dict(ob) == 0)
+    {
+        PyObject *pos = PyDict_GetItemWithError(ob->index, key);
+
+        if (pos != NULL)
+        {
+            value = get_item(ob, PyLong_AsSize_t(pos));
+        }
+        else if (!PyErr_Occurred())
+        {
+            if (missing != NULL)
+            {
+                Py_INCREF(missing);
+                value = missing;
+            }
+            else
+            {
+                // Wrap the key, so that tuples aren't taken as the arguments of the error
+                PyObject *args = PyTuple_Pack(1, key);
+
+                if (args != NULL)
+                {
+                    PyErr_SetObject(PyExc_KeyError, args);
+                    Py_DECREF(args);
+                }
+            }
+        }
+    }
+
+    LAZY_UNLOCK();
+
+    return value;
+}
+
+static PyObject *lazy_dict_subscript(lazy_ob *ob, PyObject *key)
+{
+    return dict_get(ob, key, NULL);
+}
+
+static PyObject *lazy_dict_get(lazy_ob *ob, PyObject *args)
+{
+    PyObject *key;
+    PyObject *missing = Py_None;
+
+    if (!PyArg_ParseTuple(args, "O|O", &key, &missing))
+        return NULL;
+
+    return dict_get(ob, key, missing);
+}
+
+static int lazy_dict_contains(lazy_ob *ob, PyObject *key)
+{
+    int result = -1;
+
+    LAZY_LOCK(ob);
+
+    if (ob->index != NULL || index_dict(ob) == 0)
+        result = PyDict_Contains(ob->index, key);
+
+    LAZY_UNLOCK();
+
+    return result;
+}
+
+// Get a new reference to the index, which isn't changed anymore once it's set
+static PyObject *get_index(lazy_ob *ob)
+{
+    PyObject *index = NULL;
+
+    LAZY_LOCK(ob);
+
+    if (ob->index != NULL || index_dict(ob) == 0)
+    {
+        Py_INCREF(ob->index);
+        index = ob->index;
+    }
+
+    LAZY_UNLOCK();
+
+    return index;
+}
+
+static PyObject *lazy_dict_iter(lazy_ob *ob)
+{
+    PyObject *index = get_index(ob);
+
+    if (index == NULL)
+        return NULL;
+
+    PyObject *iter = PyObject_GetIter(index);
+    Py_DECREF(index);
+
+    return iter;
+}
+
+static PyObject *lazy_dict_keys(lazy_ob *ob, PyObject *Py_UNUSED(ignored))
+{
+    PyObject *index = get_index(ob);
+
+    if (index == NULL)
+        return NULL;
+
+    PyObject *keys = PyDict_Keys(index);
+    Py_DECREF(index);
+
+    return keys;
+}
+
+// Get a list of the values, or of (key, value) tuples if `pairs` is set, decoding the values that aren't decoded yet
+static PyObject *dict_values(lazy_ob *ob, const int pairs)
+{
+    PyObject *index = get_index(ob);
+
+    if (index == NULL)
+        return NULL;
+
+    PyObject *list = PyList_New(PyDict_GET_SIZE(index));
+
+    if (list == NULL)
+    {
+        Py_DECREF(index);
+        return NULL;
+    }
+
+    Py_ssize_t pos = 0;
+    PyObject *key, *idx;
+
+    for (Py_ssize_t i = 0; PyDict_Next(index, &pos, &key, &idx); ++i)
+    {
+        PyObject *value;
+
+        LAZY_LOCK(ob);
+        value = get_item(ob, PyLong_AsSize_t(idx));
+        LAZY_UNLOCK();
+
+        if (value != NULL && pairs == 1)
+        {
+            PyObject *pair = PyTuple_Pack(2, key, value);
+            Py_DECREF(value);
+            value = pair;
+        }
+
+        if (value == NULL)
+        {
+            Py_DECREF(list);
+            Py_DECREF(index);
+            return NULL;
+        }
+
+        PyList_SET_ITEM(list, i, value);
+    }
+
+    Py_DECREF(index);
+    return list;
+}
+
+static PyObject *lazy_dict_values(lazy_ob *ob, PyObject *Py_UNUSED(ignored))
+{
+    return dict_values(ob, 0);
+}
+
+static PyObject *lazy_dict_items(lazy_ob *ob, PyObject *Py_UNUSED(ignored))
+{
+    return dict_values(ob, 1);
+}
+
+static PyMethodDef lazy_dict_methods[] = {
+    {"get", (PyCFunction)lazy_dict_get, METH_VARARGS, NULL},
+    {"keys", (PyCFunction)lazy_dict_keys, METH_NOARGS, NULL},
+    {"values", (PyCFunction)lazy_dict_values, METH_NOARGS, NULL},
+    {"items", (PyCFunction)lazy_dict_items, METH_NOARGS, NULL},
+    {"materialize", (PyCFunction)lazy_materialize, METH_NOARGS, NULL},
+
+    {NULL, NULL, 0, NULL}
+};
+
+static PyType_Slot lazy_dict_slots[] = {
+    {Py_tp_doc, "a dict that decodes its values once they're accessed"},
+    {Py_tp_dealloc, (destructor)lazy_dealloc},
+    {Py_tp_repr, (reprfunc)lazy_repr},
+    {Py_tp_hash, PyObject_HashNotImplemented},
+    {Py_tp_richcompare, (richcmpfunc)lazy_richcompare},
+    {Py_tp_iter, (getiterfunc)lazy_dict_iter},
+    {Py_tp_methods, lazy_dict_methods},
+    {Py_sq_contains, (objobjproc)lazy_dict_contains},
+    {Py_mp_length, (lenfunc)lazy_len},
+    {Py_mp_subscript, (binaryfunc)lazy_dict_subscript},
+    {0, NULL}
+};
+
+PyType_Spec lazy_dict_spec = {
+    .name = "compaqt.LazyDict",
+    .basicsize = sizeof(lazy_ob),
+    #ifdef Py_TPFLAGS_MAPPING
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION | Py_TPFLAGS_MAPPING,
+    #else
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    #endif
+    .slots = lazy_dict_slots,
+};
+
+/*  Create a lazily decoded list or dict from the container at `offset`, which keeps `bufd` alive. Its items are
+ *  decoded with `max_depth` levels of nesting left, minus the level of the container itself.
+ */
+PyObject *lazy_create(PyObject *module, bufdata_t *bufd, utypes_decode_ob *utypes, char *offset, char *max_offset, size_t max_depth, const int referenced)
+{
+    module_state_t *state = MODULE_STATE(module);
+
+    // The metadata macros read from `b`
+    decode_t dec;
+    decode_t *b = &dec;
+    b->offset = offset;
+
+    if (offset >= max_offset)
+    {
+        PyErr_SetString(state->decoding_error, "Received invalid or corrupted bytes");
+        return NULL;
+    }
+
+    // Preserved references resolve to values decoded before them, so they can only be decoded in order
+    if ((offset[0] & 0xFF) == (unsigned char)(DT_EXTNS | (EXT_REFDF << 3)))
+    {
+        PyErr_SetString(state->decoding_error, "Data encoded with a key table or preserved references can't be decoded lazily");
+        return NULL;
+    }
+
+    // The items of sized containers are kept within their size, unless the size wasn't known when encoding
+    if ((offset[0] & 0xFF) == SIZED_BYTE)
+    {
+        uint32_t size = 0;
+
+        if (max_offset - offset > SIZED_PREFIX_SIZE)
+        {
+            memcpy(&size, offset + 1, SIZED_PREFIX_SIZE - 1);
+            size = LITTLE_32(size);
+        }
+
+        b->offset += SIZED_PREFIX_SIZE;
+
+        if (size == 0 || (size != SIZED_UNKNOWN && size > (size_t)(max_offset - b->offset)) || (b->offset[0] & 0b110) != 0)
+        {
+            PyErr_SetString(state->decoding_error, "Received invalid or corrupted bytes");
+            return NULL;
+        }
+
+        if (size != SIZED_UNKNOWN)
+            max_offset = b->offset + size;
+    }
+
+    const unsigned char byte = b->offset[0] & 0xFF;
+
+    // The metadata is read at once, so check that all of it is there first
+    if ((size_t)(max_offset - b->offset) < METADATA_VARLEN_SIZE(byte))
+    {
+        PyErr_SetString(state->decoding_error, "Received invalid or corrupted bytes");
+        return NULL;
+    }
+
+    size_t nitems;
+    METADATA_VARLEN_RD(nitems);
+
+    // Every item takes up at least one byte, which also keeps corrupted data from allocating huge tables
+    const size_t min_size = (byte & 0b111) == DT_DICTN ? 2 : 1;
+
+    if (nitems > (size_t)(max_offset - b->offset) / min_size)
+    {
+        PyErr_SetString(state->decoding_error, "Received invalid or corrupted bytes");
+        return NULL;
+    }
+
+    if (enter_depth(&max_depth, 1, state->decoding_error) == 1)
+        return NULL;
+
+    lazy_ob *ob = PyObject_New(lazy_ob, (byte & 0b111) == DT_ARRAY ? state->lazy_list_type : state->lazy_dict_type);
+
+    if (ob == NULL)
+        return PyErr_NoMemory();
+
+    ob->bufd = bufd;
+    ob->module = module;
+    ob->utypes = utypes;
+    ob->base = offset;
+    ob->start = b->offset;
+    ob->end = max_offset;
+    ob->nitems = nitems;
+    ob->max_depth = max_depth;
+    ob->referenced = referenced;
+    ob->offsets = NULL;
+    ob->nfound = 0;
+    ob->items = NULL;
+    ob->index = NULL;
+
+    INCREF_BUFD(bufd);
+    Py_INCREF(module);
+    Py_XINCREF((PyObject *)utypes);
+
+    return (PyObject *)ob;
+}
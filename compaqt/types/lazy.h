@@ -0,0 +1,20 @@
+#ifndef LAZY_H
+#define LAZY_H
+
+#include <Python.h>
+#include "globals/typedefs.h"
+#include "globals/typemasks.h"
+#include "types/base.h"
+
+// Whether a metadata byte starts a list or dict, which are decoded lazily, including sized ones
+#define IS_LAZY_CONTAINER(byte) (((byte) & 0b110) == 0 || (byte) == SIZED_BYTE)
+
+// Whether a metadata byte starts a value that's decoded lazily, which includes containers defined in the reference table (rejected)
+#define IS_LAZY_VALUE(byte) (IS_LAZY_CONTAINER(byte) || (byte) == (DT_EXTNS | (EXT_REFDF << 3)))
+
+extern PyType_Spec lazy_list_spec;
+extern PyType_Spec lazy_dict_spec;
+
+PyObject *lazy_create(PyObject *module, bufdata_t *bufd, utypes_decode_ob *utypes, char *offset, char *max_offset, size_t max_depth, const int referenced);
+
+#endif // LAZY_H
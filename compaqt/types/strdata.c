@@ -35,17 +35,14 @@
 #define UCHAR_CAST(data) ((unsigned char)(*(data)))
 
 
-/*  
- *  Get the number of codepoints in the UTF-8 data.
+/*  Count the codepoints in `data` up to `max_data`, reading up to 3 bytes past the last one counted.
  *
- *  Returns -1 if the data is not valid UTF-8.
- *  
+ *  Returns where the counting stopped, which may be past `max_data`, or NULL if the data is not valid UTF-8.
 */
-Py_ssize_t utf8_codepoints(char *data, const Py_ssize_t len)
+static inline const char *count_codepoints(const char *data, const char *max_data, Py_ssize_t *count)
 {
-    Py_ssize_t codepoints = 0;
+    Py_ssize_t codepoints = *count;
 
-    const char *max_data = data + len;
     while (data < max_data)
     {
         switch (UCHAR_CAST(data) >> 4)
@@ -60,7 +57,7 @@ Py_ssize_t utf8_codepoints(char *data, const Py_ssize_t len)
                 memcpy(&tmp, data, 4);
 
                 if ((tmp & 0b110000001100000011000000) != 0b100000001000000010000000)
-                    return -1;
+                    return NULL;
 
                 data += 3;
                 break;
@@ -71,7 +68,7 @@ Py_ssize_t utf8_codepoints(char *data, const Py_ssize_t len)
                 memcpy(&tmp, data, 2);
 
                 if ((tmp & 0b1100000011000000) != 0b1000000010000000)
-                    return -1;
+                    return NULL;
 
                 data += 2;
                 break;
@@ -83,7 +80,7 @@ Py_ssize_t utf8_codepoints(char *data, const Py_ssize_t len)
             }
             default:
             {
-                return -1;
+                return NULL;
             }
             }
             
@@ -92,7 +89,7 @@ Py_ssize_t utf8_codepoints(char *data, const Py_ssize_t len)
         BYTE2_CASES
         {
             if ((UCHAR_CAST(data + 1) & 0b11000000) != 0b10000000)
-                return -1;
+                return NULL;
             
             ++codepoints;
             data += 2;
@@ -104,7 +101,7 @@ Py_ssize_t utf8_codepoints(char *data, const Py_ssize_t len)
             memcpy(&tmp, data, 4);
 
             if ((tmp & 0b110000001100000000000000) != 0b100000001000000000000000)
-                return -1;
+                return NULL;
 
             ++codepoints;
             data += 3;
@@ -116,7 +113,7 @@ Py_ssize_t utf8_codepoints(char *data, const Py_ssize_t len)
             memcpy(&tmp, data, 4);
 
             if ((tmp & 0b11000000110000001100000011111000) != 0b10000000100000001000000011110000)
-                return -1;
+                return NULL;
 
             ++codepoints;
             data += 4;
@@ -130,19 +127,62 @@ Py_ssize_t utf8_codepoints(char *data, const Py_ssize_t len)
         }
         default:
         {
-            return -1;
+            return NULL;
         }
         }
     }
 
-    if (data > max_data)
+    *count = codepoints;
+    return data;
+}
+
+/*  
+ *  Get the number of codepoints in the UTF-8 data.
+ *
+ *  Returns -1 if the data is not valid UTF-8.
+ *  
+*/
+Py_ssize_t utf8_codepoints(char *data, const Py_ssize_t len)
+{
+    Py_ssize_t codepoints = 0;
+
+    const char *max_data = data + len;
+    const char *offset = data;
+
+    // A last byte that starts a character is always truncated, and could be skipped over along with an ASCII byte before it
+    if (len > 0 && UCHAR_CAST(max_data - 1) >= 0xC0)
+        return -1;
+
+    // Characters are checked with reads of up to 4 bytes, so only do this in place while all of them are within the data
+    if (len > 3 && (offset = count_codepoints(data, max_data - 3, &codepoints)) == NULL)
+        return -1;
+    
+    if (offset >= max_data)
+        return codepoints;
+    
+    // Count the last few bytes in a zeroed copy, including the byte before them for the continuation checks
+    const Py_ssize_t remaining = max_data - offset;
+    char tail[8] = {0};
+
+    if (offset != data)
+        tail[0] = offset[-1];
+    
+    memcpy(tail + 1, offset, remaining);
+
+    const char *tail_max = tail + 1 + remaining;
+    const char *tail_data = count_codepoints(tail + 1, tail_max, &codepoints);
+
+    if (tail_data == NULL)
+        return -1;
+
+    if (tail_data > tail_max)
     {
-        --data;
+        --tail_data;
 
-        if (data > max_data)
+        if (tail_data > tail_max)
             return -1;
         
-        if (UCHAR_CAST(data - 1) >= 0x80)
+        if (UCHAR_CAST(tail_data - 1) >= 0x80)
             return -1;
         
         --codepoints;
@@ -283,3 +323,163 @@ Py_ssize_t utf8_count(char *data, const Py_ssize_t data_len, const char *pattern
     return count;
 }
 
+
+
+/*  Returns the size of the UTF-8 encoding of a string's `kind` data (as given by `PyUnicode_KIND`).
+ *
+ *  Returns -1 if the data contains surrogates, which can't be encoded.
+ *  The loops have no early exits so that they are vectorized by the compiler.
+ */
+Py_ssize_t utf8_size_of(const void *data, const int kind, const Py_ssize_t len)
+{
+    Py_ssize_t size = len;
+
+    switch (kind)
+    {
+    case PyUnicode_1BYTE_KIND:
+    {
+        const Py_UCS1 *chars = (const Py_UCS1 *)data;
+
+        for (Py_ssize_t i = 0; i < len; ++i)
+            size += chars[i] >> 7;
+
+        return size;
+    }
+    case PyUnicode_2BYTE_KIND:
+    {
+        const Py_UCS2 *chars = (const Py_UCS2 *)data;
+        int surrogates = 0;
+
+        for (Py_ssize_t i = 0; i < len; ++i)
+        {
+            size += (chars[i] >= 0x80) + (chars[i] >= 0x800);
+            surrogates |= (chars[i] & 0xF800) == 0xD800;
+        }
+
+        return surrogates ? -1 : size;
+    }
+    default:
+    {
+        const Py_UCS4 *chars = (const Py_UCS4 *)data;
+        int surrogates = 0;
+
+        for (Py_ssize_t i = 0; i < len; ++i)
+        {
+            size += (chars[i] >= 0x80) + (chars[i] >= 0x800) + (chars[i] >= 0x10000);
+            surrogates |= (chars[i] & 0xFFFFF800) == 0xD800;
+        }
+
+        return surrogates ? -1 : size;
+    }
+    }
+}
+
+// Write a single non-ASCII codepoint as UTF-8 and increment the output
+#define UTF8_WRITE_CHAR(out, c) do { \
+    if (c < 0x800) \
+    { \
+        *(out)++ = (char)(0xC0 | (c >> 6)); \
+        *(out)++ = (char)(0x80 | (c & 0x3F)); \
+    } \
+    else if (c < 0x10000) \
+    { \
+        *(out)++ = (char)(0xE0 | (c >> 12)); \
+        *(out)++ = (char)(0x80 | ((c >> 6) & 0x3F)); \
+        *(out)++ = (char)(0x80 | (c & 0x3F)); \
+    } \
+    else \
+    { \
+        *(out)++ = (char)(0xF0 | (c >> 18)); \
+        *(out)++ = (char)(0x80 | ((c >> 12) & 0x3F)); \
+        *(out)++ = (char)(0x80 | ((c >> 6) & 0x3F)); \
+        *(out)++ = (char)(0x80 | (c & 0x3F)); \
+    } \
+} while (0)
+
+/*  Transcodes a string's `kind` data to UTF-8 into `out`, which must hold the size given by `utf8_size_of`.
+ *
+ *  Runs of ASCII characters are checked and copied 8 bytes at a time.
+ */
+void utf8_write(const void *data, const int kind, const Py_ssize_t len, char *out)
+{
+    Py_ssize_t i = 0;
+
+    switch (kind)
+    {
+    case PyUnicode_1BYTE_KIND:
+    {
+        const Py_UCS1 *chars = (const Py_UCS1 *)data;
+
+        while (i < len)
+        {
+            uint64_t chunk;
+
+            if (i + 8 <= len && (memcpy(&chunk, chars + i, 8), (chunk & 0x8080808080808080ULL) == 0))
+            {
+                memcpy(out, &chunk, 8);
+                out += 8;
+                i += 8;
+                continue;
+            }
+
+            const Py_UCS1 c = chars[i++];
+
+            if (c < 0x80)
+            {
+                *out++ = (char)c;
+            }
+            else
+            {
+                *out++ = (char)(0xC0 | (c >> 6));
+                *out++ = (char)(0x80 | (c & 0x3F));
+            }
+        }
+
+        return;
+    }
+    case PyUnicode_2BYTE_KIND:
+    {
+        const Py_UCS2 *chars = (const Py_UCS2 *)data;
+
+        while (i < len)
+        {
+            uint64_t chunk;
+
+            if (i + 4 <= len && (memcpy(&chunk, chars + i, 8), (chunk & 0xFF80FF80FF80FF80ULL) == 0))
+            {
+                for (int j = 0; j < 4; ++j)
+                    out[j] = (char)chars[i + j];
+
+                out += 4;
+                i += 4;
+                continue;
+            }
+
+            const Py_UCS2 c = chars[i++];
+
+            if (c < 0x80)
+                *out++ = (char)c;
+            else
+                UTF8_WRITE_CHAR(out, c);
+        }
+
+        return;
+    }
+    default:
+    {
+        const Py_UCS4 *chars = (const Py_UCS4 *)data;
+
+        while (i < len)
+        {
+            const Py_UCS4 c = chars[i++];
+
+            if (c < 0x80)
+                *out++ = (char)c;
+            else
+                UTF8_WRITE_CHAR(out, c);
+        }
+
+        return;
+    }
+    }
+}
@@ -7,4 +7,7 @@ Py_ssize_t utf8_codepoints(char *data, const Py_ssize_t len);
 Py_ssize_t utf8_index(char *data, const Py_ssize_t len, const Py_ssize_t codepoint, Py_ssize_t *bytesize);
 Py_ssize_t utf8_count(char *data, const Py_ssize_t data_len, const char *pattern, const Py_ssize_t pattern_len, const int overlap);
 
+Py_ssize_t utf8_size_of(const void *data, const int kind, const Py_ssize_t len);
+void utf8_write(const void *data, const int kind, const Py_ssize_t len, char *out);
+
 #endif // STRDATA_H
\ No newline at end of file
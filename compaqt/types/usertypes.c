@@ -4,6 +4,7 @@
 #include "globals/typemasks.h"
 #include "globals/internals.h"
 #include "globals/typedefs.h"
+#include "globals/modstate.h"
 
 /* HASH TABLE */
 
@@ -91,10 +92,9 @@ void utypes_encode_dealloc(utypes_encode_ob *self)
         free(self->table);
     }
 
-    if (Py_TYPE(self)->tp_free)
-        Py_TYPE(self)->tp_free((PyObject *)self);
-    else
-        PyObject_Del(self);
+    PyTypeObject *type = Py_TYPE(self);
+    type->tp_free((PyObject *)self);
+    HEAPTYPE_DECREF(type);
 }
 
 void utypes_decode_dealloc(utypes_decode_ob *self)
@@ -104,26 +104,33 @@ void utypes_decode_dealloc(utypes_decode_ob *self)
 
     free(self->reads);
 
-    if (Py_TYPE(self)->tp_free)
-        Py_TYPE(self)->tp_free((PyObject *)self);
-    else
-        PyObject_Del(self);
+    PyTypeObject *type = Py_TYPE(self);
+    type->tp_free((PyObject *)self);
+    HEAPTYPE_DECREF(type);
 }
 
-PyTypeObject utypes_encode_t = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "compaqt.CustomWriteTypes",
-    .tp_basicsize = sizeof(utypes_encode_ob),
-    .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_dealloc = (destructor)utypes_encode_dealloc,
+static PyType_Slot utypes_encode_slots[] = {
+    {Py_tp_dealloc, (destructor)utypes_encode_dealloc},
+    {0, NULL}
 };
 
-PyTypeObject utypes_decode_t = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "compaqt.CustomReadTypes",
-    .tp_basicsize = sizeof(utypes_decode_ob),
-    .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_dealloc = (destructor)utypes_decode_dealloc,
+static PyType_Slot utypes_decode_slots[] = {
+    {Py_tp_dealloc, (destructor)utypes_decode_dealloc},
+    {0, NULL}
+};
+
+PyType_Spec utypes_encode_spec = {
+    .name = "compaqt.CustomWriteTypes",
+    .basicsize = sizeof(utypes_encode_ob),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    .slots = utypes_encode_slots,
+};
+
+PyType_Spec utypes_decode_spec = {
+    .name = "compaqt.CustomReadTypes",
+    .basicsize = sizeof(utypes_decode_ob),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    .slots = utypes_decode_slots,
 };
 
 PyObject *get_utypes_encode_ob(PyObject *self, PyObject *args)
@@ -142,7 +149,7 @@ PyObject *get_utypes_encode_ob(PyObject *self, PyObject *args)
         return NULL;
     }
 
-    utypes_encode_ob *ob = PyObject_New(utypes_encode_ob, &utypes_encode_t);
+    utypes_encode_ob *ob = PyObject_New(utypes_encode_ob, MODULE_STATE(self)->utypes_encode_type);
 
     if (ob == NULL)
         return PyErr_NoMemory();
@@ -237,7 +244,7 @@ PyObject *get_utypes_decode_ob(PyObject *self, PyObject *args)
     if (!PyArg_ParseTuple(args, "O!", &PyDict_Type, &data))
         return NULL;
 
-    utypes_decode_ob *ob = PyObject_New(utypes_decode_ob, &utypes_decode_t);
+    utypes_decode_ob *ob = PyObject_New(utypes_decode_ob, MODULE_STATE(self)->utypes_decode_type);
 
     if (ob == NULL)
         return PyErr_NoMemory();
@@ -283,26 +290,15 @@ PyObject *get_utypes_decode_ob(PyObject *self, PyObject *args)
 
 /* SERIALIZATION */
 
-int encode_custom(encode_t *b, PyObject *value)
+// Get the write function of a custom type and store its index in `idx`. Returns NULL without setting an error if the type has none
+PyObject *get_custom_type(utypes_encode_ob *utypes, PyTypeObject *type, size_t *idx)
 {
-    // Check if we actually got a custom types object as it's optional
-    if (b->utypes == NULL)
-    {
-        PyErr_Format(PyExc_ValueError, "Received unsupported datatype '%s'", Py_TYPE(value)->tp_name);
-        return 1;
-    }
-    
-    PyTypeObject *type = Py_TYPE(value);
-
-    size_t idx;
-    PyObject *func = pull_from_table(((utypes_encode_ob *)b->utypes)->table, type, &idx);
-
-    if (func == NULL)
-    {
-        PyErr_Format(PyExc_ValueError, "Received unsupported datatype '%s'", Py_TYPE(value)->tp_name);
-        return 1;
-    }
+    return pull_from_table(utypes->table, type, idx);
+}
 
+// Encode a value with the write function and index received from `get_custom_type`
+int encode_custom(encode_t *b, PyObject *value, PyObject *func, const size_t idx)
+{
     // Call the write function provided by the user and pass the value to encode
     PyObject *result = PyObject_CallFunctionObjArgs(func, value, NULL);
 
@@ -339,10 +335,14 @@ PyObject *decode_custom(decode_t *b)
     // Custom types object is NULL if we didn't get one, in that case the bytes are invalid
     if (b->utypes == NULL)
     {
-        PyErr_SetString(DecodingError, "Likely received an invalid or corrupted bytes object");
+        PyErr_SetString(b->state->decoding_error, "Likely received an invalid or corrupted bytes object");
         return NULL;
     }
 
+    // The index is stored in the first byte of the metadata, and the number of length bytes in the second
+    if (b->bufcheck(b, 2) == 1 || b->bufcheck(b, 1 + (b->offset[1] & 0b111)) == 1)
+        return NULL;
+
     int idx;
     size_t length;
     METADATA_UTYPE_RD(idx, length);
@@ -356,7 +356,7 @@ PyObject *decode_custom(decode_t *b)
     // No function was provided for this pointer index
     if (func == NULL)
     {
-        PyErr_Format(DecodingError, "Could not find a valid function on ID %i. Did you use the same custom type ID as when encoding?", idx);
+        PyErr_Format(b->state->decoding_error, "Could not find a valid function on ID %i. Did you use the same custom type ID as when encoding?", idx);
         return NULL;
     }
 
@@ -4,13 +4,14 @@
 #include <Python.h>
 #include "globals/typedefs.h"
 
-extern PyTypeObject utypes_encode_t;
-extern PyTypeObject utypes_decode_t;
+extern PyType_Spec utypes_encode_spec;
+extern PyType_Spec utypes_decode_spec;
 
 PyObject *get_utypes_encode_ob(PyObject *self, PyObject *args);
 PyObject *get_utypes_decode_ob(PyObject *self, PyObject *args);
 
-int encode_custom(encode_t *b, PyObject *value);
+PyObject *get_custom_type(utypes_encode_ob *utypes, PyTypeObject *type, size_t *idx);
+int encode_custom(encode_t *b, PyObject *value, PyObject *func, const size_t idx);
 PyObject *decode_custom(decode_t *b);
 
 #endif // USERTYPES_H
\ No newline at end of file
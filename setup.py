@@ -11,17 +11,19 @@ ext_modules = [
         sources=[
             'compaqt/compaqt.c',
             
-            'compaqt/globals/exceptions.c',
-            
             'compaqt/main/serialization.c',
             'compaqt/main/regular.c',
             'compaqt/main/stream.c',
             'compaqt/main/validation.c',
+            'compaqt/main/compression.c',
+            'compaqt/main/checksum.c',
+            'compaqt/main/filemap.c',
             
             'compaqt/types/usertypes.c',
             'compaqt/types/strdata.c',
             'compaqt/types/cbytes.c',
             'compaqt/types/cstr.c',
+            'compaqt/types/lazy.c',
             
             'compaqt/settings/allocations.c',
         ],
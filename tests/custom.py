@@ -95,5 +95,52 @@ try:
 except:
     pass
 
+# Custom types should be skipped over correctly when validating
+if not cq.validate(cq.encode([IntegerCustom(1), 'abc', StringCustom('two')], custom_types=enc)):
+    print("Failed: Validating custom types")
+
+# Custom types registered for types that are also supported natively should keep being used for them
+from array import array
+calls = []
+
+def native_wr(value) -> bytes:
+    calls.append(type(value))
+    return repr(value).encode()
+
+native_types = (tuple, set, frozenset, bytearray, memoryview, array)
+enc_native = cq.types.encoder_types({i: (tp, native_wr) for i, tp in enumerate(native_types)})
+values = [(1, 2), {3}, frozenset([4]), bytearray(b'5'), memoryview(b'6'), array('i', [7])]
+
+for value in (values, {'nested': values}, [values]):
+    calls.clear()
+    encoded = cq.encode(value, custom_types=enc_native)
+
+    if calls != [type(v) for v in values]:
+        print(f"Failed: Custom types for natively supported types: {value}")
+
+if cq.encoded_size(values, custom_types=enc_native) != len(cq.encode(values, custom_types=enc_native)):
+    print("Failed: Measuring custom types for natively supported types")
+
+# Lazily decoded containers decode custom types once they're accessed
+lazy = cq.decode(cq.encode({'values': [IntegerCustom(1), StringCustom('two')]}, custom_types=enc), custom_types=dec, lazy=True)
+
+if lazy['values'][0].value != 1 or lazy['values'][1].value != 'two':
+    print("Failed: Lazily decoding custom types")
+
+# An encoder can't be used again while it's encoding, as that would reuse its buffer
+def reentrant_wr(value: IntegerCustom) -> bytes:
+    return encoder.encode(value.value)
+
+encoder = cq.Encoder(custom_types=cq.types.encoder_types({0: (IntegerCustom, reentrant_wr)}))
+
+try:
+    encoder.encode(IntegerCustom(5))
+    print("Failed: Reentrant encoder test")
+except RuntimeError:
+    pass
+
+if cq.decode(encoder.encode([1, 2])) != [1, 2]:
+    print("Failed: Using the encoder after a reentrant call")
+
 print('Finished\n')
 
@@ -32,6 +32,373 @@ for v in test_values:
 # Test the entire list
 test(test_values)
 
+# Subclasses of supported types encode as their base type
+class DictSub(dict): pass
+class IntSub(int): pass
+
+if cq.decode(cq.encode([DictSub(a=1), IntSub(5)])) != [{'a': 1}, 5]:
+    print('Failed: Encoding subclasses\n')
+
+# Check the encoded size
+if cq.encoded_size(test_values) != len(cq.encode(test_values)):
+    print('Incorrect encoded size\n')
+
+if cq.encoded_size(['A' * 100_000]) != len(cq.encode(['A' * 100_000])):
+    print('Incorrect encoded size of a large item\n')
+
+# Encode into a caller-supplied buffer
+encoded = cq.encode(test_values)
+buf = bytearray(len(encoded) + 4)
+
+if cq.encode_into(test_values, buf, 4) != len(encoded) or buf[4:] != encoded:
+    print('Incorrectly encoded into a buffer\n')
+
+# A buffer of exactly the encoded size should fit the encoded data
+for v in test_values + [test_values, ['A' * 100_000, 'B']]:
+    buf = bytearray(cq.encoded_size(v))
+
+    if cq.encode_into(v, buf) != len(buf) or buf != cq.encode(v):
+        print(f'Incorrectly encoded into a buffer of the encoded size: {shorten(v)}\n')
+
+try:
+    cq.encode_into(test_values, bytearray(8))
+    print('Failed: Encoding into a too small buffer\n')
+except cq.BufferSizeError as e:
+    if e.needed_size != len(encoded):
+        print(f'Incorrect needed size: {e.needed_size}\n')
+
+# Encode with a reusable encoder
+encoder = cq.Encoder()
+
+for v in test_values + [test_values, test_values]:
+    if cq.decode(encoder.encode(v)) != v:
+        print(f'Failed with encoder: {shorten(v)}\n')
+
+# Stream compatible data should decode as usual
+if cq.decode(cq.encode(test_values, stream_compatible=True)) != test_values:
+    print('Failed: Stream compatible encoding\n')
+
+# Repeated keys should be deduplicated with the key table, and decode to the same object
+records = [{'name': 'Alice', 'age': 30, 'id': i, 'nested': {'name': 'Bob'}} for i in range(100)]
+encoded = cq.encode(records, key_table=True)
+decoded = cq.decode(encoded)
+
+if decoded != records or not cq.validate(encoded):
+    print('Failed: Encoding with a key table\n')
+if len(encoded) >= len(cq.encode(records)) or list(decoded[0])[0] is not list(decoded[99]['nested'])[0]:
+    print('Failed: Deduplicating keys with a key table\n')
+if cq.decode(cq.encode(test_values, key_table=True)) != test_values:
+    print('Failed: Encoding test values with a key table\n')
+
+# Lists of dicts with the same keys should decode to the same dicts, with the same key order, when encoded by column
+records = [{'id': i, 'score': i / 3, 'small': i % 100, 'big': 2**70 + i, 'name': f'n{i}', 'mixed': i if i % 2 else None} for i in range(100)]
+nested = {'records': records, 'shapes': [{'a': 1}, {'b': 2}], 'order': [{'a': 1, 'b': 2}, {'b': 2, 'a': 1}]}
+
+for value in (records, nested, test_values):
+    encoded = cq.encode(value, columnar=True)
+    decoded = cq.decode(encoded)
+
+    if decoded != value or not cq.validate(encoded):
+        print(f'Failed: Encoding by column: {shorten(value)}\n')
+
+if [list(d) for d in cq.decode(cq.encode(nested, columnar=True))['order']] != [list(d) for d in nested['order']]:
+    print('Failed: Key order when encoding by column\n')
+if len(cq.encode(records, columnar=True)) >= len(cq.encode(records)):
+    print('Failed: Encoding by column did not reduce the size\n')
+
+# Compact numbers should decode to the same values, and be smaller for floats and lists of integers
+compact = [0.5, -1.25, 0.1, float('inf'), [0, -1, 63, -64, 2**63 - 1, -2**63], [{'value': 1.5, 'id': i} for i in range(4)]]
+
+for value in (compact, test_values):
+    encoded = cq.encode(value, compact_numbers=True, columnar=True)
+
+    if cq.decode(encoded) != value or not cq.validate(encoded):
+        print(f'Failed: Encoding compact numbers: {shorten(value)}\n')
+
+if len(cq.encode(0.5, compact_numbers=True)) != 5 or len(cq.encode(list(range(-64, 64)), compact_numbers=True)) != 128 + 3:
+    print('Failed: Compact numbers are not compact\n')
+
+# Typed arrays should decode to a memoryview of the items when referencing the encoded data
+from array import array
+values = array('i', range(-50, 50))
+
+if cq.decode(cq.encode(memoryview(values))) != values:
+    print('Failed: Encoding a memoryview of numbers\n')
+if cq.decode(cq.encode(values), referenced=True).tolist() != values.tolist():
+    print('Failed: Decoding a referenced typed array\n')
+
+# Extensions should only validate along with the data they extend, so that validated data can be decoded
+if cq.validate(b'\x07' + cq.encode(5)):
+    print('Failed: Validating an extension of the wrong datatype\n')
+
+for value, kwargs in ((records, {'columnar': True}), (compact, {'compact_numbers': True, 'columnar': True}), ([values, array('d', [0.5])], {})):
+    encoded = cq.encode(value, **kwargs)
+
+    for i in range(len(encoded)):
+        corrupted = bytearray(encoded)
+        corrupted[i] ^= 0x40
+
+        try:
+            if cq.validate(bytes(corrupted)):
+                cq.decode(bytes(corrupted))
+        except cq.DecodingError:
+            print(f'Failed: Validating corrupted extension data at byte {i}: {shorten(value)}\n')
+
+# Encoding non-ASCII strings shouldn't attach a UTF-8 copy to them
+import sys
+s = ''.join(['Привет, мир! 🙂'] * 4)
+size = sys.getsizeof(s)
+
+if cq.decode(cq.encode(s)) != s or sys.getsizeof(s) != size:
+    print('Failed: Non-ASCII string encoding cached UTF-8 data\n')
+
+# Deeply nested values shouldn't overflow the stack, and nesting beyond the maximum depth should raise an error
+deep = 0
+for i in range(50_000):
+    deep = [deep] if i % 3 else ({'key': deep},)
+
+encoded = cq.encode(deep)
+
+# Comparing such values recurses in Python itself, so compare their encoded data instead
+if cq.encode(cq.decode(encoded)) != encoded or not cq.validate(encoded):
+    print('Failed: Deeply nested value\n')
+
+for func, error in ((lambda: cq.encode(deep, max_depth=100), cq.EncodingError), (lambda: cq.decode(encoded, max_depth=100), cq.DecodingError)):
+    try:
+        func()
+        print('Failed: Exceeding the maximum depth did not raise an error\n')
+    except error:
+        pass
+
+if cq.validate(encoded, max_depth=100) or not cq.validate(cq.encode([[[]]]), max_depth=3):
+    print('Failed: Validating the maximum depth\n')
+
+# Shared lists and dicts should decode to shared objects when preserving references, including cycles
+shared = [1, 'abc', {'key': 'value'}]
+cyclic = {'shared': shared}
+cyclic['self'] = cyclic
+value = [shared, shared, cyclic, [cyclic, (shared,)]]
+
+encoded = cq.encode(value, preserve_refs=True)
+decoded = cq.decode(encoded)
+
+if decoded[0] != shared or decoded[0] is not decoded[1] or decoded[2]['shared'] is not decoded[0] or decoded[3][1][0] is not decoded[0]:
+    print('Failed: Preserving shared references\n')
+if decoded[2]['self'] is not decoded[2] or decoded[3][0] is not decoded[2] or not cq.validate(encoded):
+    print('Failed: Preserving cyclic references\n')
+if cq.decode(cq.encode(test_values, preserve_refs=True, compact_numbers=True, key_table=True)) != test_values:
+    print('Failed: Encoding test values while preserving references\n')
+
+# Compressed data should decode and validate as usual, also when it's stream compatible
+records = [{'id': i, 'name': f'user{i}', 'tags': ['a', 'b']} for i in range(20_000)]
+
+for value in (records, test_values, 'abc'):
+    for stream_compatible in (False, True):
+        encoded = cq.encode(value, compress=True, stream_compatible=stream_compatible)
+
+        if cq.decode(encoded) != value or not cq.validate(encoded):
+            print(f'Failed: Compressed encoding: {shorten(value)}\n')
+
+encoded = cq.encode(records, compress=True)
+
+if len(encoded) >= len(cq.encode(records)) // 2:
+    print('Failed: Compression did not reduce the size\n')
+if [bytes(v) for v in cq.decode(cq.encode([b'abc'] * 1000, compress=True), referenced=True)[:2]] != [b'abc', b'abc']:
+    print('Failed: Decoding referenced compressed data\n')
+
+# Truncated compressed data should be rejected
+try:
+    cq.decode(encoded[:-100])
+    print('Failed: Decoding truncated compressed data did not raise an error\n')
+except cq.DecodingError:
+    pass
+
+if cq.validate(encoded[:-100]):
+    print('Failed: Validating truncated compressed data\n')
+
+# Checksummed data should decode and validate as usual, and be rejected when corrupted
+for value in (records, test_values, 'abc'):
+    for compress in (False, True):
+        for stream_compatible in (False, True):
+            encoded = cq.encode(value, checksum=True, compress=compress, stream_compatible=stream_compatible)
+
+            if cq.decode(encoded) != value or not cq.validate(encoded):
+                print(f'Failed: Checksummed encoding: {shorten(value)}\n')
+
+            corrupted = bytearray(encoded)
+            corrupted[len(corrupted) // 2] ^= 0b100
+
+            try:
+                cq.decode(bytes(corrupted))
+                print(f'Failed: Decoding corrupted checksummed data did not raise an error: {shorten(value)}\n')
+            except cq.DecodingError:
+                pass
+
+            if cq.validate(bytes(corrupted)):
+                print(f'Failed: Validating corrupted checksummed data: {shorten(value)}\n')
+
+# Any bytes-like object can be decoded and validated, also just a part of it
+import mmap
+encoded = cq.encode(test_values)
+received = bytearray(b'header') + encoded + b'trailer'
+mapped = mmap.mmap(-1, len(received))
+mapped.write(received)
+
+for buffer in (bytearray(encoded), memoryview(encoded), received, memoryview(received), mapped):
+    part = {} if len(buffer) == len(encoded) else {'offset': 6, 'length': len(encoded)}
+
+    if cq.decode(buffer, **part) != test_values or not cq.validate(buffer, **part):
+        print(f"Failed: Decoding a part of type '{type(buffer).__name__}'\n")
+
+if cq.decode(received, offset=len(received) - len(encoded) - 7, length=None)[-1] != test_values[-1]:
+    print('Failed: Decoding up to the end of a buffer\n')
+
+for part in ({'offset': len(received) + 1}, {'offset': 6, 'length': len(received)}):
+    try:
+        cq.decode(received, **part)
+        print(f'Failed: Decoding outside of the buffer did not raise an error: {part}\n')
+    except ValueError:
+        pass
+
+# Truncated data at the end of a mapping should raise an error instead of reading past the mapping
+import os
+truncated_file = 'test_truncated.bin'
+
+# Map two pages and shrink the file to the first one, so that reading the second one fails
+with open(truncated_file, 'wb') as file:
+    file.write(bytes(2 * mmap.PAGESIZE))
+
+with open(truncated_file, 'r+b') as file:
+    mapped = mmap.mmap(file.fileno(), 2 * mmap.PAGESIZE)
+    file.truncate(mmap.PAGESIZE)
+
+for value in (test_values, [None] * 5000, [records, records], {'key': 'value' * 100}):
+    for kwargs in ({}, {'columnar': True}, {'key_table': True}, {'preserve_refs': True}, {'sized': True}):
+        try:
+            encoded = cq.encode(value, **kwargs)
+        except (TypeError, ValueError):
+            continue
+
+        for length in (*range(1, 64), *range(64, min(len(encoded), mmap.PAGESIZE), 97)):
+            mapped[mmap.PAGESIZE - length:mmap.PAGESIZE] = encoded[:length]
+            view = memoryview(mapped)[mmap.PAGESIZE - length:mmap.PAGESIZE]
+
+            for decode_kwargs in ({}, {'lazy': True}, {'referenced': True}):
+                try:
+                    decoded = cq.decode(view, **decode_kwargs)
+
+                    if decode_kwargs.get('lazy'):
+                        decoded.materialize()
+                except (cq.DecodingError, ValueError):
+                    pass
+
+                decoded = None
+
+            cq.validate(view)
+            view.release()
+
+mapped.close()
+os.remove(truncated_file)
+
+# Referenced values keep the buffer exported, so it can't be resized while they're alive
+encoded = cq.encode([b'abc', 'def'])
+received = bytearray(b'header') + encoded
+referenced = cq.decode(received, offset=6, referenced=True)
+
+try:
+    received.extend(b'more')
+    print('Failed: Resizing a buffer referenced by decoded values\n')
+except BufferError:
+    pass
+
+if [bytes(referenced[0]), str(referenced[1])] != [b'abc', 'def']:
+    print('Failed: Decoding a referenced part of a buffer\n')
+
+del referenced
+received.extend(b'more')
+mapped.close()
+
+# Lazily decoded lists and dicts should decode their items on access, to the same values as decoding them directly
+document = {'config': {'name': 'test', 'values': [1, 2.5, None]}, 'catalog': records, 'test_values': test_values, (1, 2): 'tuple key'}
+
+for value in (document, test_values, records):
+    for options in ({}, {'compress': True}, {'checksum': True}, {'stream_compatible': True}):
+        lazy = cq.decode(cq.encode(value, **options), lazy=True)
+
+        if lazy != value or lazy.materialize() != value:
+            print(f'Failed: Lazy decoding with {options}: {shorten(value)}\n')
+
+lazy = cq.decode(cq.encode(document), lazy=True)
+catalog = lazy['catalog']
+
+if not isinstance(lazy, cq.LazyDict) or not isinstance(catalog, cq.LazyList) or len(catalog) != len(records):
+    print('Failed: Lazy decoding types\n')
+if catalog[-1] != records[-1] or catalog[5:10] != records[5:10] or catalog[0] is not catalog[0]:
+    print('Failed: Lazily decoded list items\n')
+if list(lazy) != list(document) or lazy[(1, 2)] != 'tuple key' or 'config' not in lazy or lazy.get('missing', 5) != 5:
+    print('Failed: Lazily decoded dict keys\n')
+if [v == document[k] for k, v in lazy.items()] != [True] * len(document) or lazy.values()[0] != document['config']:
+    print('Failed: Lazily decoded dict values\n')
+if [bytes(v) for v in cq.decode(cq.encode([b'abc', b'def']), lazy=True, referenced=True)] != [b'abc', b'def']:
+    print('Failed: Lazily decoding referenced values\n')
+if cq.decode(cq.encode('abc'), lazy=True) != 'abc':
+    print('Failed: Lazily decoding a value without a container\n')
+
+for func, error in ((lambda: lazy['missing'], KeyError), (lambda: catalog[len(records)], IndexError), (lambda: cq.decode(cq.encode([[[]]]), lazy=True, max_depth=2)[0][0], cq.DecodingError)):
+    try:
+        func()
+        print('Failed: Invalid lazy access did not raise an error\n')
+    except error:
+        pass
+
+# Key tables and references only resolve when decoding in order, so they're rejected when decoding lazily
+for encoded in (cq.encode(records, key_table=True), cq.encode([document, document], preserve_refs=True)):
+    try:
+        list(cq.decode(encoded, lazy=True)[0].items())
+        print('Failed: Lazily decoding tables did not raise an error\n')
+    except cq.DecodingError:
+        pass
+
+# Corrupted data should be rejected once the corrupted part is reached
+encoded = cq.encode(records)
+
+try:
+    cq.decode(encoded[:-10], lazy=True)[-1].materialize()
+    print('Failed: Lazily decoding truncated data did not raise an error\n')
+except cq.DecodingError:
+    pass
+
+# Sized lists and dicts should decode and validate as usual, and be skipped over when decoding lazily
+for value in (document, test_values, records, [[]], 'abc'):
+    for options in ({}, {'compress': True}, {'checksum': True}, {'stream_compatible': True}, {'columnar': True, 'compact_numbers': True}):
+        encoded = cq.encode(value, sized=True, **options)
+
+        if cq.decode(encoded) != value or not cq.validate(encoded) or cq.decode(encoded, lazy=True) != value:
+            print(f'Failed: Sized encoding with {options}: {shorten(value)}\n')
+
+encoded = cq.encode(document, sized=True)
+lazy = cq.decode(encoded, lazy=True)
+
+if len(encoded) <= len(cq.encode(document)) or lazy['catalog'][-1] != records[-1] or lazy[(1, 2)] != 'tuple key':
+    print('Failed: Lazily decoding sized data\n')
+
+# Tables are defined within the containers, so containers aren't sized when using one
+if cq.encode(records, sized=True, key_table=True) != cq.encode(records, key_table=True):
+    print('Failed: Sized encoding with a key table\n')
+
+# A size that doesn't match its container should be rejected
+corrupted = bytearray(cq.encode([[1, 2], [3]], sized=True))
+corrupted[7] += 1
+
+if cq.validate(bytes(corrupted)):
+    print('Failed: Validating a corrupted size\n')
+
+try:
+    cq.decode(bytes(corrupted))
+    print('Failed: Decoding a corrupted size did not raise an error\n')
+except cq.DecodingError:
+    pass
+
 # Write the entire list to a file
 f = 'test_regular.bin'
 cq.encode(test_values, file_name=f)
@@ -44,9 +411,177 @@ if cq.validate(file_name=f) == False:
 if cq.decode(file_name=f) != test_values:
     print(f"Incorrectly decoded file '{f}'\n")
 
+# Files can be mapped into memory instead of being read, of which referenced values use the mapping directly
+if cq.decode(file_name=f, mmap=True) != test_values or cq.decode(file_name=f, mmap=True, huge_pages=True) != test_values:
+    print(f"Incorrectly decoded mapped file '{f}'\n")
+
+# The offset and length only apply to buffers, so they shouldn't be silently ignored for files
+for method in (cq.decode, cq.validate):
+    for part in ({'offset': 6}, {'length': 10}, {'offset': 0, 'length': None}):
+        try:
+            method(file_name=f, **part)
+            print(f"Failed: Using a part of file '{f}' did not raise an error: {part}\n")
+        except ValueError:
+            pass
+
+cq.encode([b'abc', 'def'] * 100, file_name=f)
+referenced = cq.decode(file_name=f, mmap=True, referenced=True)[-2:]
+
+if [bytes(referenced[0]), str(referenced[1])] != [b'abc', 'def']:
+    print(f"Incorrectly decoded referenced mapped file '{f}'\n")
+
+del referenced
+
+# The mapping of a file ends at the end of the file, so truncated files should raise an error instead of reading past it
+import mmap
+
+for padding in range(1, 24):
+    value = [bytes(mmap.PAGESIZE - 16 - padding), [None] * 300, {'key': 'é' * 500}, 2**70, list(range(300))]
+
+    for kwargs in ({}, {'sized': True}, {'key_table': True}):
+        with open(f, 'wb') as file:
+            file.write(cq.encode(value, **kwargs)[:mmap.PAGESIZE])
+
+        for decode_kwargs in ({}, {'lazy': True}, {'referenced': True}):
+            try:
+                decoded = cq.decode(file_name=f, mmap=True, **decode_kwargs)
+
+                if decode_kwargs.get('lazy'):
+                    decoded.materialize()
+
+                print(f"Failed: Decoding truncated mapped file '{f}' did not raise an error\n")
+            except (cq.DecodingError, ValueError):
+                pass
+
+            decoded = None
+
+        if cq.validate(file_name=f):
+            print(f"Incorrectly validated truncated file '{f}'\n")
+
+# Compressed files are decompressed when reading them
+cq.encode(records, file_name=f, compress=True)
+
+if not cq.validate(file_name=f) or cq.decode(file_name=f) != records:
+    print(f"Incorrectly read compressed file '{f}'\n")
+
+# Checksums of files are verified while reading them in chunks
+for compress in (False, True):
+    cq.encode(records, file_name=f, checksum=True, compress=compress)
+
+    if not cq.validate(file_name=f, chunk_size=1024) or cq.decode(file_name=f) != records or cq.decode(file_name=f, mmap=True) != records:
+        print(f"Incorrectly read checksummed file '{f}'\n")
+
+    with open(f, 'r+b') as file:
+        file.seek(-100, 2)
+        byte = file.read(1)
+        file.seek(-100, 2)
+        file.write(bytes([byte[0] ^ 1]))
+
+    if cq.validate(file_name=f, chunk_size=1024):
+        print(f"Incorrectly validated corrupted file '{f}'\n")
+
+    try:
+        cq.decode(file_name=f, mmap=True)
+        print(f"Failed: Decoding corrupted mapped file '{f}' did not raise an error\n")
+    except cq.DecodingError:
+        pass
+
+# Sizes are checked across the chunks of a file
+cq.encode(records, file_name=f, sized=True)
+
+if not cq.validate(file_name=f, chunk_size=1024) or cq.decode(file_name=f) != records:
+    print(f"Incorrectly read sized file '{f}'\n")
+
 # Clean up file
 import os
 os.remove(f)
 
+# Encode buffers grow by the growth settings, of which the factor has to be a finite number of at least 1.0
+large_values = [test_values] * 64
+
+for factor, cap in ((1.0, 1), (4.0, 64), (1.5, 1024*1024*256)):
+    cq.settings.buffer_growth(factor=factor, cap=cap)
+
+    if cq.decode(cq.encode(large_values)) != large_values:
+        print(f'Failed: Encoding with a growth factor of {factor} and cap of {cap}\n')
+
+for kwargs in ({'factor': 0.5}, {'factor': float('nan')}, {'factor': float('inf')}, {'cap': 0}):
+    try:
+        cq.settings.buffer_growth(**kwargs)
+        print(f'Failed: Invalid buffer growth settings did not raise an error: {kwargs}\n')
+    except ValueError:
+        pass
+
+# Files and larger values are processed without holding the GIL, which shouldn't affect the results of concurrent calls
+from threading import Thread
+large = cq.encode([test_values] * 64)
+results = []
+
+def use_file(i: int) -> None:
+    name = f'test_regular_{i}.bin'
+    cq.encode(test_values, file_name=name)
+    results.append(cq.validate(file_name=name) and cq.decode(file_name=name) == test_values and cq.validate(large) and cq.decode(cq.encode(test_values)) == test_values)
+    os.remove(name)
+
+threads = [Thread(target=use_file, args=(i,)) for i in range(8)]
+for t in threads: t.start()
+for t in threads: t.join()
+
+if results != [True] * 8:
+    print('Failed: Using files from multiple threads\n')
+
+# Referenced values can be released by other threads than the one that decoded them
+referenced = cq.decode(cq.encode([b'abc', 'def'] * 100), referenced=True)
+threads = [Thread(target=lambda part: part.clear(), args=(referenced[i::4],)) for i in range(4)]
+del referenced
+
+for t in threads: t.start()
+for t in threads: t.join()
+
+# Sub-interpreters with their own GIL (Python 3.12+) import their own copy of the module, and can encode at the same time
+try:
+    import _interpreters as interpreters
+    create_interpreter = lambda: interpreters.create('isolated')
+except ImportError:
+    try:
+        import _xxsubinterpreters as interpreters
+
+        def create_interpreter():
+            # Sub-interpreters share the GIL before Python 3.12
+            try:
+                return interpreters.create(isolated=True)
+            except TypeError:
+                return interpreters.create()
+    except ImportError:
+        interpreters = None
+
+if interpreters is not None:
+    code = """
+import compaqt as cq
+value = [{'id': i, 'name': str(i), 'values': [i / 3, None, True]} for i in range(100)]
+cq.settings.manual_allocations(64, 256)
+assert cq.decode(cq.encode(value, key_table=True)) == value
+assert bytes(cq.decode(cq.Encoder().encode([b'abc']), referenced=True)[0]) == b'abc'
+"""
+    failures = []
+
+    def run_interpreter(interp) -> None:
+        try:
+            # Newer versions return the error instead of raising it
+            if interpreters.run_string(interp, code) is not None:
+                failures.append(interp)
+        except Exception:
+            failures.append(interp)
+
+    interps = [create_interpreter() for _ in range(4)]
+    threads = [Thread(target=run_interpreter, args=(interp,)) for interp in interps]
+
+    for t in threads: t.start()
+    for t in threads: t.join()
+    for interp in interps: interpreters.destroy(interp)
+
+    if failures or cq.decode(cq.encode(test_values)) != test_values:
+        print('Failed: Using the module from sub-interpreters\n')
+
 print('Finished\n')
 
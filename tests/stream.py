@@ -57,6 +57,93 @@ if dec.read(len(test_values)) != test_values:
 if dec.read(len(test_values)) != test_values:
     print(f"Invalid decoding (4.2)")
 
+# Test 5 (compressed streams)
+
+records = [{'id': i, 'name': f'user{i}', 'tags': ['a', 'b']} for i in range(2000)]
+
+enc = cq.StreamEncoder(f, list, chunk_size=1024, compress=True)
+enc.write(records)
+enc.write(test_values)
+
+cq.validate(file_name=f, err_on_invalid=True)
+
+if cq.decode(file_name=f) != records + test_values:
+    print(f"Invalid decoding (5.1)")
+
+dec = cq.StreamDecoder(f, chunk_size=256)
+if dec.read(1500) != records[:1500] or dec.read(500) != records[1500:] or dec.read() != test_values:
+    print(f"Invalid decoding (5.2)")
+
+enc = cq.StreamEncoder(f, list, resume_stream=True, compress=True)
+enc.write(records)
+
+dec = cq.StreamDecoder(f)
+if dec.read() != records + test_values + records:
+    print(f"Invalid decoding (5.3)")
+
+try:
+    cq.StreamEncoder(f, list, resume_stream=True)
+    print(f"Resumed a compressed stream without compression")
+except ValueError:
+    pass
+
+# Stream compatible data compressed by `encode` can be read by stream decoders
+cq.encode(records, file_name=f, stream_compatible=True, compress=True)
+
+dec = cq.StreamDecoder(f)
+if dec.read(1000) != records[:1000] or dec.read() != records[1000:]:
+    print(f"Invalid decoding (5.4)")
+
+# Test 6 (checksummed streams)
+
+for compress in (False, True):
+    enc = cq.StreamEncoder(f, list, chunk_size=1024, compress=compress, checksum=True)
+    enc.write(records)
+    enc.write(test_values)
+
+    if not cq.validate(file_name=f) or cq.decode(file_name=f) != records + test_values:
+        print(f"Invalid decoding (6.1)")
+
+    dec = cq.StreamDecoder(f, chunk_size=256)
+    if dec.read(1500) != records[:1500] or dec.read() != records[1500:] + test_values:
+        print(f"Invalid decoding (6.2)")
+
+    # Checksummed blocks can be compressed or not, so resuming only has to match the checksums
+    enc = cq.StreamEncoder(f, list, resume_stream=True, compress=not compress, checksum=True)
+    enc.write(records)
+
+    if cq.StreamDecoder(f).read() != records + test_values + records:
+        print(f"Invalid decoding (6.3)")
+
+try:
+    cq.StreamEncoder(f, list, resume_stream=True)
+    print(f"Resumed a checksummed stream without checksums")
+except ValueError:
+    pass
+
+# Corrupting a block should fail its checksum when reading it
+with open(f, 'r+b') as file:
+    file.seek(-10, 2)
+    byte = file.read(1)
+    file.seek(-10, 2)
+    file.write(bytes([byte[0] ^ 1]))
+
+if cq.validate(file_name=f):
+    print(f"Incorrectly validated a corrupted stream")
+
+dec = cq.StreamDecoder(f)
+try:
+    dec.read()
+    print(f"Decoded a corrupted stream")
+except cq.DecodingError:
+    pass
+
+cq.encode(records, file_name=f, stream_compatible=True, checksum=True)
+
+dec = cq.StreamDecoder(f)
+if dec.read(1000) != records[:1000] or dec.read() != records[1000:]:
+    print(f"Invalid decoding (6.4)")
+
 # Clean up file
 import os
 os.remove(f)
@@ -1,13 +1,27 @@
 # A list of all values to test
 
+from array import array
+
 test_values = [
     0,
     1,
     -1,
+    127,
+    128,
+    -128,
+    -129,
     123456789,
     -123456789,
     2**31 - 1,
     -(2**31),
+    2**63 - 1,
+    -(2**63),
+    2**63,
+    -(2**63) - 1,
+    2**127 + 12345,
+    -(2**1000),
+    2**20000 + 1,
+    -(2**20000) - 1,
     0.0,
     1.0,
     -1.0,
@@ -32,6 +46,9 @@ test_values = [
     "Length mode 2: " + "A" * 1024,
     "Tab\tDelimited",
     "Café",
+    "Latin-1: " + "àéîõü ÿ" * 16,
+    "UCS-2: Привет, мир! 你好，世界" * 8,
+    "UCS-4: 🙂 🚀 𝄞" * 8,
     "a1b2c3",
     "A\0B\0C\0D\0E",
     b"",
@@ -67,5 +84,19 @@ test_values = [
     None,
     [True, False, None],
     {True: {False: None}},
+    (),
+    (1, "two", 3.0),
+    ((1, 2), [3, (4,)]),
+    set(),
+    {1, "two", b"three"},
+    frozenset([1, 2, 3]),
+    {"set": {(1, 2), frozenset([3])}},
+    bytearray(),
+    bytearray(b"Hello, World!"),
+    memoryview(b"Hello, World!"),
+    array("d", [1.5, -2.25, 1e300]),
+    array("q", [0, -1, 2**63 - 1]),
+    array("B", b"raw bytes"),
+    array("f"),
 ]
 